@@ -1,11 +1,30 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #ifdef _WIN32
 #include <fcntl.h>
 #include <io.h>
+#include <malloc.h>
+#endif
+
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
 #endif
 
 #pragma pack(push, 1)
@@ -70,251 +89,7256 @@ void apply_xor(uint8_t *data, size_t size, int value) {
   }
 }
 
-void print_usage(const char *program_name) {
-  printf("Usage: %s <input.wav> <output.wav> <operation> <value>\n",
-         program_name);
-  printf("Operations:\n");
-  printf("  --right -r   Right shift by value (0-7)\n");
-  printf("  --left -l    Left shift by value (0-7)\n");
-  printf("  --not -n     Bitwise NOT (value ignored)\n");
-  printf("  --and -a     Bitwise AND with value (0-255)\n");
-  printf("  --or -o      Bitwise OR with value (0-255)\n");
-  printf("  --xor -z     Bitwise XOR with value (0-255)\n");
+void apply_rotate_left(uint8_t *data, size_t size, int value) {
+  int shift = value & 7;
+  for (size_t i = 0; i < size; i++) {
+    data[i] = (uint8_t)((data[i] << shift) | (data[i] >> ((8 - shift) & 7)));
+  }
 }
 
-int parse_wav_file(FILE *file, WavFmtData *fmtData, uint32_t *data_size,
-                   long *data_offset) {
-  WavRiffHeader riffHeader;
+void apply_rotate_right(uint8_t *data, size_t size, int value) {
+  int shift = value & 7;
+  for (size_t i = 0; i < size; i++) {
+    data[i] = (uint8_t)((data[i] >> shift) | (data[i] << ((8 - shift) & 7)));
+  }
+}
 
-  if (fread(&riffHeader, sizeof(WavRiffHeader), 1, file) != 1) {
-    return 0;
+void apply_bit_reverse(uint8_t *data, size_t size, int value) {
+  for (size_t i = 0; i < size; i++) {
+    uint8_t b = data[i];
+    b = (uint8_t)((b >> 4) | (b << 4));
+    b = (uint8_t)(((b & 0xCC) >> 2) | ((b & 0x33) << 2));
+    data[i] = (uint8_t)(((b & 0xAA) >> 1) | ((b & 0x55) << 1));
   }
+}
 
-  if (strncmp(riffHeader.chunkID, "RIFF", 4) != 0 ||
-      strncmp(riffHeader.format, "WAVE", 4) != 0) {
-    return 0;
+void apply_nibble_swap(uint8_t *data, size_t size, int value) {
+  for (size_t i = 0; i < size; i++) {
+    data[i] = (uint8_t)((data[i] >> 4) | (data[i] << 4));
+  }
+}
+
+void apply_gray_encode(uint8_t *data, size_t size, int value) {
+  for (size_t i = 0; i < size; i++) {
+    data[i] ^= data[i] >> 1;
   }
+}
 
-  WavChunkHeader chunkHeader;
-  int fmt_found = 0;
-  int data_found = 0;
+void apply_gray_decode(uint8_t *data, size_t size, int value) {
+  for (size_t i = 0; i < size; i++) {
+    uint8_t b = data[i];
+    b ^= b >> 1;
+    b ^= b >> 2;
+    data[i] = b ^ (b >> 4);
+  }
+}
 
-  while (fread(&chunkHeader, sizeof(WavChunkHeader), 1, file) == 1) {
-    if (strncmp(chunkHeader.subchunkID, "fmt ", 4) == 0) {
-      if (fread(fmtData, sizeof(WavFmtData), 1, file) != 1) {
-        return 0;
+// Keeps bit plane value (0 the least significant) as a full scale signal:
+// 0xFF where the bit is set, 0 elsewhere.
+void apply_bit_plane(uint8_t *data, size_t size, int value) {
+  for (size_t i = 0; i < size; i++) {
+    data[i] = (uint8_t)(0 - ((data[i] >> value) & 1));
+  }
+}
+
+// Scratch state of a frame op stage, kept across buffers of one region.
+typedef struct {
+  int held;
+  uint8_t frame[];
+} FrameOpState;
+
+int lane_mask_is_full(const uint8_t *lane_mask, size_t lane_count) {
+  if (!lane_mask) {
+    return 1;
+  }
+  for (size_t lane = 0; lane < lane_count; lane++) {
+    if (!lane_mask[lane]) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Reduces samples to value bits, rounding to the nearest level. 8-bit
+// samples are unsigned and 16-bit samples signed, as in PCM WAV files.
+void apply_crush(uint8_t *data, size_t size, uint64_t position,
+                 const WavFmtData *fmtData, const uint8_t *lane_mask,
+                 int value, FrameOpState *state) {
+  int bits = fmtData->bitsPerSample;
+  if (value >= bits) {
+    return;
+  }
+
+  int shift = bits - value;
+  int32_t half = 1 << (shift - 1);
+  size_t lane_count = fmtData->blockAlign;
+  int full = lane_mask_is_full(lane_mask, lane_count);
+
+  if (bits == 8) {
+    int32_t max_level = 256 - (1 << shift);
+    if (full) {
+      for (size_t i = 0; i < size; i++) {
+        int32_t level = ((data[i] + half) >> shift) << shift;
+        data[i] = (uint8_t)(level > max_level ? max_level : level);
+      }
+    } else {
+      size_t lane = position % lane_count;
+      for (size_t i = 0; i < size; i++) {
+        if (lane_mask[lane]) {
+          int32_t level = ((data[i] + half) >> shift) << shift;
+          data[i] = (uint8_t)(level > max_level ? max_level : level);
+        }
+        if (++lane == lane_count) {
+          lane = 0;
+        }
       }
+    }
+    return;
+  }
 
-      if (chunkHeader.subchunkSize > sizeof(WavFmtData)) {
-        fseek(file, chunkHeader.subchunkSize - sizeof(WavFmtData), SEEK_CUR);
+  int16_t *samples = (int16_t *)data;
+  size_t sample_count = size / 2;
+  int32_t max_level = 32768 - (1 << shift);
+  if (full) {
+    for (size_t i = 0; i < sample_count; i++) {
+      int32_t level = ((samples[i] + half) >> shift) * (1 << shift);
+      samples[i] = (int16_t)(level > max_level ? max_level : level);
+    }
+  } else {
+    size_t lane = position % lane_count;
+    for (size_t i = 0; i < sample_count; i++) {
+      if (lane_mask[lane]) {
+        int32_t level = ((samples[i] + half) >> shift) * (1 << shift);
+        samples[i] = (int16_t)(level > max_level ? max_level : level);
       }
-      fmt_found = 1;
-    } else if (strncmp(chunkHeader.subchunkID, "data", 4) == 0) {
-      *data_size = chunkHeader.subchunkSize;
-      *data_offset = ftell(file);
-      data_found = 1;
-      break;
+      lane += 2;
+      if (lane == lane_count) {
+        lane = 0;
+      }
+    }
+  }
+}
+
+// Sample-and-hold: every frame repeats the first frame of its group of value
+// frames. Groups are counted from the start of the data chunk, and the held
+// frame is carried in state when a group spans two buffers.
+void apply_decimate(uint8_t *data, size_t size, uint64_t position,
+                    const WavFmtData *fmtData, const uint8_t *lane_mask,
+                    int value, FrameOpState *state) {
+  size_t frame_size = fmtData->blockAlign;
+  uint64_t first_frame = position / frame_size;
+  size_t frame_count = size / frame_size;
+  int full = lane_mask_is_full(lane_mask, frame_size);
+
+  if (value <= 1) {
+    return;
+  }
+
+  const uint8_t *source = state->held ? state->frame : NULL;
+  for (size_t f = 0; f < frame_count; f++) {
+    uint8_t *frame = data + f * frame_size;
+    if ((first_frame + f) % value == 0) {
+      source = frame;
+      continue;
+    }
+    if (!source) {
+      continue;
+    }
+    if (full) {
+      memcpy(frame, source, frame_size);
     } else {
-      fseek(file, chunkHeader.subchunkSize, SEEK_CUR);
+      for (size_t lane = 0; lane < frame_size; lane++) {
+        if (lane_mask[lane]) {
+          frame[lane] = source[lane];
+        }
+      }
     }
   }
 
-  return (fmt_found && data_found);
+  if (source) {
+    memcpy(state->frame, source, frame_size);
+    state->held = 1;
+  }
 }
 
-int process_wav_file(const char *input_filename, const char *output_filename,
-                     const char *operation, int value) {
-  FILE *input_file = fopen(input_filename, "rb");
-  if (!input_file) {
-    printf("Error: cannot open input file %s\n", input_filename);
-    return 1;
+// Per-sample expressions such as "s ^ (t >> 8)". s is the byte value, t the
+// frame (sample) index, c the channel and i the byte index in the data chunk.
+// Expressions are compiled once to a small register bytecode which is then
+// run over blocks of EXPR_BLOCK bytes, one instruction at a time, so every
+// instruction is a tight loop the compiler can vectorize.
+#define EXPR_BLOCK 256
+#define EXPR_MAX_CODE 64
+#define EXPR_MAX_REGS 16
+#define EXPR_VAR_REGS 4
+#define MAX_EXPR_PROGRAMS 32
+
+typedef enum {
+  EXPR_CONST,
+  EXPR_ADD,
+  EXPR_SUB,
+  EXPR_MUL,
+  EXPR_DIV,
+  EXPR_MOD,
+  EXPR_AND,
+  EXPR_OR,
+  EXPR_XOR,
+  EXPR_SHL,
+  EXPR_SHR,
+  EXPR_NOT,
+  EXPR_NEG
+} ExprOpcode;
+
+typedef struct {
+  uint8_t opcode;
+  uint8_t dst;
+  uint8_t a;
+  uint8_t b;
+  uint8_t b_is_imm;
+  uint32_t imm;
+} ExprInstr;
+
+typedef struct {
+  ExprInstr code[EXPR_MAX_CODE];
+  int length;
+  int result;
+  int uses;
+} ExprProgram;
+
+typedef struct {
+  int is_const;
+  int is_temp;
+  uint32_t value;
+  int reg;
+} ExprOperand;
+
+typedef struct {
+  const char *p;
+  ExprProgram *program;
+  int top;
+  int error;
+} ExprParser;
+
+ExprProgram expr_programs[MAX_EXPR_PROGRAMS];
+int expr_program_count = 0;
+
+uint32_t fold_expr(int opcode, uint32_t a, uint32_t b) {
+  switch (opcode) {
+  case EXPR_ADD:
+    return a + b;
+  case EXPR_SUB:
+    return a - b;
+  case EXPR_MUL:
+    return a * b;
+  case EXPR_DIV:
+    return b ? a / b : 0;
+  case EXPR_MOD:
+    return b ? a % b : 0;
+  case EXPR_AND:
+    return a & b;
+  case EXPR_OR:
+    return a | b;
+  case EXPR_XOR:
+    return a ^ b;
+  case EXPR_SHL:
+    return a << (b & 31);
+  case EXPR_SHR:
+    return a >> (b & 31);
+  case EXPR_NOT:
+    return ~a;
+  case EXPR_NEG:
+    return 0u - a;
+  default:
+    return 0;
   }
+}
 
-  WavFmtData fmtData;
-  uint32_t data_size;
-  long data_offset;
+void emit_expr(ExprParser *parser, int opcode, int dst, int a, int b,
+               int b_is_imm, uint32_t imm) {
+  ExprProgram *program = parser->program;
+  if (program->length == EXPR_MAX_CODE) {
+    parser->error = 1;
+    return;
+  }
+  ExprInstr *instr = &program->code[program->length++];
+  instr->opcode = (uint8_t)opcode;
+  instr->dst = (uint8_t)dst;
+  instr->a = (uint8_t)a;
+  instr->b = (uint8_t)b;
+  instr->b_is_imm = (uint8_t)b_is_imm;
+  instr->imm = imm;
+}
 
-  if (!parse_wav_file(input_file, &fmtData, &data_size, &data_offset)) {
-    printf("Error: invalid WAV file format\n");
-    fclose(input_file);
-    return 1;
+int alloc_expr_reg(ExprParser *parser) {
+  if (parser->top == EXPR_MAX_REGS) {
+    parser->error = 1;
+    return EXPR_MAX_REGS - 1;
   }
+  return parser->top++;
+}
 
-  printf("WAV file info:\n");
-  printf("  Channels: %d\n", fmtData.numChannels);
-  printf("  Sample rate: %d Hz\n", fmtData.sampleRate);
-  printf("  Bits per sample: %d\n", fmtData.bitsPerSample);
-  printf("  Data size: %u bytes\n", data_size);
-  printf("  Data offset: %ld bytes\n", data_offset);
-
-  if (fmtData.audioFormat != 1) {
-    printf("Error: only PCM format supported\n");
-    fclose(input_file);
-    return 1;
+ExprOperand emit_expr_unary(ExprParser *parser, int opcode,
+                            ExprOperand operand) {
+  if (operand.is_const) {
+    operand.value = fold_expr(opcode, operand.value, 0);
+    return operand;
   }
+  int dst = operand.is_temp ? operand.reg : alloc_expr_reg(parser);
+  emit_expr(parser, opcode, dst, operand.reg, 0, 1, 0);
+  operand.reg = dst;
+  operand.is_temp = 1;
+  return operand;
+}
 
-  if (fmtData.bitsPerSample != 8 && fmtData.bitsPerSample != 16) {
-    printf("Error: only 8-bit and 16-bit PCM supported\n");
-    fclose(input_file);
-    return 1;
+ExprOperand emit_expr_binary(ExprParser *parser, int opcode, ExprOperand l,
+                             ExprOperand r) {
+  if (l.is_const && r.is_const) {
+    l.value = fold_expr(opcode, l.value, r.value);
+    return l;
   }
 
-  FILE *output_file = fopen(output_filename, "wb");
-  if (!output_file) {
-    printf("Error: cannot create output file %s\n", output_filename);
-    fclose(input_file);
-    return 1;
+  int commutative = opcode == EXPR_ADD || opcode == EXPR_MUL ||
+                    opcode == EXPR_AND || opcode == EXPR_OR ||
+                    opcode == EXPR_XOR;
+  if (l.is_const && commutative) {
+    ExprOperand swap = l;
+    l = r;
+    r = swap;
   }
 
-  rewind(input_file);
-  uint8_t *header_buffer = (uint8_t *)malloc(data_offset);
-  if (!header_buffer) {
-    printf("Error: cannot allocate memory for header\n");
-    fclose(input_file);
-    fclose(output_file);
-    return 1;
+  int dst;
+  if (l.is_temp) {
+    dst = l.reg;
+  } else if (r.is_temp) {
+    dst = r.reg;
+  } else {
+    dst = alloc_expr_reg(parser);
   }
 
-  if (fread(header_buffer, 1, data_offset, input_file) != data_offset) {
-    printf("Error: cannot read file header\n");
-    free(header_buffer);
-    fclose(input_file);
-    fclose(output_file);
-    return 1;
+  if (r.is_const) {
+    emit_expr(parser, opcode, dst, l.reg, 0, 1, r.value);
+  } else if (l.is_const) {
+    // The scratch register above the stack only lives for this instruction.
+    int scratch = parser->top;
+    if (scratch == EXPR_MAX_REGS) {
+      parser->error = 1;
+      return l;
+    }
+    emit_expr(parser, EXPR_CONST, scratch, 0, 0, 1, l.value);
+    emit_expr(parser, opcode, dst, scratch, r.reg, 0, 0);
+  } else {
+    emit_expr(parser, opcode, dst, l.reg, r.reg, 0, 0);
   }
 
-  if (fwrite(header_buffer, 1, data_offset, output_file) != data_offset) {
-    printf("Error: cannot write file header\n");
-    free(header_buffer);
-    fclose(input_file);
-    fclose(output_file);
-    return 1;
+  if (l.is_temp && r.is_temp) {
+    parser->top--;
   }
 
-  free(header_buffer);
+  ExprOperand result;
+  result.is_const = 0;
+  result.is_temp = 1;
+  result.value = 0;
+  result.reg = dst;
+  return result;
+}
 
-  const size_t BUFFER_SIZE = 1024 * 1024;
-  uint8_t *buffer = (uint8_t *)malloc(BUFFER_SIZE);
-  if (!buffer) {
-    printf("Error: cannot allocate buffer\n");
-    fclose(input_file);
-    fclose(output_file);
-    return 1;
+void skip_expr_spaces(ExprParser *parser) {
+  while (*parser->p == ' ' || *parser->p == '\t') {
+    parser->p++;
   }
+}
 
-  size_t total_processed = 0;
-  size_t bytes_remaining = data_size;
+ExprOperand parse_expr_or(ExprParser *parser);
 
-  printf("Processing audio data...\n");
+ExprOperand parse_expr_primary(ExprParser *parser) {
+  ExprOperand operand;
+  operand.is_const = 0;
+  operand.is_temp = 0;
+  operand.value = 0;
+  operand.reg = 0;
 
-  while (bytes_remaining > 0) {
-    size_t chunk_size =
-        (bytes_remaining < BUFFER_SIZE) ? bytes_remaining : BUFFER_SIZE;
+  skip_expr_spaces(parser);
+  char ch = *parser->p;
 
-    size_t bytes_read = fread(buffer, 1, chunk_size, input_file);
-    if (bytes_read != chunk_size) {
-      printf("Error: read incomplete chunk\n");
-      free(buffer);
-      fclose(input_file);
-      fclose(output_file);
-      return 1;
+  if (ch == '(') {
+    parser->p++;
+    operand = parse_expr_or(parser);
+    skip_expr_spaces(parser);
+    if (*parser->p != ')') {
+      parser->error = 1;
+    } else {
+      parser->p++;
     }
+  } else if (ch == '~' || ch == '-') {
+    parser->p++;
+    operand = emit_expr_unary(parser, (ch == '~') ? EXPR_NOT : EXPR_NEG,
+                              parse_expr_primary(parser));
+  } else if (ch >= '0' && ch <= '9') {
+    char *end;
+    operand.is_const = 1;
+    operand.value = (uint32_t)strtoul(parser->p, &end, 0);
+    parser->p = end;
+  } else if (ch == 's' || ch == 't' || ch == 'c' || ch == 'i') {
+    operand.reg = (ch == 's') ? 0 : (ch == 't') ? 1 : (ch == 'c') ? 2 : 3;
+    parser->program->uses |= 1 << operand.reg;
+    parser->p++;
+  } else {
+    parser->error = 1;
+  }
 
-    if (strcmp(operation, "--right") == 0 || strcmp(operation, "-r") == 0) {
-      apply_right_shift(buffer, chunk_size, value);
-    } else if (strcmp(operation, "--left") == 0 ||
-               strcmp(operation, "-l") == 0) {
-      apply_left_shift(buffer, chunk_size, value);
-    } else if (strcmp(operation, "--not") == 0 ||
-               strcmp(operation, "-n") == 0) {
-      apply_not(buffer, chunk_size, value);
-    } else if (strcmp(operation, "--and") == 0 ||
-               strcmp(operation, "-a") == 0) {
-      apply_and(buffer, chunk_size, value);
-    } else if (strcmp(operation, "--or") == 0 || strcmp(operation, "-o") == 0) {
-      apply_or(buffer, chunk_size, value);
-    } else if (strcmp(operation, "--xor") == 0 ||
-               strcmp(operation, "-z") == 0) {
-      apply_xor(buffer, chunk_size, value);
-    }
-
-    size_t bytes_written = fwrite(buffer, 1, chunk_size, output_file);
-    if (bytes_written != chunk_size) {
-      printf("Error: write incomplete chunk\n");
-      free(buffer);
-      fclose(input_file);
-      fclose(output_file);
-      return 1;
+  return operand;
+}
+
+ExprOperand parse_expr_mul(ExprParser *parser) {
+  ExprOperand l = parse_expr_primary(parser);
+  for (;;) {
+    skip_expr_spaces(parser);
+    char ch = *parser->p;
+    int opcode = (ch == '*')   ? EXPR_MUL
+                 : (ch == '/') ? EXPR_DIV
+                 : (ch == '%') ? EXPR_MOD
+                               : -1;
+    if (opcode < 0 || parser->error) {
+      return l;
     }
+    parser->p++;
+    l = emit_expr_binary(parser, opcode, l, parse_expr_primary(parser));
+  }
+}
 
-    total_processed += chunk_size;
-    bytes_remaining -= chunk_size;
+ExprOperand parse_expr_add(ExprParser *parser) {
+  ExprOperand l = parse_expr_mul(parser);
+  for (;;) {
+    skip_expr_spaces(parser);
+    char ch = *parser->p;
+    int opcode = (ch == '+') ? EXPR_ADD : (ch == '-') ? EXPR_SUB : -1;
+    if (opcode < 0 || parser->error) {
+      return l;
+    }
+    parser->p++;
+    l = emit_expr_binary(parser, opcode, l, parse_expr_mul(parser));
+  }
+}
 
-    if (data_size > 0) {
-      int progress = (int)((total_processed * 100) / data_size);
-      printf("\rProgress: %d%% (%zu/%u bytes)", progress, total_processed,
-             data_size);
-      fflush(stdout);
+ExprOperand parse_expr_shift(ExprParser *parser) {
+  ExprOperand l = parse_expr_add(parser);
+  for (;;) {
+    skip_expr_spaces(parser);
+    int opcode = (strncmp(parser->p, "<<", 2) == 0)   ? EXPR_SHL
+                 : (strncmp(parser->p, ">>", 2) == 0) ? EXPR_SHR
+                                                      : -1;
+    if (opcode < 0 || parser->error) {
+      return l;
     }
+    parser->p += 2;
+    l = emit_expr_binary(parser, opcode, l, parse_expr_add(parser));
   }
+}
 
-  printf("\n");
+ExprOperand parse_expr_and(ExprParser *parser) {
+  ExprOperand l = parse_expr_shift(parser);
+  for (;;) {
+    skip_expr_spaces(parser);
+    if (*parser->p != '&' || parser->error) {
+      return l;
+    }
+    parser->p++;
+    l = emit_expr_binary(parser, EXPR_AND, l, parse_expr_shift(parser));
+  }
+}
 
-  free(buffer);
-  fclose(input_file);
-  fclose(output_file);
+ExprOperand parse_expr_xor(ExprParser *parser) {
+  ExprOperand l = parse_expr_and(parser);
+  for (;;) {
+    skip_expr_spaces(parser);
+    if (*parser->p != '^' || parser->error) {
+      return l;
+    }
+    parser->p++;
+    l = emit_expr_binary(parser, EXPR_XOR, l, parse_expr_and(parser));
+  }
+}
 
-  return 0;
+ExprOperand parse_expr_or(ExprParser *parser) {
+  ExprOperand l = parse_expr_xor(parser);
+  for (;;) {
+    skip_expr_spaces(parser);
+    if (*parser->p != '|' || parser->error) {
+      return l;
+    }
+    parser->p++;
+    l = emit_expr_binary(parser, EXPR_OR, l, parse_expr_xor(parser));
+  }
 }
 
-int main(int argc, char *argv[]) {
-#ifdef _WIN32
-  _setmode(_fileno(stdin), _O_BINARY);
-  _setmode(_fileno(stdout), _O_BINARY);
-#endif
+// Compiles text into a new program and stores its index in value, which is
+// how expression ops carry their program through an op chain.
+int compile_expression(const char *text, int *value) {
+  if (expr_program_count == MAX_EXPR_PROGRAMS) {
+    return 0;
+  }
 
-  if (argc != 5 && !(argc == 4 && (strcmp(argv[3], "--not") == 0 ||
-                                   strcmp(argv[3], "-n") == 0))) {
-    print_usage(argv[0]);
-    return 1;
+  ExprProgram *program = &expr_programs[expr_program_count];
+  memset(program, 0, sizeof(ExprProgram));
+
+  ExprParser parser;
+  parser.p = text;
+  parser.program = program;
+  parser.top = EXPR_VAR_REGS;
+  parser.error = 0;
+
+  ExprOperand result = parse_expr_or(&parser);
+  skip_expr_spaces(&parser);
+  if (parser.error || *parser.p != '\0') {
+    return 0;
   }
 
-  const char *input_filename = argv[1];
-  const char *output_filename = argv[2];
-  const char *operation = argv[3];
-  int value = 0;
+  if (result.is_const) {
+    result.reg = alloc_expr_reg(&parser);
+    emit_expr(&parser, EXPR_CONST, result.reg, 0, 0, 1, result.value);
+  }
+  if (parser.error) {
+    return 0;
+  }
 
-  if (argc == 5) {
-    value = atoi(argv[4]);
+  program->result = result.reg;
+  *value = expr_program_count++;
+  return 1;
+}
 
-    if ((strcmp(operation, "--right") == 0 || strcmp(operation, "-r") == 0 ||
-         strcmp(operation, "--left") == 0 || strcmp(operation, "-l") == 0)) {
-      if (value < 0 || value > 7) {
-        printf("Error: shift value must be in range 0-7\n");
-        return 1;
+void run_expr_program(const ExprProgram *program,
+                      uint32_t regs[EXPR_MAX_REGS][EXPR_BLOCK], size_t n) {
+  for (int pc = 0; pc < program->length; pc++) {
+    const ExprInstr *instr = &program->code[pc];
+    uint32_t *d = regs[instr->dst];
+    const uint32_t *a = regs[instr->a];
+    const uint32_t *b = regs[instr->b];
+    uint32_t imm = instr->imm;
+
+#define EXPR_LOOP(imm_expr, reg_expr)                                          \
+  if (instr->b_is_imm) {                                                       \
+    for (size_t k = 0; k < n; k++) {                                           \
+      d[k] = (imm_expr);                                                       \
+    }                                                                          \
+  } else {                                                                     \
+    for (size_t k = 0; k < n; k++) {                                           \
+      d[k] = (reg_expr);                                                       \
+    }                                                                          \
+  }
+
+    switch (instr->opcode) {
+    case EXPR_CONST:
+      for (size_t k = 0; k < n; k++) {
+        d[k] = imm;
       }
-    } else if (strcmp(operation, "--and") == 0 ||
-               strcmp(operation, "-a") == 0 || strcmp(operation, "--or") == 0 ||
-               strcmp(operation, "-o") == 0 ||
-               strcmp(operation, "--xor") == 0 ||
-               strcmp(operation, "-z") == 0) {
-      if (value < 0 || value > 255) {
-        printf("Error: operation value must be in range 0-255\n");
-        return 1;
+      break;
+    case EXPR_ADD:
+      EXPR_LOOP(a[k] + imm, a[k] + b[k]);
+      break;
+    case EXPR_SUB:
+      EXPR_LOOP(a[k] - imm, a[k] - b[k]);
+      break;
+    case EXPR_MUL:
+      EXPR_LOOP(a[k] * imm, a[k] * b[k]);
+      break;
+    case EXPR_DIV:
+      EXPR_LOOP(imm ? a[k] / imm : 0, b[k] ? a[k] / b[k] : 0);
+      break;
+    case EXPR_MOD:
+      EXPR_LOOP(imm ? a[k] % imm : 0, b[k] ? a[k] % b[k] : 0);
+      break;
+    case EXPR_AND:
+      EXPR_LOOP(a[k] & imm, a[k] & b[k]);
+      break;
+    case EXPR_OR:
+      EXPR_LOOP(a[k] | imm, a[k] | b[k]);
+      break;
+    case EXPR_XOR:
+      EXPR_LOOP(a[k] ^ imm, a[k] ^ b[k]);
+      break;
+    case EXPR_SHL:
+      EXPR_LOOP(a[k] << (imm & 31), a[k] << (b[k] & 31));
+      break;
+    case EXPR_SHR:
+      EXPR_LOOP(a[k] >> (imm & 31), a[k] >> (b[k] & 31));
+      break;
+    case EXPR_NOT:
+      for (size_t k = 0; k < n; k++) {
+        d[k] = ~a[k];
       }
+      break;
+    case EXPR_NEG:
+      for (size_t k = 0; k < n; k++) {
+        d[k] = 0u - a[k];
+      }
+      break;
     }
+
+#undef EXPR_LOOP
   }
+}
 
-  printf("Operation: %s", operation);
-  if (argc == 5) {
-    printf(" with value %d", value);
+// lane_mask marks the byte lanes of a frame the expression writes, NULL
+// means all of them.
+void apply_expr(uint8_t *data, size_t size, uint64_t position,
+                const WavFmtData *fmtData, const uint8_t *lane_mask,
+                int value, FrameOpState *state) {
+  const ExprProgram *program = &expr_programs[value];
+  uint32_t regs[EXPR_MAX_REGS][EXPR_BLOCK];
+  size_t lane_count = fmtData->blockAlign;
+  size_t bytes_per_sample = (fmtData->bitsPerSample + 7) / 8;
+
+  for (size_t offset = 0; offset < size; offset += EXPR_BLOCK) {
+    size_t n = (size - offset < EXPR_BLOCK) ? size - offset : EXPR_BLOCK;
+    uint8_t *block = data + offset;
+    uint64_t byte_index = position + offset;
+
+    for (size_t k = 0; k < n; k++) {
+      regs[0][k] = block[k];
+    }
+    if ((lane_count & (lane_count - 1)) == 0 &&
+        (bytes_per_sample & (bytes_per_sample - 1)) == 0) {
+      // Power of two frames, the usual case, need no per-byte counters.
+      int frame_shift = 0;
+      int sample_shift = 0;
+      while (((size_t)1 << frame_shift) < lane_count) {
+        frame_shift++;
+      }
+      while (((size_t)1 << sample_shift) < bytes_per_sample) {
+        sample_shift++;
+      }
+      uint32_t base = (uint32_t)byte_index;
+      uint32_t lane_bits = (uint32_t)lane_count - 1;
+      if (program->uses & 2) {
+        uint64_t first_frame = byte_index >> frame_shift;
+        uint32_t first_lane = (uint32_t)(byte_index & lane_bits);
+        for (size_t k = 0; k < n; k++) {
+          regs[1][k] = (uint32_t)first_frame +
+                       ((first_lane + (uint32_t)k) >> frame_shift);
+        }
+      }
+      if (program->uses & 4) {
+        for (size_t k = 0; k < n; k++) {
+          regs[2][k] = ((base + (uint32_t)k) & lane_bits) >> sample_shift;
+        }
+      }
+    } else {
+      if (program->uses & 2) {
+        uint64_t frame = byte_index / lane_count;
+        size_t lane = byte_index % lane_count;
+        for (size_t k = 0; k < n; k++) {
+          regs[1][k] = (uint32_t)frame;
+          if (++lane == lane_count) {
+            lane = 0;
+            frame++;
+          }
+        }
+      }
+      if (program->uses & 4) {
+        size_t lane = byte_index % lane_count;
+        for (size_t k = 0; k < n; k++) {
+          regs[2][k] = (uint32_t)(lane / bytes_per_sample);
+          if (++lane == lane_count) {
+            lane = 0;
+          }
+        }
+      }
+    }
+    if (program->uses & 8) {
+      for (size_t k = 0; k < n; k++) {
+        regs[3][k] = (uint32_t)(byte_index + k);
+      }
+    }
+
+    run_expr_program(program, regs, n);
+
+    const uint32_t *result = regs[program->result];
+    if (!lane_mask) {
+      for (size_t k = 0; k < n; k++) {
+        block[k] = (uint8_t)result[k];
+      }
+    } else {
+      size_t lane = byte_index % lane_count;
+      for (size_t k = 0; k < n; k++) {
+        if (lane_mask[lane]) {
+          block[k] = (uint8_t)result[k];
+        }
+        if (++lane == lane_count) {
+          lane = 0;
+        }
+      }
+    }
   }
-  printf("\n");
+}
 
-  int result =
-      process_wav_file(input_filename, output_filename, operation, value);
+// Seeded bit noise: flip XORs and dropout clears bits of the data, each bit
+// hit with probability rate. The noise of every NOISE_BLOCK bytes of the data
+// chunk comes from its own generator, seeded from the op's seed and the
+// block's index, so output depends only on the seed and never on buffer
+// sizes, regions or threads. Dense rates build the masks with a vectorized
+// xoshiro256++ (NOISE_LANES independent streams kept as arrays, so the
+// compiler can put the lanes in SIMD registers) and combine random words
+// digit by digit of the rate, which gives bits set with that probability.
+// Sparse rates jump from one hit to the next with geometric gaps instead.
+#define NOISE_BLOCK 4096
+#define NOISE_WORDS (NOISE_BLOCK / 8)
+#define NOISE_LANES 8
+#define NOISE_DIGITS 24
+#define NOISE_PRECISION 12
+#define NOISE_SPARSE_RATE (1.0 / 256)
+#define MAX_NOISE_SPECS 32
 
-  if (result == 0) {
+typedef struct {
+  double rate;
+  uint64_t seed;
+} NoiseSpec;
+
+NoiseSpec noise_specs[MAX_NOISE_SPECS];
+int noise_spec_count = 0;
+
+// Parses "RATE[:SEED]" and stores its index in value, as expressions do.
+int parse_noise(const char *text, int *value) {
+  if (noise_spec_count == MAX_NOISE_SPECS) {
+    return 0;
+  }
+  NoiseSpec *spec = &noise_specs[noise_spec_count];
+  char *end;
+  spec->rate = strtod(text, &end);
+  spec->seed = 0;
+  if (end == text || spec->rate < 0 || spec->rate > 1) {
+    return 0;
+  }
+  if (*end == ':') {
+    const char *seed = end + 1;
+    spec->seed = strtoull(seed, &end, 0);
+    if (end == seed) {
+      return 0;
+    }
+  }
+  if (*end != '\0') {
+    return 0;
+  }
+  *value = noise_spec_count++;
+  return 1;
+}
+
+uint64_t splitmix64(uint64_t *state) {
+  uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
+
+typedef struct {
+  uint64_t s0[NOISE_LANES];
+  uint64_t s1[NOISE_LANES];
+  uint64_t s2[NOISE_LANES];
+  uint64_t s3[NOISE_LANES];
+} NoiseGenerator;
+
+void seed_noise(NoiseGenerator *generator, uint64_t seed, uint64_t block) {
+  uint64_t state = seed ^ (block * 0xD1B54A32D192ED03ull);
+  for (int l = 0; l < NOISE_LANES; l++) {
+    generator->s0[l] = splitmix64(&state);
+    generator->s1[l] = splitmix64(&state);
+    generator->s2[l] = splitmix64(&state);
+    generator->s3[l] = splitmix64(&state);
+  }
+}
+
+// Fills words (a multiple of NOISE_LANES) with random 64-bit words.
+void fill_noise(NoiseGenerator *restrict generator, uint64_t *restrict out,
+                size_t words) {
+  for (size_t w = 0; w < words; w += NOISE_LANES) {
+    for (int l = 0; l < NOISE_LANES; l++) {
+      uint64_t s0 = generator->s0[l];
+      uint64_t s1 = generator->s1[l];
+      uint64_t s2 = generator->s2[l];
+      uint64_t s3 = generator->s3[l];
+      uint64_t sum = s0 + s3;
+      out[w + l] = ((sum << 23) | (sum >> 41)) + s0;
+      uint64_t t = s1 << 17;
+      s2 ^= s0;
+      s3 ^= s1;
+      s1 ^= s2;
+      s0 ^= s3;
+      s2 ^= t;
+      generator->s0[l] = s0;
+      generator->s1[l] = s1;
+      generator->s2[l] = s2;
+      generator->s3[l] = (s3 << 45) | (s3 >> 19);
+    }
+  }
+}
+
+// Builds the mask of one noise block: every bit set with probability rate.
+void noise_mask(const NoiseSpec *spec, uint64_t block,
+                uint64_t mask[NOISE_WORDS]) {
+  NoiseGenerator generator;
+  seed_noise(&generator, spec->seed, block);
+
+  if (spec->rate >= 1.0) {
+    memset(mask, 0xFF, NOISE_WORDS * 8);
+    return;
+  }
+  memset(mask, 0, NOISE_WORDS * 8);
+  if (spec->rate <= 0.0) {
+    return;
+  }
+
+  if (spec->rate < NOISE_SPARSE_RATE) {
+    uint64_t random[NOISE_LANES];
+    int used = NOISE_LANES;
+    double scale = 1.0 / log1p(-spec->rate);
+    for (uint64_t bit = 0;; bit++) {
+      if (used == NOISE_LANES) {
+        fill_noise(&generator, random, NOISE_LANES);
+        used = 0;
+      }
+      double u = ((random[used++] >> 11) + 1) * (1.0 / 9007199254740992.0);
+      double gap = floor(log(u) * scale);
+      if (gap >= NOISE_BLOCK * 8 - bit) {
+        return;
+      }
+      bit += (uint64_t)gap;
+      mask[bit / 64] |= 1ull << (bit % 64);
+    }
+  }
+
+  // The rate as a NOISE_DIGITS digit binary fraction. Going from its last
+  // digit to its first, a 1 digit ORs in a random word and a 0 digit ANDs
+  // one, which halves or raises the odds of each bit to match the fraction.
+  // Digits more than NOISE_PRECISION below the leading one are dropped.
+  // Rates within half a digit of 1 round up to 1 itself.
+  uint32_t digits = (uint32_t)(spec->rate * (1u << NOISE_DIGITS) + 0.5);
+  if (digits >> NOISE_DIGITS) {
+    memset(mask, 0xFF, NOISE_WORDS * 8);
+    return;
+  }
+  uint64_t random[NOISE_WORDS];
+  int first = NOISE_DIGITS - 1;
+  while (first > 0 && !(digits & (1u << first))) {
+    first--;
+  }
+  first = first >= NOISE_PRECISION ? first - NOISE_PRECISION : 0;
+  while (first < NOISE_DIGITS && !(digits & (1u << first))) {
+    first++;
+  }
+  for (int d = first; d < NOISE_DIGITS; d++) {
+    fill_noise(&generator, random, NOISE_WORDS);
+    if (digits & (1u << d)) {
+      for (size_t w = 0; w < NOISE_WORDS; w++) {
+        mask[w] |= random[w];
+      }
+    } else {
+      for (size_t w = 0; w < NOISE_WORDS; w++) {
+        mask[w] &= random[w];
+      }
+    }
+  }
+}
+
+void apply_noise(uint8_t *data, size_t size, uint64_t position,
+                 const uint8_t *lane_mask, size_t lane_count,
+                 const NoiseSpec *spec, int clear) {
+  uint64_t mask[NOISE_WORDS];
+  while (size > 0) {
+    uint64_t block = position / NOISE_BLOCK;
+    size_t offset = position % NOISE_BLOCK;
+    size_t n = NOISE_BLOCK - offset;
+    if (n > size) {
+      n = size;
+    }
+    noise_mask(spec, block, mask);
+    const uint8_t *bytes = (const uint8_t *)mask + offset;
+
+    if (!lane_mask && clear) {
+      for (size_t i = 0; i < n; i++) {
+        data[i] &= ~bytes[i];
+      }
+    } else if (!lane_mask) {
+      for (size_t i = 0; i < n; i++) {
+        data[i] ^= bytes[i];
+      }
+    } else {
+      size_t lane = position % lane_count;
+      for (size_t i = 0; i < n; i++) {
+        if (lane_mask[lane]) {
+          data[i] = clear ? data[i] & ~bytes[i] : data[i] ^ bytes[i];
+        }
+        if (++lane == lane_count) {
+          lane = 0;
+        }
+      }
+    }
+    data += n;
+    size -= n;
+    position += n;
+  }
+}
+
+void apply_flip(uint8_t *data, size_t size, uint64_t position,
+                const WavFmtData *fmtData, const uint8_t *lane_mask,
+                int value, FrameOpState *state) {
+  apply_noise(data, size, position, lane_mask, fmtData->blockAlign,
+              &noise_specs[value], 0);
+}
+
+void apply_dropout(uint8_t *data, size_t size, uint64_t position,
+                   const WavFmtData *fmtData, const uint8_t *lane_mask,
+                   int value, FrameOpState *state) {
+  apply_noise(data, size, position, lane_mask, fmtData->blockAlign,
+              &noise_specs[value], 1);
+}
+
+typedef void (*ByteOpKernel)(uint8_t *data, size_t size, int value);
+
+// Operations that are not plain byte maps see where the buffer sits in the
+// data chunk, which byte lanes of a frame they may write and their state.
+// Buffers always start on a frame boundary.
+typedef void (*FrameOpKernel)(uint8_t *data, size_t size, uint64_t position,
+                              const WavFmtData *fmtData,
+                              const uint8_t *lane_mask, int value,
+                              FrameOpState *state);
+
+typedef struct {
+  const char *name;
+  const char *long_flag;
+  const char *short_flag;
+  ByteOpKernel kernel;
+  FrameOpKernel frame_kernel;
+  int (*parse_value)(const char *text, int *value);
+  int takes_value;
+  int min_value;
+  int max_value;
+  int position_independent;
+} OperationInfo;
+
+const OperationInfo operations[] = {
+    {"right", "--right", "-r", apply_right_shift, NULL, NULL, 1, 0, 7, 1},
+    {"left", "--left", "-l", apply_left_shift, NULL, NULL, 1, 0, 7, 1},
+    {"not", "--not", "-n", apply_not, NULL, NULL, 0, 0, 0, 1},
+    {"and", "--and", "-a", apply_and, NULL, NULL, 1, 0, 255, 1},
+    {"or", "--or", "-o", apply_or, NULL, NULL, 1, 0, 255, 1},
+    {"xor", "--xor", "-z", apply_xor, NULL, NULL, 1, 0, 255, 1},
+    {"rotl", "--rotl", "-L", apply_rotate_left, NULL, NULL, 1, 0, 7, 1},
+    {"rotr", "--rotr", "-R", apply_rotate_right, NULL, NULL, 1, 0, 7, 1},
+    {"bitrev", "--bitrev", "-v", apply_bit_reverse, NULL, NULL, 0, 0, 0, 1},
+    {"swap", "--swap", "-s", apply_nibble_swap, NULL, NULL, 0, 0, 0, 1},
+    {"gray", "--gray", "-g", apply_gray_encode, NULL, NULL, 0, 0, 0, 1},
+    {"ungray", "--ungray", "-G", apply_gray_decode, NULL, NULL, 0, 0, 0, 1},
+    {"plane", "--plane", "-p", apply_bit_plane, NULL, NULL, 1, 0, 7, 1},
+    {"crush", "--crush", "-b", NULL, apply_crush, NULL, 1, 1, 16, 1},
+    {"decimate", "--decimate", "-d", NULL, apply_decimate, NULL, 1, 1, 4096,
+     0},
+    {"expr", "--expr", "-e", NULL, apply_expr, compile_expression, 1, 0,
+     MAX_EXPR_PROGRAMS - 1, 0},
+    {"flip", "--flip", "-f", NULL, apply_flip, parse_noise, 1, 0,
+     MAX_NOISE_SPECS - 1, 0},
+    {"dropout", "--dropout", "-x", NULL, apply_dropout, parse_noise, 1, 0,
+     MAX_NOISE_SPECS - 1, 0},
+};
+
+#define NUM_OPERATIONS (sizeof(operations) / sizeof(operations[0]))
+#define MAX_CHAIN_OPS 16
+
+typedef struct {
+  const OperationInfo *info;
+  int value;
+} ChainOp;
+
+typedef struct {
+  ChainOp ops[MAX_CHAIN_OPS];
+  int count;
+} OpChain;
+
+typedef struct {
+  uint64_t start;
+  uint64_t end;
+  OpChain chain;
+} Region;
+
+#define MAX_CHANNELS 32
+
+typedef enum {
+  ENVELOPE_NONE,
+  ENVELOPE_RAMP,
+  ENVELOPE_LFO,
+  ENVELOPE_BREAKPOINTS
+} EnvelopeType;
+
+typedef struct {
+  double time;
+  double value;
+} Breakpoint;
+
+typedef struct {
+  EnvelopeType type;
+  double from;
+  double to;
+  double center;
+  double depth;
+  double rate;
+  Breakpoint *points;
+  size_t point_count;
+} Envelope;
+
+typedef enum {
+  DURABILITY_NONE,
+  DURABILITY_DATA,
+  DURABILITY_FULL
+} Durability;
+
+typedef enum {
+  GLITCH_NONE,
+  GLITCH_REVERSE,
+  GLITCH_STUTTER,
+  GLITCH_SHUFFLE
+} GlitchType;
+
+typedef struct {
+  GlitchType type;
+  double segment_ms;
+  uint64_t repeats;
+  uint64_t seed;
+} Glitch;
+
+typedef enum {
+  COMBINE_NONE,
+  COMBINE_XOR,
+  COMBINE_AND,
+  COMBINE_OR,
+  COMBINE_MIX
+} CombineType;
+
+typedef enum { LENGTH_FIRST, LENGTH_SHORTEST, LENGTH_LONGEST } LengthRule;
+
+#define MAX_COMBINE_INPUTS 16
+
+typedef struct {
+  CombineType type;
+  LengthRule length;
+  const char *filenames[MAX_COMBINE_INPUTS];
+  size_t count;
+} Combine;
+
+typedef struct {
+  int bits;
+  int is_signed;
+  int mono;
+} OutputFormat;
+
+typedef struct {
+  double start_time;
+  double end_time;
+  const char *regions_filename;
+  OpChain channel_chains[MAX_CHANNELS];
+  int channel_chain_set[MAX_CHANNELS];
+  Envelope automation;
+  int checksum;
+  const char *checksum_json;
+  int checksum_input;
+  int analyze;
+  const char *journal_filename;
+  Durability durability;
+  int streaming;
+  int direct_io;
+  Glitch glitch;
+  Combine combine;
+  OutputFormat output;
+  int follow;
+  double follow_idle;
+  int auto_gain;
+  double auto_gain_db;
+} ProcessOptions;
+
+const OperationInfo *find_operation(const char *token) {
+  for (size_t i = 0; i < NUM_OPERATIONS; i++) {
+    if (strcmp(token, operations[i].name) == 0 ||
+        strcmp(token, operations[i].long_flag) == 0 ||
+        strcmp(token, operations[i].short_flag) == 0) {
+      return &operations[i];
+    }
+  }
+  return NULL;
+}
+
+// Parses an op's value with its parse_value hook, or as an integer.
+int parse_op_value(const OperationInfo *info, const char *text, int *value) {
+  if (info->parse_value) {
+    return info->parse_value(text, value);
+  }
+
+  char *end;
+  long parsed = strtol(text, &end, 0);
+  if (end == text || *end != '\0') {
+    return 0;
+  }
+  *value = (int)parsed;
+  return 1;
+}
+
+// Parses a comma separated chain such as "xor:85,right:2". The special
+// chain "none" leaves the data untouched.
+int parse_op_chain(const char *spec, OpChain *chain) {
+  chain->count = 0;
+  if (strcmp(spec, "none") == 0) {
+    return 1;
+  }
+
+  const char *p = spec;
+  while (*p) {
+    char token[256];
+    size_t len = strcspn(p, ",");
+    if (len == 0 || len >= sizeof(token) || chain->count == MAX_CHAIN_OPS) {
+      return 0;
+    }
+    memcpy(token, p, len);
+    token[len] = '\0';
+    p += len;
+    if (*p == ',') {
+      p++;
+    }
+
+    char *colon = strchr(token, ':');
+    if (colon) {
+      *colon = '\0';
+    }
+
+    const OperationInfo *info = find_operation(token);
+    if (!info || (info->takes_value && !colon)) {
+      return 0;
+    }
+
+    int value = 0;
+    if (colon && !parse_op_value(info, colon + 1, &value)) {
+      return 0;
+    }
+    if (info->takes_value &&
+        (value < info->min_value || value > info->max_value)) {
+      return 0;
+    }
+
+    chain->ops[chain->count].info = info;
+    chain->ops[chain->count].value = value;
+    chain->count++;
+  }
+
+  return chain->count > 0;
+}
+
+// Only valid for chains made of byte map operations.
+void apply_chain(uint8_t *data, size_t size, const OpChain *chain) {
+  for (int i = 0; i < chain->count; i++) {
+    chain->ops[i].info->kernel(data, size, chain->ops[i].value);
+  }
+}
+
+int chain_is_byte_map(const OpChain *chain) {
+  for (int i = 0; i < chain->count; i++) {
+    if (!chain->ops[i].info->kernel) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Every byte map chain run over the identity table yields the 256 entry
+// lookup table for the whole chain.
+void build_chain_table(const OpChain *chain, uint8_t table[256]) {
+  for (int i = 0; i < 256; i++) {
+    table[i] = (uint8_t)i;
+  }
+  apply_chain(table, 256, chain);
+}
+
+// Chains made of and/or/xor/not collapse to (x & and_mask) ^ xor_mask.
+int table_to_masks(const uint8_t table[256], uint8_t *and_mask,
+                   uint8_t *xor_mask) {
+  *xor_mask = table[0];
+  *and_mask = table[255] ^ table[0];
+  for (int i = 0; i < 256; i++) {
+    if (table[i] != ((i & *and_mask) ^ *xor_mask)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Byte map chains compiled for interleaved frames. Each byte lane of a frame
+// (blockAlign bytes) gets the table of the channel it belongs to; without
+// per-channel chains there is a single lane. When every lane is a mask pair
+// the lanes are unrolled into patterns that repeat every pattern_size bytes,
+// so the kernel is a straight vectorizable loop. A single operation on every
+// lane runs its own kernel directly.
+typedef struct {
+  int direct;
+  const OperationInfo *direct_op;
+  int direct_value;
+  int masked;
+  size_t lane_count;
+  uint8_t (*lane_tables)[256];
+  size_t pattern_size;
+  uint8_t *and_pattern;
+  uint8_t *xor_pattern;
+} LaneMap;
+
+void free_lane_map(LaneMap *map) {
+  free(map->lane_tables);
+  free(map->and_pattern);
+  free(map->xor_pattern);
+  map->lane_tables = NULL;
+  map->and_pattern = NULL;
+  map->xor_pattern = NULL;
+}
+
+int build_lane_map(const OpChain *const *lane_chains, size_t lane_count,
+                   LaneMap *map) {
+  memset(map, 0, sizeof(LaneMap));
+
+  if (lane_count == 1 && lane_chains[0]->count <= 1) {
+    map->direct = 1;
+    if (lane_chains[0]->count == 1) {
+      map->direct_op = lane_chains[0]->ops[0].info;
+      map->direct_value = lane_chains[0]->ops[0].value;
+    }
+    return 1;
+  }
+
+  map->lane_count = lane_count;
+  map->lane_tables = malloc(map->lane_count * sizeof(*map->lane_tables));
+  if (!map->lane_tables) {
+    return 0;
+  }
+
+  map->masked = 1;
+  uint8_t lane_and[256 * 16];
+  uint8_t lane_xor[256 * 16];
+  for (size_t lane = 0; lane < map->lane_count; lane++) {
+    build_chain_table(lane_chains[lane], map->lane_tables[lane]);
+    if (lane >= sizeof(lane_and) ||
+        !table_to_masks(map->lane_tables[lane], &lane_and[lane],
+                        &lane_xor[lane])) {
+      map->masked = 0;
+    }
+  }
+
+  if (map->masked) {
+    map->pattern_size = map->lane_count;
+    while (map->pattern_size % 64 != 0) {
+      map->pattern_size += map->lane_count;
+    }
+    map->and_pattern = malloc(map->pattern_size);
+    map->xor_pattern = malloc(map->pattern_size);
+    if (!map->and_pattern || !map->xor_pattern) {
+      free_lane_map(map);
+      return 0;
+    }
+    for (size_t i = 0; i < map->pattern_size; i++) {
+      map->and_pattern[i] = lane_and[i % map->lane_count];
+      map->xor_pattern[i] = lane_xor[i % map->lane_count];
+    }
+  }
+
+  return 1;
+}
+
+void apply_lane_masks(uint8_t *restrict data, size_t size,
+                      const uint8_t *restrict and_pattern,
+                      const uint8_t *restrict xor_pattern,
+                      size_t pattern_size, size_t phase) {
+  size_t i = 0;
+  while (i < size) {
+    size_t n = pattern_size - phase;
+    if (n > size - i) {
+      n = size - i;
+    }
+    const uint8_t *a = and_pattern + phase;
+    const uint8_t *x = xor_pattern + phase;
+    uint8_t *d = data + i;
+    for (size_t k = 0; k < n; k++) {
+      d[k] = (d[k] & a[k]) ^ x[k];
+    }
+    i += n;
+    phase = 0;
+  }
+}
+
+void apply_lane_tables(uint8_t *data, size_t size,
+                       const uint8_t (*lane_tables)[256], size_t lane_count,
+                       size_t lane) {
+  for (size_t i = 0; i < size; i++) {
+    data[i] = lane_tables[lane][data[i]];
+    if (++lane == lane_count) {
+      lane = 0;
+    }
+  }
+}
+
+// position is the offset of data inside the data chunk, which keeps the lane
+// phase right across buffer boundaries.
+void apply_lane_map(uint8_t *data, size_t size, uint64_t position,
+                    const LaneMap *map) {
+  if (map->direct) {
+    if (map->direct_op) {
+      map->direct_op->kernel(data, size, map->direct_value);
+    }
+  } else if (map->masked) {
+    apply_lane_masks(data, size, map->and_pattern, map->xor_pattern,
+                     map->pattern_size, position % map->pattern_size);
+  } else {
+    apply_lane_tables(data, size, (const uint8_t(*)[256])map->lane_tables,
+                      map->lane_count, position % map->lane_count);
+  }
+}
+
+// A region's chains (the region chain plus per-channel overrides) compiled
+// into stages. When everything is a byte map there is a single lane map
+// stage. Otherwise each chain is split into runs of byte maps, compiled to
+// lane maps that leave the other channels alone, and frame ops that only
+// write the lanes of their channels.
+typedef struct {
+  const OperationInfo *info;
+  int value;
+  uint8_t *lane_mask;
+  FrameOpState *state;
+  LaneMap map;
+} PlanStage;
+
+typedef struct {
+  PlanStage *stages;
+  size_t stage_count;
+} RenderPlan;
+
+void free_render_plan(RenderPlan *plan) {
+  for (size_t i = 0; i < plan->stage_count; i++) {
+    free(plan->stages[i].lane_mask);
+    free(plan->stages[i].state);
+    free_lane_map(&plan->stages[i].map);
+  }
+  free(plan->stages);
+  plan->stages = NULL;
+  plan->stage_count = 0;
+}
+
+PlanStage *add_plan_stage(RenderPlan *plan) {
+  PlanStage *stages = (PlanStage *)realloc(
+      plan->stages, (plan->stage_count + 1) * sizeof(PlanStage));
+  if (!stages) {
+    return NULL;
+  }
+  plan->stages = stages;
+  PlanStage *stage = &stages[plan->stage_count++];
+  memset(stage, 0, sizeof(PlanStage));
+  return stage;
+}
+
+int build_render_plan(const OpChain *chain, const ProcessOptions *options,
+                      const WavFmtData *fmtData, RenderPlan *plan) {
+  plan->stages = NULL;
+  plan->stage_count = 0;
+
+  size_t lane_count = fmtData->blockAlign;
+  size_t bytes_per_sample = (fmtData->bitsPerSample + 7) / 8;
+  const OpChain **lane_chains =
+      (const OpChain **)malloc(lane_count * sizeof(OpChain *));
+  if (!lane_chains) {
+    return 0;
+  }
+
+  int uniform = 1;
+  int byte_maps = chain_is_byte_map(chain);
+  for (size_t lane = 0; lane < lane_count; lane++) {
+    size_t channel = lane / bytes_per_sample;
+    lane_chains[lane] = chain;
+    if (channel < MAX_CHANNELS && options->channel_chain_set[channel]) {
+      lane_chains[lane] = &options->channel_chains[channel];
+      uniform = 0;
+      byte_maps = byte_maps && chain_is_byte_map(lane_chains[lane]);
+    }
+  }
+
+  if (byte_maps) {
+    PlanStage *stage = add_plan_stage(plan);
+    int ok = stage && build_lane_map(lane_chains, uniform ? 1 : lane_count,
+                                     &stage->map);
+    free(lane_chains);
+    if (!ok) {
+      free_render_plan(plan);
+    }
+    return ok;
+  }
+
+  OpChain empty_chain;
+  empty_chain.count = 0;
+  const OpChain **run_chains =
+      (const OpChain **)malloc(lane_count * sizeof(OpChain *));
+  if (!run_chains) {
+    free(lane_chains);
+    return 0;
+  }
+
+  for (size_t first = 0; first < lane_count; first++) {
+    const OpChain *group = lane_chains[first];
+    int seen = 0;
+    for (size_t lane = 0; lane < first; lane++) {
+      if (lane_chains[lane] == group) {
+        seen = 1;
+      }
+    }
+    if (seen) {
+      continue;
+    }
+
+    int op = 0;
+    while (op < group->count) {
+      PlanStage *stage = add_plan_stage(plan);
+      if (!stage) {
+        free(run_chains);
+        free(lane_chains);
+        free_render_plan(plan);
+        return 0;
+      }
+
+      if (!uniform) {
+        stage->lane_mask = (uint8_t *)malloc(lane_count);
+        if (!stage->lane_mask) {
+          free(run_chains);
+          free(lane_chains);
+          free_render_plan(plan);
+          return 0;
+        }
+        for (size_t lane = 0; lane < lane_count; lane++) {
+          stage->lane_mask[lane] = lane_chains[lane] == group;
+        }
+      }
+
+      if (!group->ops[op].info->kernel) {
+        stage->info = group->ops[op].info;
+        stage->value = group->ops[op].value;
+        stage->state =
+            (FrameOpState *)calloc(1, sizeof(FrameOpState) + lane_count);
+        if (!stage->state) {
+          free(run_chains);
+          free(lane_chains);
+          free_render_plan(plan);
+          return 0;
+        }
+        op++;
+        continue;
+      }
+
+      OpChain run;
+      run.count = 0;
+      while (op < group->count && group->ops[op].info->kernel) {
+        run.ops[run.count++] = group->ops[op++];
+      }
+      for (size_t lane = 0; lane < lane_count; lane++) {
+        run_chains[lane] = (lane_chains[lane] == group) ? &run : &empty_chain;
+      }
+      if (!build_lane_map(run_chains, uniform ? 1 : lane_count,
+                          &stage->map)) {
+        free(run_chains);
+        free(lane_chains);
+        free_render_plan(plan);
+        return 0;
+      }
+    }
+  }
+
+  free(run_chains);
+  free(lane_chains);
+  return 1;
+}
+
+void apply_render_plan(uint8_t *data, size_t size, uint64_t position,
+                       const WavFmtData *fmtData, const RenderPlan *plan) {
+  for (size_t i = 0; i < plan->stage_count; i++) {
+    const PlanStage *stage = &plan->stages[i];
+    if (stage->info) {
+      stage->info->frame_kernel(data, size, position, fmtData,
+                                stage->lane_mask, stage->value, stage->state);
+    } else {
+      apply_lane_map(data, size, position, &stage->map);
+    }
+  }
+}
+
+int compare_breakpoints(const void *a, const void *b) {
+  const Breakpoint *pa = (const Breakpoint *)a;
+  const Breakpoint *pb = (const Breakpoint *)b;
+  if (pa->time != pb->time) {
+    return (pa->time < pb->time) ? -1 : 1;
+  }
+  return 0;
+}
+
+// Envelopes are "ramp:FROM:TO" over the whole file, "lfo:CENTER:DEPTH:HZ"
+// (a sine) or "file:PATH" with one "<seconds> <value>" breakpoint per line.
+int parse_envelope(const char *spec, Envelope *envelope) {
+  memset(envelope, 0, sizeof(Envelope));
+
+  if (sscanf(spec, "ramp:%lf:%lf", &envelope->from, &envelope->to) == 2) {
+    envelope->type = ENVELOPE_RAMP;
+    return 1;
+  }
+
+  if (sscanf(spec, "lfo:%lf:%lf:%lf", &envelope->center, &envelope->depth,
+             &envelope->rate) == 3) {
+    envelope->type = ENVELOPE_LFO;
+    return 1;
+  }
+
+  if (strncmp(spec, "file:", 5) != 0) {
+    return 0;
+  }
+
+  FILE *file = fopen(spec + 5, "r");
+  if (!file) {
+    printf("Error: cannot open envelope file %s\n", spec + 5);
+    return 0;
+  }
+
+  size_t capacity = 0;
+  char line[256];
+  while (fgets(line, sizeof(line), file)) {
+    Breakpoint point;
+    if (line[0] == '#' ||
+        sscanf(line, "%lf %lf", &point.time, &point.value) != 2) {
+      continue;
+    }
+
+    if (envelope->point_count == capacity) {
+      capacity = capacity ? capacity * 2 : 64;
+      Breakpoint *grown = (Breakpoint *)realloc(
+          envelope->points, capacity * sizeof(Breakpoint));
+      if (!grown) {
+        free(envelope->points);
+        fclose(file);
+        return 0;
+      }
+      envelope->points = grown;
+    }
+    envelope->points[envelope->point_count++] = point;
+  }
+
+  fclose(file);
+
+  if (envelope->point_count == 0) {
+    printf("Error: no breakpoints in %s\n", spec + 5);
+    return 0;
+  }
+
+  qsort(envelope->points, envelope->point_count, sizeof(Breakpoint),
+        compare_breakpoints);
+  envelope->type = ENVELOPE_BREAKPOINTS;
+  return 1;
+}
+
+double evaluate_envelope(const Envelope *envelope, double time,
+                         double duration) {
+  switch (envelope->type) {
+  case ENVELOPE_RAMP:
+    if (duration <= 0) {
+      return envelope->from;
+    }
+    return envelope->from + (envelope->to - envelope->from) * time / duration;
+  case ENVELOPE_LFO:
+    return envelope->center +
+           envelope->depth * sin(2.0 * M_PI * envelope->rate * time);
+  case ENVELOPE_BREAKPOINTS: {
+    const Breakpoint *points = envelope->points;
+    size_t count = envelope->point_count;
+    if (time <= points[0].time) {
+      return points[0].value;
+    }
+    if (time >= points[count - 1].time) {
+      return points[count - 1].value;
+    }
+    size_t lo = 0;
+    size_t hi = count - 1;
+    while (hi - lo > 1) {
+      size_t mid = (lo + hi) / 2;
+      if (points[mid].time <= time) {
+        lo = mid;
+      } else {
+        hi = mid;
+      }
+    }
+    double span = points[hi].time - points[lo].time;
+    double fraction = (span > 0) ? (time - points[lo].time) / span : 0;
+    return points[lo].value + (points[hi].value - points[lo].value) * fraction;
+  }
+  default:
+    return 0;
+  }
+}
+
+// Automated renders evaluate the envelope once per block of frames. The
+// compiled lane maps of the last few values are kept so that slow envelopes
+// keep hitting the same tables and the hot loop stays a table lookup. Frame op
+// state moves along with the value, so decimate keeps its held frame.
+#define AUTOMATION_BLOCK_FRAMES 512
+#define AUTOMATION_CACHE_SIZE 16
+
+typedef struct {
+  int valid;
+  int value;
+  uint64_t last_used;
+  RenderPlan plan;
+} AutomationCacheEntry;
+
+typedef struct {
+  AutomationCacheEntry entries[AUTOMATION_CACHE_SIZE];
+  uint64_t clock;
+  AutomationCacheEntry *current;
+} AutomationCache;
+
+// The automated op is the first op of the chain that takes a value.
+int automated_op_index(const OpChain *chain) {
+  for (int i = 0; i < chain->count; i++) {
+    if (chain->ops[i].info->takes_value && !chain->ops[i].info->parse_value) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void free_automation_cache(AutomationCache *cache) {
+  for (int i = 0; i < AUTOMATION_CACHE_SIZE; i++) {
+    if (cache->entries[i].valid) {
+      free_render_plan(&cache->entries[i].plan);
+      cache->entries[i].valid = 0;
+    }
+  }
+  cache->current = NULL;
+}
+
+AutomationCacheEntry *lookup_automation_cache(AutomationCache *cache,
+                                              const OpChain *chain,
+                                              int op_index, int value,
+                                              const ProcessOptions *options,
+                                              const WavFmtData *fmtData) {
+  AutomationCacheEntry *victim = &cache->entries[0];
+  cache->clock++;
+
+  for (int i = 0; i < AUTOMATION_CACHE_SIZE; i++) {
+    AutomationCacheEntry *entry = &cache->entries[i];
+    if (entry->valid && entry->value == value) {
+      entry->last_used = cache->clock;
+      return entry;
+    }
+    // The current plan holds the frame op state still to be carried over.
+    if (entry != cache->current &&
+        (!entry->valid || victim == cache->current ||
+         (victim->valid && entry->last_used < victim->last_used))) {
+      victim = entry;
+    }
+  }
+
+  if (victim->valid) {
+    free_render_plan(&victim->plan);
+    victim->valid = 0;
+  }
+
+  OpChain automated_chain = *chain;
+  automated_chain.ops[op_index].value = value;
+  if (!build_render_plan(&automated_chain, options, fmtData, &victim->plan)) {
+    return NULL;
+  }
+  victim->valid = 1;
+  victim->value = value;
+  victim->last_used = cache->clock;
+  return victim;
+}
+
+// Hands the frame op state of one plan to another built from the same chain
+// with a different automated value. Both have their frame op stages in the
+// same order.
+void carry_frame_states(const RenderPlan *from, RenderPlan *to,
+                        size_t lane_count) {
+  size_t j = 0;
+  for (size_t i = 0; i < from->stage_count; i++) {
+    if (!from->stages[i].state) {
+      continue;
+    }
+    while (j < to->stage_count && !to->stages[j].state) {
+      j++;
+    }
+    if (j == to->stage_count) {
+      return;
+    }
+    memcpy(to->stages[j].state, from->stages[i].state,
+           sizeof(FrameOpState) + lane_count);
+    j++;
+  }
+}
+
+// Applies the chain to a buffer starting at data chunk offset position,
+// re-evaluating the automated value every AUTOMATION_BLOCK_FRAMES frames.
+int apply_automated_chain(uint8_t *data, size_t size, uint64_t position,
+                          const OpChain *chain, AutomationCache *cache,
+                          const ProcessOptions *options,
+                          const WavFmtData *fmtData, double duration) {
+  int op_index = automated_op_index(chain);
+  const OperationInfo *info = chain->ops[op_index].info;
+  uint64_t block_bytes = (uint64_t)AUTOMATION_BLOCK_FRAMES * fmtData->blockAlign;
+
+  size_t i = 0;
+  while (i < size) {
+    uint64_t block_end = ((position + i) / block_bytes + 1) * block_bytes;
+    size_t n = (size_t)(block_end - (position + i));
+    if (n > size - i) {
+      n = size - i;
+    }
+
+    double time = (double)((position + i) / fmtData->blockAlign) /
+                  fmtData->sampleRate;
+    long value = lround(evaluate_envelope(&options->automation, time,
+                                          duration));
+    if (value < info->min_value) {
+      value = info->min_value;
+    } else if (value > info->max_value) {
+      value = info->max_value;
+    }
+
+    AutomationCacheEntry *entry = lookup_automation_cache(
+        cache, chain, op_index, (int)value, options, fmtData);
+    if (!entry) {
+      return 0;
+    }
+    if (cache->current && cache->current != entry) {
+      carry_frame_states(&cache->current->plan, &entry->plan,
+                         fmtData->blockAlign);
+    }
+    cache->current = entry;
+    apply_render_plan(data + i, n, position + i, fmtData, &entry->plan);
+    i += n;
+  }
+
+  return 1;
+}
+
+void print_usage(const char *program_name) {
+  printf("Usage: %s <input.wav> <output.wav> <operation> <value> [options]\n",
+         program_name);
+  printf("       %s --autotune DIR [MB]\n", program_name);
+  printf("         Benchmark block sizes and queue depths on the device of\n");
+  printf("         DIR with MB (default 256) of scratch data and save the\n");
+  printf("         best ones for later runs on that device\n");
+  printf("       %s --graph FILE\n", program_name);
+  printf("         Run the job graph in FILE, one node per line:\n");
+  printf("           input NAME FILE, chain NAME FROM CHAIN,\n");
+  printf("           convert NAME FROM FMT[,mono],\n");
+  printf("           combine NAME MODE[:RULE] FROM FROM... or\n");
+  printf("           output FROM FILE\n");
+  printf("         Nodes stream to each other in memory and only output\n");
+  printf("         nodes write files\n");
+  printf("Operations:\n");
+  printf("  --right -r   Right shift by value (0-7)\n");
+  printf("  --left -l    Left shift by value (0-7)\n");
+  printf("  --not -n     Bitwise NOT (value ignored)\n");
+  printf("  --and -a     Bitwise AND with value (0-255)\n");
+  printf("  --or -o      Bitwise OR with value (0-255)\n");
+  printf("  --xor -z     Bitwise XOR with value (0-255)\n");
+  printf("  --rotl -L    Rotate left by value (0-7)\n");
+  printf("  --rotr -R    Rotate right by value (0-7)\n");
+  printf("  --bitrev -v  Reverse the bit order (value ignored)\n");
+  printf("  --swap -s    Swap the nibbles (value ignored)\n");
+  printf("  --gray -g    Gray encode (value ignored)\n");
+  printf("  --ungray -G  Gray decode (value ignored)\n");
+  printf("  --plane -p   Keep bit plane value (0-7) at full scale\n");
+  printf("  --crush -b   Reduce samples to value bits with rounding (1-16)\n");
+  printf("  --decimate -d  Sample-and-hold every value frames (1-4096)\n");
+  printf("  --expr -e    Per-sample expression given as value, e.g.\n");
+  printf("               \"s ^ (t >> 8)\" with s the byte, t the frame index,\n");
+  printf("               c the channel and i the byte index\n");
+  printf("  --flip -f    Flip each bit with probability RATE, value given\n");
+  printf("               as RATE[:SEED], e.g. 0.001:42\n");
+  printf("  --dropout -x Clear each bit with probability RATE, value given\n");
+  printf("               as RATE[:SEED]\n");
+  printf("  --chain -c   Op chain given as value, e.g. \"xor:85,right:2\"\n");
+  printf("Options:\n");
+  printf("  --start SEC      Only process audio from SEC seconds on\n");
+  printf("  --end SEC        Only process audio up to SEC seconds\n");
+  printf("  --regions FILE   Process the regions listed in FILE, one\n");
+  printf("                   \"<start> <end> [chain]\" line per region\n");
+  printf("  --channel N:CHAIN\n");
+  printf("                   Use CHAIN for channel N (0-based) instead of the\n");
+  printf("                   operation, e.g. --channel 1:right:4\n");
+  printf("  --huge-pages     Back large buffers with huge pages\n");
+  printf("  --memory-budget MB  Cap the memory held by the buffer pool\n");
+  printf("  --pool-stats     Print buffer pool statistics when done\n");
+  printf("  --block-size KB  Work block size, overriding the saved tuning\n");
+  printf("  --queue-depth N  Fan-out ring depth, overriding the saved\n");
+  printf("                   tuning\n");
+  printf("  --automate ENV   Drive the value of the first valued op with ENV:\n");
+  printf("                   ramp:FROM:TO, lfo:CENTER:DEPTH:HZ or file:PATH\n");
+  printf("  --checksum       Write the XXH64 of the output to OUTPUT.xxh64\n");
+  printf("  --checksum-json FILE  Write output checksums as JSON to FILE\n");
+  printf("  --checksum-input Also hash the input data chunk (JSON only)\n");
+  printf("  --journal FILE   Checkpoint progress to FILE and resume from it\n");
+  printf("                   when rerun after an interruption\n");
+  printf("  --durability LEVEL  Sync before publishing the output: none,\n");
+  printf("                   data (the file) or full (file and directory)\n");
+  printf("  --variant OUT=CHAIN\n");
+  printf("                   Also render OUT with CHAIN from the same read\n");
+  printf("  --sweep OP:FROM:TO\n");
+  printf("                   Also render OP with each value FROM-TO to\n");
+  printf("                   OUTPUT_<op><value>.wav from the same read\n");
+  printf("  --stream         Keep bulk passes out of the page cache: read\n");
+  printf("                   ahead and drop pages once they are done\n");
+  printf("  --direct         Like --stream, reading the input with O_DIRECT\n");
+  printf("  --glitch GLITCH  Move audio in time before the operation:\n");
+  printf("                   reverse[:MS], stutter:MS:REPEATS or\n");
+  printf("                   shuffle:MS[:SEED], on segments of MS ms\n");
+  printf("  --with FILE      Combine FILE into the input first\n");
+  printf("                   (repeat for more inputs, same PCM format)\n");
+  printf("  --combine MODE   How --with inputs combine: xor (default), and,\n");
+  printf("                   or, or mix (saturating sum)\n");
+  printf("  --length RULE    Output length with --with: first (default),\n");
+  printf("                   shortest or longest; short inputs are padded\n");
+  printf("                   so they stop contributing\n");
+  printf("  --out-format FMT Write u8, s8, u16 or s16 samples (s8 and u16\n");
+  printf("                   are not standard WAV layouts), PCM only\n");
+  printf("  --mono           Write the average of the channels\n");
+  printf("  --follow         Keep processing the input as it is recorded,\n");
+  printf("                   updating the output in place\n");
+  printf("  --follow-idle SEC  Stop following after SEC seconds without new\n");
+  printf("                   audio (default 10)\n");
+  printf("  --auto-gain DB   Scale the output so its peak is at DB dBFS\n");
+  printf("                   (e.g. -1), measured from the input first\n");
+  printf("  --analyze        Report changed bytes and levels per channel\n");
+  printf("                   without writing the output file\n");
+}
+
+int parse_wav_file(FILE *file, WavFmtData *fmtData, uint32_t *data_size,
+                   long *data_offset) {
+  WavRiffHeader riffHeader;
+
+  if (fread(&riffHeader, sizeof(WavRiffHeader), 1, file) != 1) {
+    return 0;
+  }
+
+  if (strncmp(riffHeader.chunkID, "RIFF", 4) != 0 ||
+      strncmp(riffHeader.format, "WAVE", 4) != 0) {
+    return 0;
+  }
+
+  WavChunkHeader chunkHeader;
+  int fmt_found = 0;
+  int data_found = 0;
+
+  while (fread(&chunkHeader, sizeof(WavChunkHeader), 1, file) == 1) {
+    if (strncmp(chunkHeader.subchunkID, "fmt ", 4) == 0) {
+      if (fread(fmtData, sizeof(WavFmtData), 1, file) != 1) {
+        return 0;
+      }
+
+      if (chunkHeader.subchunkSize > sizeof(WavFmtData)) {
+        fseek(file, chunkHeader.subchunkSize - sizeof(WavFmtData), SEEK_CUR);
+      }
+      fmt_found = 1;
+    } else if (strncmp(chunkHeader.subchunkID, "data", 4) == 0) {
+      *data_size = chunkHeader.subchunkSize;
+      *data_offset = ftell(file);
+      data_found = 1;
+      break;
+    } else {
+      fseek(file, chunkHeader.subchunkSize, SEEK_CUR);
+    }
+  }
+
+  return (fmt_found && data_found);
+}
+
+
+// Compressed formats are decoded to 16-bit PCM, processed and encoded again
+// in the same pass. For A-law and mu-law a chain without position dependent
+// ops is a function of the 8-bit code, so decode, chain and encode collapse
+// into one 256 entry table per channel.
+#define WAVE_FORMAT_PCM 1
+#define WAVE_FORMAT_ALAW 6
+#define WAVE_FORMAT_MULAW 7
+#define WAVE_FORMAT_IMA_ADPCM 0x11
+
+int16_t mulaw_decode_table[256];
+int16_t alaw_decode_table[256];
+uint8_t mulaw_encode_table[16384];
+uint8_t alaw_encode_table[8192];
+int law_tables_ready = 0;
+
+int16_t mulaw_decode(uint8_t code) {
+  code = ~code;
+  int magnitude = (((code & 0x0F) << 3) + 0x84) << ((code & 0x70) >> 4);
+  return (int16_t)((code & 0x80) ? 0x84 - magnitude : magnitude - 0x84);
+}
+
+int16_t alaw_decode(uint8_t code) {
+  code ^= 0x55;
+  int magnitude = (code & 0x0F) << 4;
+  int segment = (code & 0x70) >> 4;
+  if (segment == 0) {
+    magnitude += 8;
+  } else {
+    magnitude = (magnitude + 0x108) << (segment - 1);
+  }
+  return (int16_t)((code & 0x80) ? magnitude : -magnitude);
+}
+
+uint8_t mulaw_encode(int16_t sample) {
+  int value = sample >> 2;
+  int mask = 0xFF;
+  if (value < 0) {
+    value = -value;
+    mask = 0x7F;
+  }
+  value += 33;
+  if (value > 8191) {
+    value = 8191;
+  }
+  int segment = 0;
+  for (int v = value >> 6; v && segment < 7; v >>= 1) {
+    segment++;
+  }
+  return (uint8_t)(((segment << 4) | ((value >> (segment + 1)) & 0x0F)) ^
+                   mask);
+}
+
+uint8_t alaw_encode(int16_t sample) {
+  int value = sample >> 3;
+  int mask = 0xD5;
+  if (value < 0) {
+    value = -value - 1;
+    mask = 0x55;
+  }
+  int segment = 0;
+  for (int v = value >> 5; v && segment < 8; v >>= 1) {
+    segment++;
+  }
+  if (segment >= 8) {
+    return (uint8_t)(0x7F ^ mask);
+  }
+  int mantissa = (segment < 2) ? (value >> 1) & 0x0F
+                               : (value >> segment) & 0x0F;
+  return (uint8_t)(((segment << 4) | mantissa) ^ mask);
+}
+
+void init_law_tables(void) {
+  if (law_tables_ready) {
+    return;
+  }
+  for (int i = 0; i < 256; i++) {
+    mulaw_decode_table[i] = mulaw_decode((uint8_t)i);
+    alaw_decode_table[i] = alaw_decode((uint8_t)i);
+  }
+  for (int i = 0; i < 16384; i++) {
+    mulaw_encode_table[i] = mulaw_encode((int16_t)((i - 8192) * 4));
+  }
+  for (int i = 0; i < 8192; i++) {
+    alaw_encode_table[i] = alaw_encode((int16_t)((i - 4096) * 8));
+  }
+  law_tables_ready = 1;
+}
+
+uint8_t law_encode(int format, int16_t sample) {
+  if (format == WAVE_FORMAT_MULAW) {
+    return mulaw_encode_table[(sample >> 2) + 8192];
+  }
+  return alaw_encode_table[(sample >> 3) + 4096];
+}
+
+const int ima_index_table[16] = {-1, -1, -1, -1, 2, 4, 6, 8,
+                                 -1, -1, -1, -1, 2, 4, 6, 8};
+
+const int ima_step_table[89] = {
+    7,     8,     9,     10,    11,    12,    13,    14,    16,    17,
+    19,    21,    23,    25,    28,    31,    34,    37,    41,    45,
+    50,    55,    60,    66,    73,    80,    88,    97,    107,   118,
+    130,   143,   157,   173,   190,   209,   230,   253,   279,   307,
+    337,   371,   408,   449,   494,   544,   598,   658,   724,   796,
+    876,   963,   1060,  1166,  1282,  1411,  1552,  1707,  1878,  2066,
+    2272,  2499,  2749,  3024,  3327,  3660,  4026,  4428,  4871,  5358,
+    5894,  6484,  7132,  7845,  8630,  9493,  10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767};
+
+// Frames stored in one blockAlign sized block of the data chunk.
+uint32_t frames_per_block(const WavFmtData *fmtData) {
+  if (fmtData->audioFormat == WAVE_FORMAT_IMA_ADPCM) {
+    uint32_t header = 4u * fmtData->numChannels;
+    return (fmtData->blockAlign - header) * 2 / fmtData->numChannels + 1;
+  }
+  return 1;
+}
+
+// Format the op chain sees: the input itself for PCM, 16-bit PCM otherwise.
+WavFmtData processing_format(const WavFmtData *fmtData) {
+  WavFmtData pcm = *fmtData;
+  if (fmtData->audioFormat != WAVE_FORMAT_PCM) {
+    pcm.audioFormat = WAVE_FORMAT_PCM;
+    pcm.bitsPerSample = 16;
+    pcm.blockAlign = 2 * fmtData->numChannels;
+    pcm.byteRate = pcm.blockAlign * fmtData->sampleRate;
+  }
+  return pcm;
+}
+
+int ima_step(int *predictor, int *index, int nibble) {
+  int step = ima_step_table[*index];
+  int diff = step >> 3;
+  if (nibble & 4) {
+    diff += step;
+  }
+  if (nibble & 2) {
+    diff += step >> 1;
+  }
+  if (nibble & 1) {
+    diff += step >> 2;
+  }
+  *predictor += (nibble & 8) ? -diff : diff;
+  if (*predictor > 32767) {
+    *predictor = 32767;
+  } else if (*predictor < -32768) {
+    *predictor = -32768;
+  }
+  *index += ima_index_table[nibble];
+  if (*index < 0) {
+    *index = 0;
+  } else if (*index > 88) {
+    *index = 88;
+  }
+  return *predictor;
+}
+
+int ima_encode_sample(int *predictor, int *index, int sample) {
+  int step = ima_step_table[*index];
+  int diff = sample - *predictor;
+  int nibble = 0;
+  if (diff < 0) {
+    nibble = 8;
+    diff = -diff;
+  }
+  if (diff >= step) {
+    nibble |= 4;
+    diff -= step;
+  }
+  if (diff >= step >> 1) {
+    nibble |= 2;
+    diff -= step >> 1;
+  }
+  if (diff >= step >> 2) {
+    nibble |= 1;
+  }
+  ima_step(predictor, index, nibble);
+  return nibble;
+}
+
+// Decodes whole IMA ADPCM blocks into interleaved 16-bit frames.
+void decode_ima_blocks(const uint8_t *data, size_t block_count,
+                       const WavFmtData *fmtData, int16_t *pcm) {
+  int channels = fmtData->numChannels;
+  uint32_t frames = frames_per_block(fmtData);
+
+  for (size_t b = 0; b < block_count; b++) {
+    const uint8_t *block = data + b * fmtData->blockAlign;
+    int16_t *out = pcm + b * frames * channels;
+
+    for (int c = 0; c < channels; c++) {
+      const uint8_t *header = block + 4 * c;
+      int predictor = (int16_t)(header[0] | (header[1] << 8));
+      int index = header[2] > 88 ? 88 : header[2];
+      out[c] = (int16_t)predictor;
+
+      const uint8_t *nibbles = block + 4 * channels;
+      for (uint32_t f = 1; f < frames; f++) {
+        uint32_t n = f - 1;
+        const uint8_t *word = nibbles + ((n / 8) * channels + c) * 4;
+        uint8_t byte = word[(n % 8) / 2];
+        int nibble = (n % 2) ? byte >> 4 : byte & 0x0F;
+        out[f * channels + c] = (int16_t)ima_step(&predictor, &index, nibble);
+      }
+    }
+  }
+}
+
+// Encodes frames back into the blocks they were decoded from, keeping each
+// block's original step index as the encoder's starting point.
+void encode_ima_blocks(const int16_t *pcm, size_t block_count,
+                       const WavFmtData *fmtData, uint8_t *data) {
+  int channels = fmtData->numChannels;
+  uint32_t frames = frames_per_block(fmtData);
+
+  for (size_t b = 0; b < block_count; b++) {
+    uint8_t *block = data + b * fmtData->blockAlign;
+    const int16_t *in = pcm + b * frames * channels;
+    uint8_t *nibbles = block + 4 * channels;
+    memset(nibbles, 0, fmtData->blockAlign - 4 * channels);
+
+    for (int c = 0; c < channels; c++) {
+      uint8_t *header = block + 4 * c;
+      int predictor = in[c];
+      int index = header[2] > 88 ? 88 : header[2];
+      header[0] = (uint8_t)(predictor & 0xFF);
+      header[1] = (uint8_t)((predictor >> 8) & 0xFF);
+      header[3] = 0;
+
+      for (uint32_t f = 1; f < frames; f++) {
+        uint32_t n = f - 1;
+        uint8_t *word = nibbles + ((n / 8) * channels + c) * 4;
+        int nibble =
+            ima_encode_sample(&predictor, &index, in[f * channels + c]);
+        word[(n % 8) / 2] |= (uint8_t)((n % 2) ? nibble << 4 : nibble);
+      }
+    }
+  }
+}
+
+// Decodes a buffer of encoded data into pcm and returns the number of PCM
+// bytes. Trailing bytes that do not form a whole ADPCM block stay encoded.
+size_t decode_samples(const uint8_t *data, size_t size,
+                      const WavFmtData *fmtData, int16_t *pcm) {
+  if (fmtData->audioFormat == WAVE_FORMAT_IMA_ADPCM) {
+    size_t block_count = size / fmtData->blockAlign;
+    decode_ima_blocks(data, block_count, fmtData, pcm);
+    return block_count * frames_per_block(fmtData) * fmtData->numChannels * 2;
+  }
+
+  const int16_t *table = (fmtData->audioFormat == WAVE_FORMAT_MULAW)
+                             ? mulaw_decode_table
+                             : alaw_decode_table;
+  for (size_t i = 0; i < size; i++) {
+    pcm[i] = table[data[i]];
+  }
+  return size * 2;
+}
+
+void encode_samples(const int16_t *pcm, size_t size, const WavFmtData *fmtData,
+                    uint8_t *data) {
+  if (fmtData->audioFormat == WAVE_FORMAT_IMA_ADPCM) {
+    encode_ima_blocks(pcm, size / fmtData->blockAlign, fmtData, data);
+    return;
+  }
+
+  for (size_t i = 0; i < size; i++) {
+    data[i] = law_encode(fmtData->audioFormat, pcm[i]);
+  }
+}
+
+// Offset of the PCM frame that corresponds to an encoded data offset.
+uint64_t processing_position(uint64_t position, const WavFmtData *fmtData) {
+  uint64_t frames = position / fmtData->blockAlign * frames_per_block(fmtData);
+  return frames * 2 * fmtData->numChannels;
+}
+
+uint64_t time_to_data_offset(double seconds, const WavFmtData *fmtData,
+                             uint32_t data_size) {
+  if (seconds <= 0) {
+    return 0;
+  }
+
+  uint64_t frame = (uint64_t)(seconds * fmtData->sampleRate);
+  uint64_t offset = frame / frames_per_block(fmtData) * fmtData->blockAlign;
+  return (offset < data_size) ? offset : data_size;
+}
+
+int compare_regions(const void *a, const void *b) {
+  const Region *ra = (const Region *)a;
+  const Region *rb = (const Region *)b;
+  if (ra->start != rb->start) {
+    return (ra->start < rb->start) ? -1 : 1;
+  }
+  return 0;
+}
+
+// Builds the sorted list of regions to transform. Everything outside of them
+// is passed through untouched.
+int load_regions(const ProcessOptions *options, const WavFmtData *fmtData,
+                 uint32_t data_size, const OpChain *default_chain,
+                 Region **regions_out, size_t *region_count_out) {
+  Region *regions = NULL;
+  size_t region_count = 0;
+
+  if (!options->regions_filename) {
+    regions = (Region *)malloc(sizeof(Region));
+    if (!regions) {
+      printf("Error: cannot allocate regions\n");
+      return 0;
+    }
+    regions[0].start = time_to_data_offset(options->start_time, fmtData,
+                                           data_size);
+    regions[0].end = (options->end_time < 0)
+                         ? data_size
+                         : time_to_data_offset(options->end_time, fmtData,
+                                               data_size);
+    regions[0].chain = *default_chain;
+    region_count = (regions[0].end > regions[0].start) ? 1 : 0;
+    *regions_out = regions;
+    *region_count_out = region_count;
+    return 1;
+  }
+
+  FILE *file = fopen(options->regions_filename, "r");
+  if (!file) {
+    printf("Error: cannot open regions file %s\n", options->regions_filename);
+    return 0;
+  }
+
+  size_t capacity = 0;
+  char line[512];
+  int line_number = 0;
+
+  while (fgets(line, sizeof(line), file)) {
+    line_number++;
+
+    char *comment = strchr(line, '#');
+    if (comment) {
+      *comment = '\0';
+    }
+
+    double start_time, end_time;
+    char chain_spec[256];
+    int fields =
+        sscanf(line, "%lf %lf %255s", &start_time, &end_time, chain_spec);
+    if (fields <= 0) {
+      continue;
+    }
+    if (fields < 2 || end_time < start_time) {
+      printf("Error: invalid region on line %d of %s\n", line_number,
+             options->regions_filename);
+      free(regions);
+      fclose(file);
+      return 0;
+    }
+
+    if (region_count == capacity) {
+      capacity = capacity ? capacity * 2 : 16;
+      Region *grown = (Region *)realloc(regions, capacity * sizeof(Region));
+      if (!grown) {
+        printf("Error: cannot allocate regions\n");
+        free(regions);
+        fclose(file);
+        return 0;
+      }
+      regions = grown;
+    }
+
+    Region *region = &regions[region_count];
+    region->start = time_to_data_offset(start_time, fmtData, data_size);
+    region->end = time_to_data_offset(end_time, fmtData, data_size);
+    if (fields == 3) {
+      if (!parse_op_chain(chain_spec, &region->chain)) {
+        printf("Error: invalid op chain \"%s\" on line %d of %s\n",
+               chain_spec, line_number, options->regions_filename);
+        free(regions);
+        fclose(file);
+        return 0;
+      }
+    } else {
+      region->chain = *default_chain;
+    }
+
+    if (region->end > region->start) {
+      region_count++;
+    }
+  }
+
+  fclose(file);
+
+  if (region_count > 0) {
+    qsort(regions, region_count, sizeof(Region), compare_regions);
+  }
+  for (size_t i = 1; i < region_count; i++) {
+    if (regions[i].start < regions[i - 1].end) {
+      printf("Error: overlapping regions in %s\n", options->regions_filename);
+      free(regions);
+      return 0;
+    }
+  }
+
+  *regions_out = regions;
+  *region_count_out = region_count;
+  return 1;
+}
+
+// Work and header buffers come from a process wide pool of 64-byte aligned
+// blocks in power of two size classes. Released blocks are cached for the
+// next job instead of going back to the allocator. With huge pages enabled,
+// blocks of 2 MiB and up are backed by MAP_HUGETLB when available and by
+// transparent huge pages otherwise. budget caps the bytes the pool holds
+// (in use plus cached), 0 means unlimited.
+#define POOL_ALIGNMENT 64
+#define POOL_MIN_BLOCK 4096
+#define POOL_CLASSES 24
+#define POOL_HUGE_PAGE (2 * 1024 * 1024)
+
+typedef struct PoolBlock {
+  struct PoolBlock *next;
+  void *data;
+  size_t size;
+  int size_class;
+  int mapped;
+} PoolBlock;
+
+typedef struct {
+  PoolBlock *free_lists[POOL_CLASSES];
+  PoolBlock *live;
+  size_t budget;
+  int huge_pages;
+  size_t in_use;
+  size_t cached;
+  size_t peak;
+  uint64_t hits;
+  uint64_t misses;
+  pthread_mutex_t lock;
+} BufferPool;
+
+BufferPool buffer_pool = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+void pool_free_block(PoolBlock *block) {
+#ifdef __linux__
+  if (block->mapped) {
+    munmap(block->data, block->size);
+    free(block);
+    return;
+  }
+#endif
+#ifdef _WIN32
+  _aligned_free(block->data);
+#else
+  free(block->data);
+#endif
+  free(block);
+}
+
+// Drops cached blocks, largest first, until need more bytes fit the budget.
+void pool_make_room(size_t need) {
+  for (int c = POOL_CLASSES - 1; c >= 0; c--) {
+    while (buffer_pool.free_lists[c] &&
+           buffer_pool.in_use + buffer_pool.cached + need >
+               buffer_pool.budget) {
+      PoolBlock *block = buffer_pool.free_lists[c];
+      buffer_pool.free_lists[c] = block->next;
+      buffer_pool.cached -= block->size;
+      pool_free_block(block);
+    }
+  }
+}
+
+PoolBlock *pool_allocate_block(size_t size) {
+  PoolBlock *block = (PoolBlock *)calloc(1, sizeof(PoolBlock));
+  if (!block) {
+    return NULL;
+  }
+  block->size = size;
+
+#ifdef __linux__
+  if (buffer_pool.huge_pages && size >= POOL_HUGE_PAGE) {
+    block->data = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (block->data == MAP_FAILED) {
+      block->data = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (block->data != MAP_FAILED) {
+        madvise(block->data, size, MADV_HUGEPAGE);
+      }
+    }
+    if (block->data != MAP_FAILED) {
+      block->mapped = 1;
+      return block;
+    }
+    block->data = NULL;
+  }
+#endif
+
+#ifdef _WIN32
+  block->data = _aligned_malloc(size, POOL_ALIGNMENT);
+#else
+  if (posix_memalign(&block->data, POOL_ALIGNMENT, size) != 0) {
+    block->data = NULL;
+  }
+#endif
+  if (!block->data) {
+    free(block);
+    return NULL;
+  }
+  return block;
+}
+
+void *pool_acquire(size_t size) {
+  int size_class = 0;
+  size_t class_size = POOL_MIN_BLOCK;
+  while (class_size < size) {
+    class_size <<= 1;
+    size_class++;
+  }
+  if (size_class >= POOL_CLASSES) {
+    return NULL;
+  }
+
+  pthread_mutex_lock(&buffer_pool.lock);
+
+  PoolBlock *block = buffer_pool.free_lists[size_class];
+  if (block) {
+    buffer_pool.free_lists[size_class] = block->next;
+    buffer_pool.cached -= block->size;
+    buffer_pool.hits++;
+  } else {
+    if (buffer_pool.budget) {
+      pool_make_room(class_size);
+      if (buffer_pool.in_use + buffer_pool.cached + class_size >
+          buffer_pool.budget) {
+        pthread_mutex_unlock(&buffer_pool.lock);
+        return NULL;
+      }
+    }
+    block = pool_allocate_block(class_size);
+    if (!block) {
+      pthread_mutex_unlock(&buffer_pool.lock);
+      return NULL;
+    }
+    block->size_class = size_class;
+    buffer_pool.misses++;
+  }
+
+  block->next = buffer_pool.live;
+  buffer_pool.live = block;
+  buffer_pool.in_use += block->size;
+  if (buffer_pool.in_use + buffer_pool.cached > buffer_pool.peak) {
+    buffer_pool.peak = buffer_pool.in_use + buffer_pool.cached;
+  }
+
+  pthread_mutex_unlock(&buffer_pool.lock);
+  return block->data;
+}
+
+void pool_release(void *data) {
+  if (!data) {
+    return;
+  }
+
+  pthread_mutex_lock(&buffer_pool.lock);
+
+  PoolBlock **link = &buffer_pool.live;
+  while (*link && (*link)->data != data) {
+    link = &(*link)->next;
+  }
+  PoolBlock *block = *link;
+  if (block) {
+    *link = block->next;
+    buffer_pool.in_use -= block->size;
+    block->next = buffer_pool.free_lists[block->size_class];
+    buffer_pool.free_lists[block->size_class] = block;
+    buffer_pool.cached += block->size;
+  }
+
+  pthread_mutex_unlock(&buffer_pool.lock);
+}
+
+void print_pool_stats(void) {
+  pthread_mutex_lock(&buffer_pool.lock);
+  printf("Buffer pool: %llu hits, %llu misses, peak %zu KiB, cached %zu KiB\n",
+         (unsigned long long)buffer_pool.hits,
+         (unsigned long long)buffer_pool.misses, buffer_pool.peak / 1024,
+         buffer_pool.cached / 1024);
+  pthread_mutex_unlock(&buffer_pool.lock);
+}
+
+// Checksums use XXH64: a streaming, non-cryptographic 64-bit hash that keeps
+// up with memory bandwidth. It is fed the same buffers that are written, so
+// producing it costs no extra pass over the file.
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+typedef struct {
+  uint64_t total_len;
+  uint64_t acc[4];
+  uint8_t pending[32];
+  size_t pending_size;
+} Xxh64State;
+
+uint64_t xxh64_rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+uint64_t xxh64_read64(const uint8_t *p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+uint32_t xxh64_read32(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+uint64_t xxh64_round(uint64_t acc, uint64_t input) {
+  acc += input * XXH_PRIME64_2;
+  acc = xxh64_rotl(acc, 31);
+  return acc * XXH_PRIME64_1;
+}
+
+uint64_t xxh64_merge_round(uint64_t acc, uint64_t val) {
+  acc ^= xxh64_round(0, val);
+  return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+void xxh64_reset(Xxh64State *state) {
+  memset(state, 0, sizeof(*state));
+  state->acc[0] = XXH_PRIME64_1 + XXH_PRIME64_2;
+  state->acc[1] = XXH_PRIME64_2;
+  state->acc[2] = 0;
+  state->acc[3] = 0 - XXH_PRIME64_1;
+}
+
+void xxh64_stripes(Xxh64State *state, const uint8_t *p, size_t stripes) {
+  uint64_t a0 = state->acc[0], a1 = state->acc[1];
+  uint64_t a2 = state->acc[2], a3 = state->acc[3];
+  for (size_t s = 0; s < stripes; s++, p += 32) {
+    a0 = xxh64_round(a0, xxh64_read64(p));
+    a1 = xxh64_round(a1, xxh64_read64(p + 8));
+    a2 = xxh64_round(a2, xxh64_read64(p + 16));
+    a3 = xxh64_round(a3, xxh64_read64(p + 24));
+  }
+  state->acc[0] = a0;
+  state->acc[1] = a1;
+  state->acc[2] = a2;
+  state->acc[3] = a3;
+}
+
+void xxh64_update(Xxh64State *state, const uint8_t *data, size_t size) {
+  state->total_len += size;
+
+  if (state->pending_size) {
+    size_t take = 32 - state->pending_size;
+    if (take > size) {
+      take = size;
+    }
+    memcpy(state->pending + state->pending_size, data, take);
+    state->pending_size += take;
+    data += take;
+    size -= take;
+    if (state->pending_size < 32) {
+      return;
+    }
+    xxh64_stripes(state, state->pending, 1);
+    state->pending_size = 0;
+  }
+
+  xxh64_stripes(state, data, size / 32);
+  data += size - size % 32;
+  memcpy(state->pending, data, size % 32);
+  state->pending_size = size % 32;
+}
+
+uint64_t xxh64_digest(const Xxh64State *state) {
+  uint64_t h;
+  if (state->total_len >= 32) {
+    h = xxh64_rotl(state->acc[0], 1) + xxh64_rotl(state->acc[1], 7) +
+        xxh64_rotl(state->acc[2], 12) + xxh64_rotl(state->acc[3], 18);
+    for (int i = 0; i < 4; i++) {
+      h = xxh64_merge_round(h, state->acc[i]);
+    }
+  } else {
+    h = state->acc[2] + XXH_PRIME64_5;
+  }
+  h += state->total_len;
+
+  const uint8_t *p = state->pending;
+  size_t left = state->pending_size;
+  for (; left >= 8; left -= 8, p += 8) {
+    h ^= xxh64_round(0, xxh64_read64(p));
+    h = xxh64_rotl(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+  }
+  if (left >= 4) {
+    h ^= (uint64_t)xxh64_read32(p) * XXH_PRIME64_1;
+    h = xxh64_rotl(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+    p += 4;
+    left -= 4;
+  }
+  for (; left > 0; left--, p++) {
+    h ^= *p * XXH_PRIME64_5;
+    h = xxh64_rotl(h, 11) * XXH_PRIME64_1;
+  }
+
+  h ^= h >> 33;
+  h *= XXH_PRIME64_2;
+  h ^= h >> 29;
+  h *= XXH_PRIME64_3;
+  h ^= h >> 32;
+  return h;
+}
+
+// Writes text as a JSON string literal, escaping quotes, backslashes and
+// control characters.
+void write_json_string(FILE *file, const char *text) {
+  fputc('"', file);
+  for (const unsigned char *p = (const unsigned char *)text; *p; p++) {
+    if (*p == '"' || *p == '\\') {
+      fprintf(file, "\\%c", *p);
+    } else if (*p < 0x20) {
+      fprintf(file, "\\u%04x", *p);
+    } else {
+      fputc(*p, file);
+    }
+  }
+  fputc('"', file);
+}
+
+// Writes the output hash as "<output>.xxh64" in the format xxhsum -H1 prints
+// and checks with -c, and optionally a JSON report including the input hash.
+int write_checksums(const char *input_filename, const char *output_filename,
+                    const ProcessOptions *options, const Xxh64State *output,
+                    const Xxh64State *input) {
+  if (options->checksum) {
+    char sidecar[4096];
+    snprintf(sidecar, sizeof(sidecar), "%s.xxh64", output_filename);
+    FILE *file = fopen(sidecar, "w");
+    if (!file) {
+      printf("Error: cannot create checksum file %s\n", sidecar);
+      return 0;
+    }
+    fprintf(file, "%016llx  %s\n", (unsigned long long)xxh64_digest(output),
+            output_filename);
+    if (fclose(file) != 0) {
+      printf("Error: cannot write checksum file %s\n", sidecar);
+      return 0;
+    }
+  }
+
+  if (options->checksum_json) {
+    FILE *file = fopen(options->checksum_json, "w");
+    if (!file) {
+      printf("Error: cannot create checksum file %s\n",
+             options->checksum_json);
+      return 0;
+    }
+    fprintf(file, "{\n  \"algorithm\": \"xxh64\",\n");
+    fprintf(file, "  \"output\": {\"file\": ");
+    write_json_string(file, output_filename);
+    fprintf(file, ", \"bytes\": %llu, \"hash\": \"%016llx\"}",
+            (unsigned long long)output->total_len,
+            (unsigned long long)xxh64_digest(output));
+    if (input) {
+      fprintf(file, ",\n  \"input_data\": {\"file\": ");
+      write_json_string(file, input_filename);
+      fprintf(file, ", \"bytes\": %llu, \"hash\": \"%016llx\"}",
+              (unsigned long long)input->total_len,
+              (unsigned long long)xxh64_digest(input));
+    }
+    fprintf(file, "\n}\n");
+    if (fclose(file) != 0) {
+      printf("Error: cannot write checksum file %s\n",
+             options->checksum_json);
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+// Analysis mode reads the data chunk once and writes nothing. Levels come
+// from per-channel sample histograms (256 or 65536 bins) in the processing
+// format. For a byte-map chain on PCM the output histogram and the changed
+// byte counts follow from the input histogram and the per-lane tables, so
+// the chain never runs over the data. Other chains are rendered in memory and
+// compared against a copy of the input.
+typedef struct {
+  int channels;
+  int bits;
+  size_t bins;
+  uint64_t *input_hist;
+  uint64_t *output_hist;
+  uint64_t *range_hist;
+  uint64_t *changed;
+  uint64_t *bytes;
+  uint8_t *original;
+  int16_t *pcm;
+} Analysis;
+
+void free_analysis(Analysis *analysis) {
+  free(analysis->input_hist);
+  free(analysis->output_hist);
+  free(analysis->range_hist);
+  free(analysis->changed);
+  free(analysis->bytes);
+  pool_release(analysis->original);
+  pool_release(analysis->pcm);
+}
+
+int init_analysis(Analysis *analysis, const WavFmtData *pcm_fmt,
+                  size_t buffer_size, size_t pcm_size) {
+  memset(analysis, 0, sizeof(Analysis));
+  analysis->channels = pcm_fmt->numChannels;
+  analysis->bits = pcm_fmt->bitsPerSample;
+  analysis->bins = (analysis->bits == 8) ? 256 : 65536;
+
+  size_t cells = analysis->channels * analysis->bins;
+  analysis->input_hist = (uint64_t *)calloc(cells, sizeof(uint64_t));
+  analysis->output_hist = (uint64_t *)calloc(cells, sizeof(uint64_t));
+  analysis->range_hist = (uint64_t *)calloc(cells, sizeof(uint64_t));
+  analysis->changed =
+      (uint64_t *)calloc(analysis->channels, sizeof(uint64_t));
+  analysis->bytes = (uint64_t *)calloc(analysis->channels, sizeof(uint64_t));
+  analysis->original = (uint8_t *)pool_acquire(buffer_size);
+  if (pcm_size) {
+    analysis->pcm = (int16_t *)pool_acquire(pcm_size);
+  }
+
+  if (!analysis->input_hist || !analysis->output_hist ||
+      !analysis->range_hist || !analysis->changed || !analysis->bytes ||
+      !analysis->original || (pcm_size && !analysis->pcm)) {
+    free_analysis(analysis);
+    return 0;
+  }
+  return 1;
+}
+
+// Adds the samples of a PCM buffer to a per-channel histogram. Scattered
+// increments do not vectorize, so 8-bit data is counted into four interleaved
+// sub-histograms, which keeps repeated values from serializing on one counter.
+void histogram_samples(const uint8_t *data, size_t size,
+                       const WavFmtData *pcm_fmt, uint64_t *hist) {
+  int channels = pcm_fmt->numChannels;
+
+  if (pcm_fmt->bitsPerSample == 16) {
+    const int16_t *samples = (const int16_t *)data;
+    size_t count = size / 2;
+    int c = 0;
+    for (size_t i = 0; i < count; i++) {
+      hist[(size_t)c * 65536 + (uint16_t)samples[i]]++;
+      if (++c == channels) {
+        c = 0;
+      }
+    }
+    return;
+  }
+
+  uint32_t sub[4][256];
+  for (int c = 0; c < channels; c++) {
+    memset(sub, 0, sizeof(sub));
+    size_t i = c;
+    size_t stride = channels;
+    for (; i + 3 * stride < size; i += 4 * stride) {
+      sub[0][data[i]]++;
+      sub[1][data[i + stride]]++;
+      sub[2][data[i + 2 * stride]]++;
+      sub[3][data[i + 3 * stride]]++;
+    }
+    for (; i < size; i += stride) {
+      sub[0][data[i]]++;
+    }
+    for (int v = 0; v < 256; v++) {
+      hist[c * 256 + v] += sub[0][v] + sub[1][v] + sub[2][v] + sub[3][v];
+    }
+  }
+}
+
+// Folds the pending range histogram into the totals, mapping each sample
+// through per-lane byte tables (NULL for an untouched range).
+void fold_range_histogram(Analysis *analysis,
+                          const uint8_t (*tables)[256]) {
+  int bytes_per_sample = analysis->bits / 8;
+
+  for (int c = 0; c < analysis->channels; c++) {
+    uint64_t *range = analysis->range_hist + c * analysis->bins;
+    uint64_t *input = analysis->input_hist + c * analysis->bins;
+    uint64_t *output = analysis->output_hist + c * analysis->bins;
+
+    for (size_t v = 0; v < analysis->bins; v++) {
+      uint64_t n = range[v];
+      if (n == 0) {
+        continue;
+      }
+      range[v] = 0;
+
+      size_t out = v;
+      if (tables && bytes_per_sample == 1) {
+        out = tables[c][v];
+        analysis->changed[c] += (out != v) ? n : 0;
+      } else if (tables) {
+        uint8_t lo = tables[2 * c][v & 0xFF];
+        uint8_t hi = tables[2 * c + 1][v >> 8];
+        out = lo | (hi << 8);
+        analysis->changed[c] +=
+            n * ((lo != (v & 0xFF)) + (hi != (v >> 8)));
+      }
+
+      input[v] += n;
+      output[out] += n;
+      analysis->bytes[c] += n * bytes_per_sample;
+    }
+  }
+}
+
+// Channel a byte of the data chunk belongs to. IMA ADPCM blocks start with
+// one 4 byte header per channel followed by interleaved 4 byte words.
+int channel_of_byte(const WavFmtData *fmtData, uint64_t offset) {
+  uint32_t in_block = offset % fmtData->blockAlign;
+  if (fmtData->audioFormat == WAVE_FORMAT_IMA_ADPCM) {
+    uint32_t header = 4u * fmtData->numChannels;
+    if (in_block < header) {
+      return in_block / 4;
+    }
+    return ((in_block - header) / 4) % fmtData->numChannels;
+  }
+  return in_block / ((fmtData->bitsPerSample + 7) / 8);
+}
+
+void count_changed_bytes(Analysis *analysis, const uint8_t *original,
+                         const uint8_t *data, size_t size, uint64_t position,
+                         const WavFmtData *fmtData) {
+  for (size_t i = 0; i < size; i++) {
+    int c = channel_of_byte(fmtData, position + i);
+    analysis->changed[c] += original[i] != data[i];
+    analysis->bytes[c]++;
+  }
+}
+
+// Adds a buffer in the file's format to a histogram, decoding it first when
+// the file is not PCM.
+void histogram_file_samples(Analysis *analysis, const uint8_t *data,
+                            size_t size, const WavFmtData *fmtData,
+                            const WavFmtData *pcm_fmt, uint64_t *hist) {
+  if (fmtData->audioFormat != WAVE_FORMAT_PCM) {
+    size = decode_samples(data, size, fmtData, analysis->pcm);
+    data = (const uint8_t *)analysis->pcm;
+  }
+  histogram_samples(data, size, pcm_fmt, hist);
+}
+
+void print_level(const char *label, const uint64_t *hist, int bits) {
+  double full_scale = (bits == 8) ? 128.0 : 32768.0;
+  size_t bins = (bits == 8) ? 256 : 65536;
+  uint64_t count = 0;
+  uint64_t silent = 0;
+  uint64_t clipped = 0;
+  double peak = 0;
+  double sum = 0;
+
+  for (size_t v = 0; v < bins; v++) {
+    if (hist[v] == 0) {
+      continue;
+    }
+    double x = (bits == 8) ? (double)v - 128 : (double)(int16_t)v;
+    double magnitude = fabs(x);
+    count += hist[v];
+    sum += hist[v] * x * x;
+    if (magnitude > peak) {
+      peak = magnitude;
+    }
+    if (magnitude < full_scale / 1024) {
+      silent += hist[v];
+    }
+    if (magnitude >= full_scale - 1) {
+      clipped += hist[v];
+    }
+  }
+
+  if (count == 0) {
+    printf("    %s: no samples\n", label);
+    return;
+  }
+  double rms = sqrt(sum / count);
+  printf("    %s: peak %.1f dBFS, RMS %.1f dBFS, silent %.1f%%, "
+         "full-scale %.1f%%\n",
+         label, peak > 0 ? 20 * log10(peak / full_scale) : -INFINITY,
+         rms > 0 ? 20 * log10(rms / full_scale) : -INFINITY,
+         100.0 * silent / count, 100.0 * clipped / count);
+}
+
+void print_analysis(const Analysis *analysis) {
+  uint64_t changed = 0;
+  uint64_t bytes = 0;
+  for (int c = 0; c < analysis->channels; c++) {
+    changed += analysis->changed[c];
+    bytes += analysis->bytes[c];
+  }
+
+  printf("Analysis (no output written):\n");
+  printf("  Changed bytes: %llu of %llu (%.1f%%)\n",
+         (unsigned long long)changed, (unsigned long long)bytes,
+         bytes ? 100.0 * changed / bytes : 0.0);
+  for (int c = 0; c < analysis->channels; c++) {
+    printf("  Channel %d: %.1f%% of bytes changed\n", c,
+           analysis->bytes[c] ? 100.0 * analysis->changed[c] /
+                                    analysis->bytes[c]
+                              : 0.0);
+    print_level("input ", analysis->input_hist + c * analysis->bins,
+                analysis->bits);
+    print_level("output", analysis->output_hist + c * analysis->bins,
+                analysis->bits);
+  }
+}
+
+// With --journal the output is synced and the committed data offset recorded
+// every JOURNAL_INTERVAL bytes, together with a fingerprint of the input and
+// the job. A rerun with the same journal and a matching fingerprint continues
+// from the last checkpoint instead of from the start.
+#define JOURNAL_INTERVAL (64ULL * 1024 * 1024)
+
+typedef struct {
+  const char *filename;
+  uint64_t fingerprint;
+  uint64_t committed;
+} Journal;
+
+void hash_value(Xxh64State *state, const void *value, size_t size) {
+  xxh64_update(state, (const uint8_t *)value, size);
+}
+
+void hash_op_chain(Xxh64State *state, const OpChain *chain) {
+  hash_value(state, &chain->count, sizeof(chain->count));
+  for (int i = 0; i < chain->count; i++) {
+    const OperationInfo *info = chain->ops[i].info;
+    hash_value(state, info->name, strlen(info->name) + 1);
+    if (info->parse_value == parse_noise) {
+      const NoiseSpec *spec = &noise_specs[chain->ops[i].value];
+      hash_value(state, &spec->rate, sizeof(spec->rate));
+      hash_value(state, &spec->seed, sizeof(spec->seed));
+      continue;
+    }
+    if (info->parse_value != compile_expression) {
+      hash_value(state, &chain->ops[i].value, sizeof(int));
+      continue;
+    }
+    const ExprProgram *program = &expr_programs[chain->ops[i].value];
+    for (int k = 0; k < program->length; k++) {
+      const ExprInstr *instr = &program->code[k];
+      uint8_t fields[5] = {instr->opcode, instr->dst, instr->a, instr->b,
+                           instr->b_is_imm};
+      hash_value(state, fields, sizeof(fields));
+      hash_value(state, &instr->imm, sizeof(instr->imm));
+    }
+    hash_value(state, &program->result, sizeof(program->result));
+  }
+}
+
+// Identifies the input by size, modification time and header, and the job by
+// everything that decides the output bytes.
+uint64_t job_fingerprint(FILE *input_file, const uint8_t *header,
+                         long data_offset, const Region *regions,
+                         size_t region_count, const ProcessOptions *options) {
+  Xxh64State state;
+  xxh64_reset(&state);
+
+  struct stat info;
+  if (fstat(fileno(input_file), &info) == 0) {
+    int64_t size = info.st_size;
+    int64_t mtime = info.st_mtime;
+    hash_value(&state, &size, sizeof(size));
+    hash_value(&state, &mtime, sizeof(mtime));
+  }
+  hash_value(&state, header, data_offset);
+
+  for (size_t r = 0; r < region_count; r++) {
+    hash_value(&state, &regions[r].start, sizeof(regions[r].start));
+    hash_value(&state, &regions[r].end, sizeof(regions[r].end));
+    hash_op_chain(&state, &regions[r].chain);
+  }
+  for (int c = 0; c < MAX_CHANNELS; c++) {
+    if (options->channel_chain_set[c]) {
+      hash_value(&state, &c, sizeof(c));
+      hash_op_chain(&state, &options->channel_chains[c]);
+    }
+  }
+
+  const Envelope *envelope = &options->automation;
+  double params[5] = {envelope->from, envelope->to, envelope->center,
+                      envelope->depth, envelope->rate};
+  int type = envelope->type;
+  hash_value(&state, &type, sizeof(type));
+  hash_value(&state, params, sizeof(params));
+  for (size_t i = 0; i < envelope->point_count; i++) {
+    hash_value(&state, &envelope->points[i].time, sizeof(double));
+    hash_value(&state, &envelope->points[i].value, sizeof(double));
+  }
+
+  const Glitch *glitch = &options->glitch;
+  int glitch_type = glitch->type;
+  hash_value(&state, &glitch_type, sizeof(glitch_type));
+  hash_value(&state, &glitch->segment_ms, sizeof(glitch->segment_ms));
+  hash_value(&state, &glitch->repeats, sizeof(glitch->repeats));
+  hash_value(&state, &glitch->seed, sizeof(glitch->seed));
+
+  const Combine *combine = &options->combine;
+  int combine_params[2] = {combine->type, combine->length};
+  hash_value(&state, combine_params, sizeof(combine_params));
+  for (size_t i = 0; i < combine->count; i++) {
+    if (stat(combine->filenames[i], &info) == 0) {
+      int64_t size = info.st_size;
+      int64_t mtime = info.st_mtime;
+      hash_value(&state, &size, sizeof(size));
+      hash_value(&state, &mtime, sizeof(mtime));
+    }
+  }
+
+  return xxh64_digest(&state);
+}
+
+int sync_file(FILE *file) {
+  if (fflush(file) != 0) {
+    return 0;
+  }
+#ifdef _WIN32
+  return _commit(_fileno(file)) == 0;
+#else
+  return fsync(fileno(file)) == 0;
+#endif
+}
+
+// Output is written to OUTPUT.part in the same directory, with its final
+// size reserved up front, and renamed over OUTPUT once complete, so readers
+// never see a partial file under the final name. Durability decides what is
+// synced: nothing, the file before the rename, or also the directory after
+// it so the rename itself survives a power loss.
+int parse_durability(const char *name, Durability *durability) {
+  if (strcmp(name, "none") == 0) {
+    *durability = DURABILITY_NONE;
+  } else if (strcmp(name, "data") == 0) {
+    *durability = DURABILITY_DATA;
+  } else if (strcmp(name, "full") == 0) {
+    *durability = DURABILITY_FULL;
+  } else {
+    return 0;
+  }
+  return 1;
+}
+
+// Reserves size bytes without changing the file size, so extents can be
+// allocated contiguously. Filesystems without support just skip it.
+void preallocate_file(FILE *file, uint64_t size) {
+#ifdef __linux__
+  fallocate(fileno(file), FALLOC_FL_KEEP_SIZE, 0, (off_t)size);
+#else
+  (void)file;
+  (void)size;
+#endif
+}
+
+int sync_directory_of(const char *filename) {
+#ifdef _WIN32
+  (void)filename;
+  return 1;
+#else
+  char directory[4096];
+  snprintf(directory, sizeof(directory), "%s", filename);
+  char *slash = strrchr(directory, '/');
+  if (!slash) {
+    strcpy(directory, ".");
+  } else if (slash == directory) {
+    slash[1] = '\0';
+  } else {
+    *slash = '\0';
+  }
+
+  int fd = open(directory, O_RDONLY);
+  if (fd < 0) {
+    return 0;
+  }
+  int ok = fsync(fd) == 0;
+  close(fd);
+  return ok;
+#endif
+}
+
+int commit_output(const char *temp_filename, const char *output_filename,
+                  Durability durability) {
+#ifdef _WIN32
+  remove(output_filename);
+#endif
+  if (rename(temp_filename, output_filename) != 0) {
+    printf("Error: cannot rename %s to %s\n", temp_filename, output_filename);
+    return 0;
+  }
+  if (durability == DURABILITY_FULL && !sync_directory_of(output_filename)) {
+    printf("Error: cannot sync directory of %s\n", output_filename);
+    return 0;
+  }
+  return 1;
+}
+
+int read_journal(const char *filename, uint64_t *fingerprint,
+                 uint64_t *committed) {
+  FILE *file = fopen(filename, "r");
+  if (!file) {
+    return 0;
+  }
+  unsigned long long hash;
+  unsigned long long offset;
+  int ok = fscanf(file,
+                  "soundbadizer journal 1 fingerprint %llx committed %llu",
+                  &hash, &offset) == 2;
+  fclose(file);
+  if (ok) {
+    *fingerprint = hash;
+    *committed = offset;
+  }
+  return ok;
+}
+
+// Writes the journal next to itself and renames it into place, so a crash
+// leaves either the old or the new checkpoint.
+int write_journal(Journal *journal, uint64_t committed) {
+  char temp_name[4096];
+  snprintf(temp_name, sizeof(temp_name), "%s.tmp", journal->filename);
+  FILE *file = fopen(temp_name, "w");
+  if (!file) {
+    printf("Error: cannot create journal %s\n", temp_name);
+    return 0;
+  }
+  fprintf(file, "soundbadizer journal 1\nfingerprint %016llx\ncommitted %llu\n",
+          (unsigned long long)journal->fingerprint,
+          (unsigned long long)committed);
+  int ok = sync_file(file);
+  if (fclose(file) != 0 || !ok) {
+    printf("Error: cannot write journal %s\n", temp_name);
+    return 0;
+  }
+#ifdef _WIN32
+  remove(journal->filename);
+#endif
+  if (rename(temp_name, journal->filename) != 0) {
+    printf("Error: cannot replace journal %s\n", journal->filename);
+    return 0;
+  }
+  journal->committed = committed;
+  return 1;
+}
+
+uint64_t gcd_u64(uint64_t a, uint64_t b) {
+  while (b) {
+    uint64_t t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+uint64_t lcm_decimate(uint64_t frames, const OpChain *chain) {
+  for (int i = 0; i < chain->count; i++) {
+    if (chain->ops[i].info->frame_kernel == apply_decimate) {
+      uint64_t value = chain->ops[i].value;
+      frames = frames / gcd_u64(frames, value) * value;
+    }
+  }
+  return frames;
+}
+
+// Decimate groups are counted from the start of the data chunk and IMA ADPCM
+// is coded in whole blocks, so rendering can only restart on an offset that
+// is a multiple of every group and block. Any other state is rebuilt from the
+// position.
+uint64_t resume_alignment(const WavFmtData *fmtData, const Region *regions,
+                          size_t region_count, const ProcessOptions *options) {
+  uint64_t block_frames = frames_per_block(fmtData);
+  uint64_t frames = block_frames;
+  for (size_t r = 0; r < region_count && frames < (1ULL << 40); r++) {
+    frames = lcm_decimate(frames, &regions[r].chain);
+  }
+  for (int c = 0; c < MAX_CHANNELS && frames < (1ULL << 40); c++) {
+    if (options->channel_chain_set[c]) {
+      frames = lcm_decimate(frames, &options->channel_chains[c]);
+    }
+  }
+  if (frames >= (1ULL << 40)) {
+    return UINT64_MAX;
+  }
+  return frames / block_frames * fmtData->blockAlign;
+}
+
+// Data offset to restart from, or 0 when the journal is missing, belongs to
+// another job or points past the end of the output.
+uint64_t find_resume_position(const Journal *journal,
+                              const char *output_filename, long data_offset,
+                              const WavFmtData *fmtData, const Region *regions,
+                              size_t region_count,
+                              const ProcessOptions *options) {
+  uint64_t fingerprint;
+  uint64_t committed;
+  if (!read_journal(journal->filename, &fingerprint, &committed)) {
+    return 0;
+  }
+  if (fingerprint != journal->fingerprint) {
+    printf("Journal %s belongs to a different job, starting over\n",
+           journal->filename);
+    return 0;
+  }
+
+  struct stat info;
+  if (stat(output_filename, &info) != 0 ||
+      (uint64_t)info.st_size < data_offset + committed) {
+    printf("Output %s is shorter than its journal, starting over\n",
+           output_filename);
+    return 0;
+  }
+
+  uint64_t alignment =
+      resume_alignment(fmtData, regions, region_count, options);
+  return committed - committed % alignment;
+}
+
+// Work block size and fan-out ring depth. Defaults suit local disks; runs
+// load the values --autotune measured for the device holding the input from
+// the tuning file, and --block-size and --queue-depth override both.
+#define MAX_FAN_OUT_SLOTS 64
+#define MIN_BLOCK_SIZE (64 * 1024)
+#define MAX_BLOCK_SIZE (64 * 1024 * 1024)
+#define TUNING_HEADER "# soundbadizer tuning: device block_size queue_depth\n"
+
+typedef struct {
+  size_t block_size;
+  size_t queue_depth;
+} IoTuning;
+
+IoTuning io_tuning = {1024 * 1024, 8};
+
+int valid_tuning(size_t block_size, size_t queue_depth) {
+  return block_size >= MIN_BLOCK_SIZE && block_size <= MAX_BLOCK_SIZE &&
+         queue_depth >= 2 && queue_depth <= MAX_FAN_OUT_SLOTS;
+}
+
+// SOUNDBADIZER_TUNING, or soundbadizer-tuning in the user config directory.
+int tuning_filename(char *filename, size_t size) {
+  const char *path = getenv("SOUNDBADIZER_TUNING");
+  if (path) {
+    return snprintf(filename, size, "%s", path) < (int)size;
+  }
+#ifdef _WIN32
+  const char *dir = getenv("LOCALAPPDATA");
+  if (!dir) {
+    return 0;
+  }
+  return snprintf(filename, size, "%s\\soundbadizer-tuning", dir) <
+         (int)size;
+#else
+  const char *dir = getenv("XDG_CONFIG_HOME");
+  if (dir && *dir) {
+    return snprintf(filename, size, "%s/soundbadizer-tuning", dir) <
+           (int)size;
+  }
+  const char *home = getenv("HOME");
+  if (!home) {
+    return 0;
+  }
+  char config_dir[4096];
+  snprintf(config_dir, sizeof(config_dir), "%s/.config", home);
+  mkdir(config_dir, 0700);
+  return snprintf(filename, size, "%s/soundbadizer-tuning", config_dir) <
+         (int)size;
+#endif
+}
+
+int device_of(const char *path, unsigned long long *device) {
+  struct stat info;
+  if (stat(path, &info) != 0) {
+    return 0;
+  }
+  *device = (unsigned long long)info.st_dev;
+  return 1;
+}
+
+// Loads the tuning recorded for the device holding path, if there is one.
+int load_tuning(const char *path, IoTuning *tuning) {
+  char filename[4096];
+  unsigned long long device;
+  if (!device_of(path, &device) ||
+      !tuning_filename(filename, sizeof(filename))) {
+    return 0;
+  }
+  FILE *file = fopen(filename, "r");
+  if (!file) {
+    return 0;
+  }
+
+  char line[256];
+  int found = 0;
+  while (!found && fgets(line, sizeof(line), file)) {
+    unsigned long long line_device;
+    size_t block_size;
+    size_t queue_depth;
+    if (sscanf(line, "%llx %zu %zu", &line_device, &block_size,
+               &queue_depth) == 3 &&
+        line_device == device && valid_tuning(block_size, queue_depth)) {
+      tuning->block_size = block_size;
+      tuning->queue_depth = queue_depth;
+      found = 1;
+    }
+  }
+  fclose(file);
+  return found;
+}
+
+// Records the tuning for device, replacing any earlier entry for it.
+int save_tuning(unsigned long long device, const IoTuning *tuning) {
+  char filename[4096];
+  char temp_name[4096 + 8];
+  if (!tuning_filename(filename, sizeof(filename))) {
+    printf("Error: no config directory for the tuning file\n");
+    return 0;
+  }
+  snprintf(temp_name, sizeof(temp_name), "%s.tmp", filename);
+
+  FILE *output = fopen(temp_name, "w");
+  if (!output) {
+    printf("Error: cannot write tuning file %s\n", temp_name);
+    return 0;
+  }
+  fputs(TUNING_HEADER, output);
+
+  FILE *input = fopen(filename, "r");
+  if (input) {
+    char line[256];
+    while (fgets(line, sizeof(line), input)) {
+      unsigned long long line_device;
+      if (line[0] == '#' || (sscanf(line, "%llx", &line_device) == 1 &&
+                             line_device == device)) {
+        continue;
+      }
+      fputs(line, output);
+    }
+    fclose(input);
+  }
+  fprintf(output, "%llx %zu %zu\n", device, tuning->block_size,
+          tuning->queue_depth);
+
+  if (fclose(output) != 0) {
+    printf("Error: cannot write tuning file %s\n", temp_name);
+    remove(temp_name);
+    return 0;
+  }
+#ifdef _WIN32
+  remove(filename);
+#endif
+  if (rename(temp_name, filename) != 0) {
+    printf("Error: cannot replace tuning file %s\n", filename);
+    remove(temp_name);
+    return 0;
+  }
+  printf("Saved tuning to %s\n", filename);
+  return 1;
+}
+
+// Streaming mode for bulk passes: pages of the input and output are advised
+// out of the page cache once the job is a window past them, so a long run
+// does not evict everything else on the machine. Output pages are written
+// back first, a window behind the writer, so dropping them never blocks on
+// fresh data. With direct I/O the input is read with O_DIRECT through an
+// aligned buffer and never enters the page cache at all.
+#define STREAM_WINDOW (8 * 1024 * 1024)
+#define STREAM_READAHEAD (4 * STREAM_WINDOW)
+#define DIRECT_ALIGNMENT 4096
+#define DIRECT_BLOCK (4 * 1024 * 1024)
+
+typedef struct {
+  uint64_t dropped;
+  uint64_t flushed;
+} PageCursor;
+
+typedef struct {
+  FILE *input_file;
+  uint64_t data_offset;
+  PageCursor input;
+  int direct_fd;
+  uint8_t *direct_buffer;
+  uint64_t direct_start;
+  uint64_t direct_end;
+} InputStream;
+
+int open_input_stream(InputStream *stream, const char *input_filename,
+                      FILE *input_file, long data_offset,
+                      const ProcessOptions *options) {
+  memset(stream, 0, sizeof(InputStream));
+  stream->input_file = input_file;
+  stream->data_offset = data_offset;
+  stream->direct_fd = -1;
+
+#ifdef __linux__
+  int fd = fileno(input_file);
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  posix_fadvise(fd, data_offset, STREAM_READAHEAD, POSIX_FADV_WILLNEED);
+
+  if (options->direct_io) {
+    stream->direct_fd = open(input_filename, O_RDONLY | O_DIRECT);
+    if (stream->direct_fd < 0) {
+      printf("Error: cannot open %s for direct I/O: %s\n", input_filename,
+             strerror(errno));
+      return 0;
+    }
+    void *buffer;
+    if (posix_memalign(&buffer, DIRECT_ALIGNMENT, DIRECT_BLOCK) != 0) {
+      printf("Error: cannot allocate direct I/O buffer\n");
+      close(stream->direct_fd);
+      stream->direct_fd = -1;
+      return 0;
+    }
+    stream->direct_buffer = (uint8_t *)buffer;
+  }
+#endif
+  return 1;
+}
+
+void close_input_stream(InputStream *stream) {
+#ifdef __linux__
+  posix_fadvise(fileno(stream->input_file), 0, 0, POSIX_FADV_DONTNEED);
+  if (stream->direct_fd >= 0) {
+    close(stream->direct_fd);
+  }
+  free(stream->direct_buffer);
+#endif
+}
+
+// Reads size bytes at file offset through the aligned direct I/O buffer.
+int direct_read(InputStream *stream, uint64_t offset, uint8_t *data,
+                size_t size) {
+#ifdef __linux__
+  while (size > 0) {
+    if (offset < stream->direct_start || offset >= stream->direct_end) {
+      uint64_t start = offset - offset % DIRECT_ALIGNMENT;
+      ssize_t n = pread(stream->direct_fd, stream->direct_buffer,
+                        DIRECT_BLOCK, (off_t)start);
+      if (n <= 0 || start + (uint64_t)n <= offset) {
+        return 0;
+      }
+      stream->direct_start = start;
+      stream->direct_end = start + n;
+    }
+
+    size_t n = stream->direct_end - offset;
+    if (n > size) {
+      n = size;
+    }
+    memcpy(data, stream->direct_buffer + (offset - stream->direct_start), n);
+    data += n;
+    size -= n;
+    offset += n;
+  }
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+// Drops input pages behind offset and asks for the next ones ahead of time.
+void drop_input_pages(InputStream *stream, uint64_t offset) {
+#ifdef __linux__
+  PageCursor *cursor = &stream->input;
+  if (offset - cursor->dropped < STREAM_WINDOW) {
+    return;
+  }
+  int fd = fileno(stream->input_file);
+  if (stream->direct_fd < 0) {
+    posix_fadvise(fd, offset, STREAM_READAHEAD, POSIX_FADV_WILLNEED);
+  }
+  posix_fadvise(fd, cursor->dropped, offset - cursor->dropped,
+                POSIX_FADV_DONTNEED);
+  cursor->dropped = offset;
+#endif
+}
+
+// Starts writeback of everything written up to offset, then waits for the
+// previous window and drops it. finish writes back and drops all of it.
+void drop_output_pages(FILE *file, PageCursor *cursor, uint64_t offset,
+                       int finish) {
+#ifdef __linux__
+  if (!finish && offset - cursor->flushed < STREAM_WINDOW) {
+    return;
+  }
+  if (fflush(file) != 0) {
+    return;
+  }
+  int fd = fileno(file);
+  if (finish) {
+    sync_file_range(fd, cursor->dropped, 0,
+                    SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                        SYNC_FILE_RANGE_WAIT_AFTER);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    cursor->dropped = cursor->flushed = offset;
+    return;
+  }
+
+  sync_file_range(fd, cursor->flushed, offset - cursor->flushed,
+                  SYNC_FILE_RANGE_WRITE);
+  if (cursor->flushed > cursor->dropped) {
+    sync_file_range(fd, cursor->dropped, cursor->flushed - cursor->dropped,
+                    SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                        SYNC_FILE_RANGE_WAIT_AFTER);
+    posix_fadvise(fd, cursor->dropped, cursor->flushed - cursor->dropped,
+                  POSIX_FADV_DONTNEED);
+    cursor->dropped = cursor->flushed;
+  }
+  cursor->flushed = offset;
+#endif
+}
+
+int seek_file(FILE *file, uint64_t offset) {
+#ifdef _WIN32
+  return _fseeki64(file, (__int64)offset, SEEK_SET);
+#else
+  return fseeko(file, (off_t)offset, SEEK_SET);
+#endif
+}
+
+// Glitch ops move audio in time, so unlike the op chains they read the data
+// chunk out of order. They work on whole frames (ADPCM blocks for IMA
+// ADPCM) grouped into segments:
+//   reverse   plays every segment backwards, the whole chunk without a size
+//   stutter   repeats the first segment of every group of repeats segments
+//   shuffle   reorders segments with a seeded permutation
+// The input is mapped and, before each block is assembled, the input ranges
+// of the next block are sorted and prefetched, so a reversed or shuffled
+// pass reads in large ascending runs instead of seeking per frame.
+int parse_glitch(const char *spec, Glitch *glitch) {
+  char name[16];
+  double segment_ms = 0;
+  unsigned long long extra = 0;
+  int fields = sscanf(spec, "%15[a-z]:%lf:%llu", name, &segment_ms, &extra);
+  if (fields < 1) {
+    return 0;
+  }
+
+  glitch->segment_ms = segment_ms;
+  glitch->repeats = 0;
+  glitch->seed = 0;
+  if (strcmp(name, "reverse") == 0 && fields <= 2) {
+    glitch->type = GLITCH_REVERSE;
+    return segment_ms >= 0;
+  }
+  if (strcmp(name, "stutter") == 0 && fields == 3) {
+    glitch->type = GLITCH_STUTTER;
+    glitch->repeats = extra;
+    return segment_ms > 0 && extra >= 2;
+  }
+  if (strcmp(name, "shuffle") == 0 && fields >= 2) {
+    glitch->type = GLITCH_SHUFFLE;
+    glitch->seed = extra;
+    return segment_ms > 0;
+  }
+  return 0;
+}
+
+typedef struct {
+  FILE *input_file;
+  uint64_t data_offset;
+  const uint8_t *map;
+  size_t map_size;
+  GlitchType type;
+  size_t unit;
+  uint64_t unit_count;
+  uint64_t segment;
+  uint64_t repeats;
+  uint64_t seed;
+  uint64_t prefetched;
+} GlitchSource;
+
+void open_glitch_source(GlitchSource *source, FILE *input_file,
+                        long data_offset, uint32_t data_size,
+                        const WavFmtData *fmtData, const Glitch *glitch) {
+  memset(source, 0, sizeof(GlitchSource));
+  source->input_file = input_file;
+  source->data_offset = data_offset;
+  source->type = glitch->type;
+  source->unit = fmtData->blockAlign;
+  source->unit_count = data_size / fmtData->blockAlign;
+  source->repeats = glitch->repeats;
+  source->seed = glitch->seed;
+
+  double frames = glitch->segment_ms * fmtData->sampleRate / 1000.0;
+  source->segment = (uint64_t)(frames / frames_per_block(fmtData) + 0.5);
+  if (source->segment == 0) {
+    source->segment = glitch->type == GLITCH_REVERSE && glitch->segment_ms == 0
+                          ? source->unit_count
+                          : 1;
+  }
+
+#ifdef __linux__
+  // A truncated file would fault inside the map, so it is read instead.
+  struct stat info;
+  size_t map_size = (size_t)data_offset + data_size;
+  void *map = MAP_FAILED;
+  if (fstat(fileno(input_file), &info) == 0 &&
+      (uint64_t)info.st_size >= (uint64_t)data_offset + data_size) {
+    map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fileno(input_file), 0);
+  }
+  if (map != MAP_FAILED) {
+    madvise(map, map_size, MADV_RANDOM);
+    source->map = (const uint8_t *)map;
+    source->map_size = map_size;
+  }
+#endif
+}
+
+void close_glitch_source(GlitchSource *source) {
+#ifdef __linux__
+  if (source->map) {
+    munmap((void *)source->map, source->map_size);
+  }
+#endif
+}
+
+uint64_t mix_bits(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xBF58476D1CE4E5B9ull;
+  x ^= x >> 27;
+  x *= 0x94D049BB133111EBull;
+  return x ^ (x >> 31);
+}
+
+// Seeded bijection on [0, count): a Feistel network over the next even power
+// of two, walked until it lands inside the range. Needs no table, however
+// many segments there are.
+uint64_t permute_index(uint64_t index, uint64_t count, uint64_t seed) {
+  int bits = 2;
+  while (bits < 64 && (1ull << bits) < count) {
+    bits += 2;
+  }
+  int half = bits / 2;
+  uint64_t mask = (1ull << half) - 1;
+
+  do {
+    uint64_t left = index >> half;
+    uint64_t right = index & mask;
+    for (uint64_t round = 0; round < 4; round++) {
+      uint64_t next = left ^ (mix_bits(right ^ seed ^ (round << 56)) & mask);
+      left = right;
+      right = next;
+    }
+    index = (left << half) | right;
+  } while (index >= count);
+  return index;
+}
+
+// Finds where output unit u comes from: source unit *from, valid for *run
+// units, which go backwards through the input when *reversed is set.
+void glitch_source_of(const GlitchSource *source, uint64_t u, uint64_t *from,
+                      uint64_t *run, int *reversed) {
+  uint64_t segment = source->segment;
+  *reversed = 0;
+
+  if (source->type == GLITCH_REVERSE) {
+    uint64_t start = u - u % segment;
+    uint64_t end = start + segment;
+    if (end > source->unit_count) {
+      end = source->unit_count;
+    }
+    *from = start + end - 1 - u;
+    *run = end - u;
+    *reversed = 1;
+  } else if (source->type == GLITCH_STUTTER) {
+    uint64_t period = segment * source->repeats;
+    uint64_t offset = u % period % segment;
+    *from = u - u % period + offset;
+    *run = segment - offset;
+  } else {
+    uint64_t segment_count = source->unit_count / segment;
+    uint64_t index = u / segment;
+    uint64_t offset = u % segment;
+    if (index >= segment_count) {
+      *from = u;
+      *run = source->unit_count - u;
+    } else {
+      *from = permute_index(index, segment_count, source->seed) * segment +
+              offset;
+      *run = segment - offset;
+    }
+  }
+}
+
+#ifdef __linux__
+#define MAX_PREFETCH_EXTENTS 64
+
+typedef struct {
+  uint64_t start;
+  uint64_t end;
+} Extent;
+
+int compare_extents(const void *a, const void *b) {
+  const Extent *x = (const Extent *)a;
+  const Extent *y = (const Extent *)b;
+  return (x->start > y->start) - (x->start < y->start);
+}
+
+// Asks for the input behind output bytes [position, end) in ascending order.
+void prefetch_glitch(GlitchSource *source, uint64_t position, uint64_t end) {
+  Extent extents[MAX_PREFETCH_EXTENTS];
+  size_t count = 0;
+  uint64_t unit = source->unit;
+  uint64_t u = position / unit;
+  uint64_t end_unit = (end + unit - 1) / unit;
+  if (end_unit > source->unit_count) {
+    end_unit = source->unit_count;
+  }
+
+  while (u < end_unit && count < MAX_PREFETCH_EXTENTS) {
+    uint64_t from;
+    uint64_t run;
+    int reversed;
+    glitch_source_of(source, u, &from, &run, &reversed);
+    if (run > end_unit - u) {
+      run = end_unit - u;
+    }
+    uint64_t low = reversed ? from + 1 - run : from;
+    Extent extent = {low * unit, (low + run) * unit};
+    if (count > 0 && extent.start <= extents[count - 1].end &&
+        extent.end >= extents[count - 1].start) {
+      Extent *last = &extents[count - 1];
+      last->start = extent.start < last->start ? extent.start : last->start;
+      last->end = extent.end > last->end ? extent.end : last->end;
+    } else {
+      extents[count++] = extent;
+    }
+    u += run;
+  }
+
+  qsort(extents, count, sizeof(Extent), compare_extents);
+  uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+  for (size_t i = 0; i < count; i++) {
+    uint64_t start = source->data_offset + extents[i].start;
+    uint64_t aligned = start - start % page;
+    madvise((void *)(source->map + aligned),
+            source->data_offset + extents[i].end - aligned, MADV_WILLNEED);
+  }
+}
+#endif
+
+int read_glitch_bytes(GlitchSource *source, uint64_t offset, uint8_t *data,
+                      size_t size) {
+  if (source->map) {
+    memcpy(data, source->map + source->data_offset + offset, size);
+    return 1;
+  }
+  return seek_file(source->input_file, source->data_offset + offset) == 0 &&
+         fread(data, 1, size, source->input_file) == size;
+}
+
+void reverse_units(uint8_t *data, const uint8_t *last, uint64_t count,
+                   size_t unit) {
+  if (unit == 2) {
+    for (uint64_t i = 0; i < count; i++) {
+      memcpy(data + 2 * i, last - 2 * i, 2);
+    }
+  } else if (unit == 4) {
+    for (uint64_t i = 0; i < count; i++) {
+      memcpy(data + 4 * i, last - 4 * i, 4);
+    }
+  } else {
+    for (uint64_t i = 0; i < count; i++) {
+      memcpy(data + unit * i, last - unit * i, unit);
+    }
+  }
+}
+
+// Fills data with output bytes [position, position + size) of the glitched
+// data chunk. Bytes after the last whole unit pass through unchanged.
+int read_glitched(GlitchSource *source, uint64_t position, uint8_t *data,
+                  size_t size) {
+#ifdef __linux__
+  if (source->map) {
+    if (source->prefetched <= position) {
+      prefetch_glitch(source, position, position + size);
+    }
+    prefetch_glitch(source, position + size, position + 2 * size);
+    source->prefetched = position + 2 * size;
+  }
+#endif
+
+  uint64_t unit = source->unit;
+  while (size > 0) {
+    uint64_t u = position / unit;
+    size_t skip = position % unit;
+    if (u >= source->unit_count) {
+      return read_glitch_bytes(source, position, data, size);
+    }
+
+    uint64_t from;
+    uint64_t run;
+    int reversed;
+    glitch_source_of(source, u, &from, &run, &reversed);
+    if (!reversed) {
+      size_t n = run * unit - skip;
+      if (n > size) {
+        n = size;
+      }
+      if (!read_glitch_bytes(source, from * unit + skip, data, n)) {
+        return 0;
+      }
+      data += n;
+      size -= n;
+      position += n;
+      continue;
+    }
+
+    if (skip > 0 || size < unit || !source->map) {
+      size_t n = unit - skip;
+      if (n > size) {
+        n = size;
+      }
+      if (!read_glitch_bytes(source, from * unit + skip, data, n)) {
+        return 0;
+      }
+      data += n;
+      size -= n;
+      position += n;
+      continue;
+    }
+
+    uint64_t count = size / unit;
+    if (count > run) {
+      count = run;
+    }
+    reverse_units(data, source->map + source->data_offset + from * unit,
+                  count, unit);
+    data += count * unit;
+    size -= count * unit;
+    position += count * unit;
+  }
+  return 1;
+}
+
+// Combine mode streams the --with inputs in lockstep with the main one and
+// folds them into each block as it is read, so the op chain sees the
+// combined signal. An input that ends early is padded with the combine's
+// identity and stops contributing: zero for xor and or, all ones for and,
+// silence for mix. The length rule sets the output length: the main input's,
+// the shortest input's or the longest input's.
+int parse_combine(const char *name, CombineType *type) {
+  if (strcmp(name, "xor") == 0) {
+    *type = COMBINE_XOR;
+  } else if (strcmp(name, "and") == 0) {
+    *type = COMBINE_AND;
+  } else if (strcmp(name, "or") == 0) {
+    *type = COMBINE_OR;
+  } else if (strcmp(name, "mix") == 0) {
+    *type = COMBINE_MIX;
+  } else {
+    return 0;
+  }
+  return 1;
+}
+
+int parse_length_rule(const char *name, LengthRule *rule) {
+  if (strcmp(name, "first") == 0) {
+    *rule = LENGTH_FIRST;
+  } else if (strcmp(name, "shortest") == 0) {
+    *rule = LENGTH_SHORTEST;
+  } else if (strcmp(name, "longest") == 0) {
+    *rule = LENGTH_LONGEST;
+  } else {
+    return 0;
+  }
+  return 1;
+}
+
+typedef struct {
+  const Combine *combine;
+  FILE *files[MAX_COMBINE_INPUTS];
+  long data_offsets[MAX_COMBINE_INPUTS];
+  uint64_t data_sizes[MAX_COMBINE_INPUTS];
+  uint64_t positions[MAX_COMBINE_INPUTS];
+  uint64_t main_size;
+  int bits;
+  uint8_t *scratch;
+} CombineSource;
+
+int formats_match(const WavFmtData *a, const WavFmtData *b) {
+  return a->audioFormat == b->audioFormat &&
+         a->numChannels == b->numChannels &&
+         a->sampleRate == b->sampleRate &&
+         a->bitsPerSample == b->bitsPerSample &&
+         a->blockAlign == b->blockAlign;
+}
+
+void close_combine_source(CombineSource *source) {
+  for (size_t i = 0; i < source->combine->count; i++) {
+    if (source->files[i]) {
+      fclose(source->files[i]);
+    }
+  }
+  pool_release(source->scratch);
+}
+
+// Opens the other inputs, checks that they match the main input's format and
+// works out the output data size.
+int open_combine_source(CombineSource *source, const Combine *combine,
+                        const WavFmtData *fmtData, uint32_t data_size,
+                        uint32_t *output_size) {
+  memset(source, 0, sizeof(CombineSource));
+  source->combine = combine;
+  source->main_size = data_size;
+  source->bits = fmtData->bitsPerSample;
+
+  if (fmtData->audioFormat != WAVE_FORMAT_PCM) {
+    printf("Error: --combine only supports PCM inputs\n");
+    return 0;
+  }
+
+  uint64_t size = data_size;
+  for (size_t i = 0; i < combine->count; i++) {
+    const char *filename = combine->filenames[i];
+    source->files[i] = fopen(filename, "rb");
+    if (!source->files[i]) {
+      printf("Error: cannot open input file %s\n", filename);
+      close_combine_source(source);
+      return 0;
+    }
+
+    WavFmtData other;
+    uint32_t other_size;
+    if (!parse_wav_file(source->files[i], &other, &other_size,
+                        &source->data_offsets[i])) {
+      printf("Error: invalid WAV file format in %s\n", filename);
+      close_combine_source(source);
+      return 0;
+    }
+    if (!formats_match(fmtData, &other)) {
+      printf("Error: %s has a different format (%d ch, %d Hz, %d bits)\n",
+             filename, other.numChannels, other.sampleRate,
+             other.bitsPerSample);
+      close_combine_source(source);
+      return 0;
+    }
+
+    source->data_sizes[i] = other_size - other_size % other.blockAlign;
+    source->positions[i] = UINT64_MAX;
+    if (combine->length == LENGTH_SHORTEST && source->data_sizes[i] < size) {
+      size = source->data_sizes[i];
+    } else if (combine->length == LENGTH_LONGEST &&
+               source->data_sizes[i] > size) {
+      size = source->data_sizes[i];
+    }
+  }
+
+  source->scratch = (uint8_t *)pool_acquire(io_tuning.block_size);
+  if (!source->scratch) {
+    printf("Error: cannot allocate combine buffer\n");
+    close_combine_source(source);
+    return 0;
+  }
+
+  *output_size = (uint32_t)size;
+  return 1;
+}
+
+void combine_xor(uint8_t *data, const uint8_t *other, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    data[i] ^= other[i];
+  }
+}
+
+void combine_and(uint8_t *data, const uint8_t *other, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    data[i] &= other[i];
+  }
+}
+
+void combine_or(uint8_t *data, const uint8_t *other, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    data[i] |= other[i];
+  }
+}
+
+// Saturating sum of the two signals.
+void combine_mix(uint8_t *data, const uint8_t *other, size_t size, int bits) {
+  if (bits == 16) {
+    int16_t *samples = (int16_t *)data;
+    const int16_t *others = (const int16_t *)other;
+    for (size_t i = 0; i < size / 2; i++) {
+      int sum = samples[i] + others[i];
+      samples[i] = (int16_t)(sum > 32767 ? 32767 : sum < -32768 ? -32768 : sum);
+    }
+    return;
+  }
+  for (size_t i = 0; i < size; i++) {
+    int sum = data[i] + other[i] - 128;
+    data[i] = (uint8_t)(sum > 255 ? 255 : sum < 0 ? 0 : sum);
+  }
+}
+
+// Byte value that leaves the other inputs unchanged when combined with them.
+int combine_identity(CombineType type, int bits) {
+  if (type == COMBINE_AND) {
+    return 0xFF;
+  }
+  if (type == COMBINE_MIX && bits == 8) {
+    return 0x80;
+  }
+  return 0;
+}
+
+void fold_combined(CombineType type, uint8_t *data, const uint8_t *other,
+                   size_t size, int bits) {
+  switch (type) {
+  case COMBINE_XOR:
+    combine_xor(data, other, size);
+    break;
+  case COMBINE_AND:
+    combine_and(data, other, size);
+    break;
+  case COMBINE_OR:
+    combine_or(data, other, size);
+    break;
+  default:
+    combine_mix(data, other, size, bits);
+    break;
+  }
+}
+
+// Fills the part of a block past the end of the main input.
+void pad_combined(const CombineSource *source, uint8_t *data, size_t size) {
+  memset(data, combine_identity(source->combine->type, source->bits), size);
+}
+
+// Folds the other inputs into a block of the main input read at position.
+int combine_block(CombineSource *source, uint64_t position, uint8_t *data,
+                  size_t size) {
+  for (size_t i = 0; i < source->combine->count; i++) {
+    if (position >= source->data_sizes[i]) {
+      continue;
+    }
+    size_t available = size;
+    if (available > source->data_sizes[i] - position) {
+      available = (size_t)(source->data_sizes[i] - position);
+    }
+
+    if (source->positions[i] != position &&
+        seek_file(source->files[i], source->data_offsets[i] + position) != 0) {
+      return 0;
+    }
+    if (fread(source->scratch, 1, available, source->files[i]) != available) {
+      return 0;
+    }
+    source->positions[i] = position + available;
+    fold_combined(source->combine->type, data, source->scratch, available,
+                  source->bits);
+  }
+  return 1;
+}
+
+// Rewrites the RIFF and data chunk sizes of a header read by read_wav_header
+// for an output whose data chunk holds data_size bytes.
+void set_wav_sizes(uint8_t *header, long data_offset, uint32_t data_size) {
+  uint32_t riff_size = (uint32_t)(data_offset - 8) + data_size;
+  memcpy(header + 4, &riff_size, sizeof(riff_size));
+  memcpy(header + data_offset - 4, &data_size, sizeof(data_size));
+}
+
+// Output conversion turns each processed block into the --out-format sample
+// width and signedness, averaging the channels for --mono, before it is
+// written. Blocks are widened to 16-bit samples, downmixed and packed; the
+// loops are simple enough for the compiler to vectorize and run on the
+// block while it is still in cache. Narrowing truncates without dither.
+int parse_out_format(const char *name, OutputFormat *format) {
+  if (strcmp(name, "u8") == 0) {
+    format->bits = 8;
+    format->is_signed = 0;
+  } else if (strcmp(name, "s8") == 0) {
+    format->bits = 8;
+    format->is_signed = 1;
+  } else if (strcmp(name, "u16") == 0) {
+    format->bits = 16;
+    format->is_signed = 0;
+  } else if (strcmp(name, "s16") == 0) {
+    format->bits = 16;
+    format->is_signed = 1;
+  } else {
+    return 0;
+  }
+  return 1;
+}
+
+WavFmtData output_format(const WavFmtData *fmtData,
+                         const OutputFormat *format) {
+  WavFmtData out = *fmtData;
+  if (format->bits) {
+    out.bitsPerSample = (uint16_t)format->bits;
+  }
+  if (format->mono) {
+    out.numChannels = 1;
+  }
+  out.blockAlign = (uint16_t)(out.numChannels * out.bitsPerSample / 8);
+  out.byteRate = out.blockAlign * out.sampleRate;
+  return out;
+}
+
+// Copy of a header read by read_wav_header with the fmt chunk rewritten to
+// out_fmt and the sizes to data_size, or NULL.
+uint8_t *convert_header(const uint8_t *header, long data_offset,
+                        const WavFmtData *out_fmt, uint32_t data_size) {
+  uint8_t *converted = (uint8_t *)pool_acquire(data_offset);
+  if (!converted) {
+    printf("Error: cannot allocate memory for header\n");
+    return NULL;
+  }
+  memcpy(converted, header, data_offset);
+
+  long offset = sizeof(WavRiffHeader);
+  while (offset + (long)sizeof(WavChunkHeader) <= data_offset) {
+    WavChunkHeader chunk;
+    memcpy(&chunk, converted + offset, sizeof(chunk));
+    offset += sizeof(chunk);
+    if (strncmp(chunk.subchunkID, "fmt ", 4) == 0 &&
+        offset + (long)sizeof(WavFmtData) <= data_offset) {
+      memcpy(converted + offset, out_fmt, sizeof(WavFmtData));
+      set_wav_sizes(converted, data_offset, data_size);
+      return converted;
+    }
+    offset += chunk.subchunkSize;
+  }
+
+  printf("Error: cannot find the fmt chunk to rewrite\n");
+  pool_release(converted);
+  return NULL;
+}
+
+// Widens a block to signed 16-bit samples, averaging each frame's channels
+// when mono is set. Returns the number of samples in pcm.
+size_t widen_samples(const uint8_t *data, size_t size,
+                     const WavFmtData *fmtData, int mono, int16_t *pcm) {
+  size_t count = size;
+  if (fmtData->bitsPerSample == 8) {
+    for (size_t i = 0; i < count; i++) {
+      pcm[i] = (int16_t)((data[i] - 128) * 256);
+    }
+  } else {
+    count = size / 2;
+    memcpy(pcm, data, size);
+  }
+
+  int channels = fmtData->numChannels;
+  if (!mono || channels == 1) {
+    return count;
+  }
+  size_t frames = count / channels;
+  if (channels == 2) {
+    for (size_t f = 0; f < frames; f++) {
+      pcm[f] = (int16_t)((pcm[2 * f] + pcm[2 * f + 1]) / 2);
+    }
+    return frames;
+  }
+  for (size_t f = 0; f < frames; f++) {
+    int sum = 0;
+    for (int c = 0; c < channels; c++) {
+      sum += pcm[f * channels + c];
+    }
+    pcm[f] = (int16_t)(sum / channels);
+  }
+  return frames;
+}
+
+// Packs 16-bit samples into the output width and signedness. Returns the
+// packed size in bytes.
+size_t pack_samples(const int16_t *pcm, size_t count,
+                    const WavFmtData *out_fmt, int is_signed,
+                    uint8_t *out) {
+  if (out_fmt->bitsPerSample == 8) {
+    uint8_t offset = is_signed ? 0 : 0x80;
+    for (size_t i = 0; i < count; i++) {
+      out[i] = (uint8_t)((pcm[i] >> 8) ^ offset);
+    }
+    return count;
+  }
+
+  uint16_t offset = is_signed ? 0 : 0x8000;
+  uint16_t *samples = (uint16_t *)out;
+  for (size_t i = 0; i < count; i++) {
+    samples[i] = (uint16_t)pcm[i] ^ offset;
+  }
+  return count * 2;
+}
+
+// Fan-out renders several outputs from one read of the input. A reader fills
+// a ring of blocks that every output job copies from at its own pace, and a
+// slot is only refilled once all jobs are past it.
+// Block size and ring depth come from io_tuning.
+typedef struct {
+  FILE *input_file;
+  InputStream *stream;
+  uint64_t data_size;
+  size_t block_size;
+  size_t slot_count;
+  GlitchSource *glitch;
+  uint8_t *slots[MAX_FAN_OUT_SLOTS];
+  uint64_t loaded;
+  uint64_t *consumed;
+  size_t consumer_count;
+  int error;
+  int quiet;
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+} FanOutSource;
+
+typedef struct {
+  FILE *input_file;
+  FILE *output_file;
+  const WavFmtData *fmtData;
+  WavFmtData pcm_fmt;
+  const ProcessOptions *options;
+  uint8_t *buffer;
+  size_t buffer_size;
+  uint64_t position;
+  size_t total_processed;
+  uint32_t data_size;
+  Xxh64State *output_hash;
+  Xxh64State *input_hash;
+  Analysis *analysis;
+  Journal *journal;
+  FanOutSource *source;
+  size_t consumer;
+  InputStream *stream;
+  PageCursor output_pages;
+  GlitchSource *glitch;
+  CombineSource *combine;
+  WavFmtData out_fmt;
+  int converting;
+  int out_signed;
+  int16_t *out_pcm;
+  uint8_t *out_buffer;
+  const uint16_t *gain_table;
+} RenderContext;
+
+void print_progress(size_t total_processed, uint32_t data_size) {
+  if (data_size > 0) {
+    int progress = (int)((total_processed * 100) / data_size);
+    printf("\rProgress: %d%% (%zu/%u bytes)", progress, total_processed,
+           data_size);
+    fflush(stdout);
+  }
+}
+
+uint64_t fan_out_slowest(const FanOutSource *source) {
+  uint64_t slowest = UINT64_MAX;
+  for (size_t c = 0; c < source->consumer_count; c++) {
+    if (source->consumed[c] < slowest) {
+      slowest = source->consumed[c];
+    }
+  }
+  return slowest;
+}
+
+// Copies size bytes starting at data offset position into data.
+int fan_out_read(FanOutSource *source, size_t consumer, uint64_t position,
+                 uint8_t *data, size_t size) {
+  while (size > 0) {
+    uint64_t block = position / source->block_size;
+    size_t offset = position % source->block_size;
+    size_t n = source->block_size - offset;
+    if (n > size) {
+      n = size;
+    }
+
+    pthread_mutex_lock(&source->lock);
+    while (source->loaded <= block && !source->error) {
+      pthread_cond_wait(&source->changed, &source->lock);
+    }
+    int error = source->error;
+    pthread_mutex_unlock(&source->lock);
+    if (error) {
+      return 0;
+    }
+
+    memcpy(data, source->slots[block % source->slot_count] + offset, n);
+    data += n;
+    size -= n;
+    position += n;
+
+    if (offset + n == source->block_size) {
+      pthread_mutex_lock(&source->lock);
+      source->consumed[consumer] = block + 1;
+      pthread_cond_broadcast(&source->changed);
+      pthread_mutex_unlock(&source->lock);
+    }
+  }
+  return 1;
+}
+
+// Called when a job stops reading, finished or not, so it never holds up the
+// reader.
+void fan_out_detach(FanOutSource *source, size_t consumer) {
+  pthread_mutex_lock(&source->lock);
+  source->consumed[consumer] = UINT64_MAX;
+  pthread_cond_broadcast(&source->changed);
+  pthread_mutex_unlock(&source->lock);
+}
+
+int fan_out_fill(FanOutSource *source) {
+  size_t block_size = source->block_size;
+  uint64_t block_count = (source->data_size + block_size - 1) / block_size;
+
+  for (uint64_t block = 0; block < block_count; block++) {
+    pthread_mutex_lock(&source->lock);
+    uint64_t slowest = fan_out_slowest(source);
+    while (slowest != UINT64_MAX && slowest + source->slot_count <= block) {
+      pthread_cond_wait(&source->changed, &source->lock);
+      slowest = fan_out_slowest(source);
+    }
+    pthread_mutex_unlock(&source->lock);
+    if (slowest == UINT64_MAX) {
+      break;
+    }
+
+    uint64_t offset = block * block_size;
+    uint64_t remaining = source->data_size - offset;
+    size_t size = (remaining < block_size) ? remaining : block_size;
+    uint8_t *slot = source->slots[block % source->slot_count];
+    int ok;
+    if (source->glitch) {
+      ok = read_glitched(source->glitch, offset, slot, size);
+    } else if (source->stream && source->stream->direct_fd >= 0) {
+      ok = direct_read(source->stream, source->stream->data_offset + offset,
+                       slot, size);
+    } else {
+      ok = fread(slot, 1, size, source->input_file) == size;
+    }
+    if (ok && source->stream) {
+      drop_input_pages(source->stream,
+                       source->stream->data_offset + offset + size);
+    }
+
+    pthread_mutex_lock(&source->lock);
+    if (ok) {
+      source->loaded = block + 1;
+    } else {
+      source->error = 1;
+    }
+    pthread_cond_broadcast(&source->changed);
+    pthread_mutex_unlock(&source->lock);
+
+    if (!ok) {
+      printf("Error: read incomplete chunk\n");
+      return 0;
+    }
+    if (!source->quiet) {
+      print_progress(offset + size, (uint32_t)source->data_size);
+    }
+  }
+  return 1;
+}
+
+// Reads the next size bytes of the data chunk into the work buffer.
+int read_main_input(RenderContext *ctx, size_t size) {
+  if (ctx->source) {
+    return fan_out_read(ctx->source, ctx->consumer, ctx->position, ctx->buffer,
+                        size);
+  }
+  if (ctx->glitch) {
+    return read_glitched(ctx->glitch, ctx->position, ctx->buffer, size);
+  }
+  if (ctx->stream && ctx->stream->direct_fd >= 0) {
+    return direct_read(ctx->stream, ctx->stream->data_offset + ctx->position,
+                       ctx->buffer, size);
+  }
+  return fread(ctx->buffer, 1, size, ctx->input_file) == size;
+}
+
+int read_input(RenderContext *ctx, size_t size) {
+  CombineSource *combine = ctx->combine;
+  if (!combine) {
+    return read_main_input(ctx, size);
+  }
+
+  size_t available = 0;
+  if (ctx->position < combine->main_size) {
+    available = size;
+    if (available > combine->main_size - ctx->position) {
+      available = (size_t)(combine->main_size - ctx->position);
+    }
+  }
+  if (available > 0 && !read_main_input(ctx, available)) {
+    return 0;
+  }
+  pad_combined(combine, ctx->buffer + available, size - available);
+  return combine_block(combine, ctx->position, ctx->buffer, size);
+}
+
+// Bytes of output written for size bytes of input data.
+uint64_t output_bytes(const RenderContext *ctx, uint64_t size) {
+  if (!ctx->converting) {
+    return size;
+  }
+  return size / ctx->fmtData->blockAlign * ctx->out_fmt.blockAlign;
+}
+
+// Writes a processed block, converting it to the output format first.
+int write_output(RenderContext *ctx, const uint8_t *data, size_t size) {
+  if (ctx->converting) {
+    const int16_t *pcm = (const int16_t *)data;
+    size_t count = size / 2;
+    if (ctx->fmtData->bitsPerSample == 8 ||
+        ctx->out_fmt.numChannels != ctx->fmtData->numChannels) {
+      count = widen_samples(data, size, ctx->fmtData,
+                            ctx->options->output.mono, ctx->out_pcm);
+      pcm = ctx->out_pcm;
+    }
+    size = pack_samples(pcm, count, &ctx->out_fmt, ctx->out_signed,
+                        ctx->out_buffer);
+    data = ctx->out_buffer;
+  }
+
+  if (ctx->output_hash) {
+    xxh64_update(ctx->output_hash, data, size);
+  }
+  return fwrite(data, 1, size, ctx->output_file) == size;
+}
+
+// In streaming mode, lets go of the pages the job has moved past. Fan-out
+// jobs share the input, so there the reader drops its pages.
+void stream_pages(RenderContext *ctx) {
+  if (!ctx->stream) {
+    return;
+  }
+  uint64_t offset = ctx->stream->data_offset + ctx->position;
+  if (!ctx->source) {
+    drop_input_pages(ctx->stream, offset);
+  }
+  if (ctx->output_file && !ctx->analysis) {
+    drop_output_pages(ctx->output_file, &ctx->output_pages,
+                      ctx->stream->data_offset +
+                          output_bytes(ctx, ctx->position),
+                      0);
+  }
+}
+
+// Fan-out jobs run concurrently, so only the reader reports progress.
+void report_progress(const RenderContext *ctx) {
+  if (!ctx->source) {
+    print_progress(ctx->total_processed, ctx->data_size);
+  }
+}
+
+int checkpoint_job(RenderContext *ctx) {
+  Journal *journal = ctx->journal;
+  if (!journal || ctx->position - journal->committed < JOURNAL_INTERVAL) {
+    return 1;
+  }
+  if (!sync_file(ctx->output_file)) {
+    printf("Error: cannot sync output file\n");
+    return 0;
+  }
+  return write_journal(journal, ctx->position);
+}
+
+// Feeds length bytes from offset of file to a checksum.
+int hash_file_range(RenderContext *ctx, FILE *file, uint64_t offset,
+                    uint64_t length, Xxh64State *state) {
+  if (seek_file(file, offset) != 0) {
+    return 0;
+  }
+  while (length > 0) {
+    size_t chunk_size =
+        (length < ctx->buffer_size) ? length : ctx->buffer_size;
+    if (fread(ctx->buffer, 1, chunk_size, file) != chunk_size) {
+      return 0;
+    }
+    xxh64_update(state, ctx->buffer, chunk_size);
+    length -= chunk_size;
+  }
+  return 1;
+}
+
+// Positions both files at the resume offset. Checksums cover the whole file,
+// so the part written by the earlier run is hashed back from disk first.
+int prepare_resume(RenderContext *ctx, long data_offset) {
+  if (ctx->output_hash &&
+      !hash_file_range(ctx, ctx->output_file, 0, data_offset + ctx->position,
+                       ctx->output_hash)) {
+    return 0;
+  }
+  if (ctx->input_hash &&
+      !hash_file_range(ctx, ctx->input_file, data_offset, ctx->position,
+                       ctx->input_hash)) {
+    return 0;
+  }
+  return seek_file(ctx->input_file, data_offset + ctx->position) == 0 &&
+         seek_file(ctx->output_file, data_offset + ctx->position) == 0;
+}
+
+// In analysis mode untouched audio goes to both histograms unchanged.
+void analyze_untouched(RenderContext *ctx, size_t size) {
+  Analysis *analysis = ctx->analysis;
+  if (ctx->fmtData->audioFormat == WAVE_FORMAT_PCM) {
+    histogram_samples(ctx->buffer, size, &ctx->pcm_fmt, analysis->range_hist);
+    fold_range_histogram(analysis, NULL);
+    return;
+  }
+  histogram_file_samples(analysis, ctx->buffer, size, ctx->fmtData,
+                         &ctx->pcm_fmt, analysis->input_hist);
+  histogram_file_samples(analysis, ctx->buffer, size, ctx->fmtData,
+                         &ctx->pcm_fmt, analysis->output_hist);
+  count_changed_bytes(analysis, ctx->buffer, ctx->buffer, size, ctx->position,
+                      ctx->fmtData);
+}
+
+// Copies untouched audio from the current input position to the current
+// output position. On Linux the copy stays inside the kernel (and may become
+// a reflink), otherwise it goes through the work buffer.
+int copy_data_range(RenderContext *ctx, uint64_t length) {
+#ifdef __linux__
+  int direct = ctx->stream && ctx->stream->direct_fd >= 0;
+  if (!ctx->output_hash && !ctx->input_hash && !ctx->analysis &&
+      !ctx->source && !ctx->glitch && !ctx->combine && !ctx->converting &&
+      !direct &&
+      fflush(ctx->output_file) == 0) {
+    off_t in_offset = ftello(ctx->input_file);
+    off_t out_offset = ftello(ctx->output_file);
+
+    while (length > 0) {
+      ssize_t copied =
+          copy_file_range(fileno(ctx->input_file), &in_offset,
+                          fileno(ctx->output_file), &out_offset, length, 0);
+      if (copied <= 0) {
+        break;
+      }
+      length -= copied;
+      ctx->position += copied;
+      ctx->total_processed += copied;
+      report_progress(ctx);
+      stream_pages(ctx);
+      if (!checkpoint_job(ctx)) {
+        return 1;
+      }
+    }
+
+    fseeko(ctx->input_file, in_offset, SEEK_SET);
+    fseeko(ctx->output_file, out_offset, SEEK_SET);
+  }
+#endif
+
+  while (length > 0) {
+    size_t chunk_size =
+        (length < ctx->buffer_size) ? length : ctx->buffer_size;
+
+    if (!read_input(ctx, chunk_size)) {
+      printf("Error: read incomplete chunk\n");
+      return 1;
+    }
+    if (ctx->input_hash) {
+      xxh64_update(ctx->input_hash, ctx->buffer, chunk_size);
+    }
+    if (ctx->analysis) {
+      analyze_untouched(ctx, chunk_size);
+    } else if (!write_output(ctx, ctx->buffer, chunk_size)) {
+      printf("Error: write incomplete chunk\n");
+      return 1;
+    }
+
+    length -= chunk_size;
+    ctx->position += chunk_size;
+    ctx->total_processed += chunk_size;
+    report_progress(ctx);
+    stream_pages(ctx);
+    if (!checkpoint_job(ctx)) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+int render_plan_is_static(const RenderPlan *plan) {
+  for (size_t i = 0; i < plan->stage_count; i++) {
+    if (plan->stages[i].info && !plan->stages[i].info->position_independent) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Runs 256 frames holding every decoded A-law or mu-law code through the
+// plan, giving one code to code table per channel.
+int build_law_tables(const RenderPlan *plan, const WavFmtData *fmtData,
+                     const WavFmtData *pcm_fmt, uint8_t (*tables)[256]) {
+  int channels = fmtData->numChannels;
+  int16_t *frames = (int16_t *)pool_acquire(256 * pcm_fmt->blockAlign);
+  if (!frames) {
+    return 0;
+  }
+
+  const int16_t *decode = (fmtData->audioFormat == WAVE_FORMAT_MULAW)
+                              ? mulaw_decode_table
+                              : alaw_decode_table;
+  for (int code = 0; code < 256; code++) {
+    for (int c = 0; c < channels; c++) {
+      frames[code * channels + c] = decode[code];
+    }
+  }
+
+  apply_render_plan((uint8_t *)frames, 256 * pcm_fmt->blockAlign, 0, pcm_fmt,
+                    plan);
+
+  for (int code = 0; code < 256; code++) {
+    for (int c = 0; c < channels; c++) {
+      tables[c][code] =
+          law_encode(fmtData->audioFormat, frames[code * channels + c]);
+    }
+  }
+
+  pool_release(frames);
+  return 1;
+}
+
+int render_plan_is_byte_map(const RenderPlan *plan) {
+  for (size_t i = 0; i < plan->stage_count; i++) {
+    if (plan->stages[i].info) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Runs 256 frames whose bytes all hold their frame index through a byte-map
+// plan, giving one byte table per lane.
+int build_byte_tables(const RenderPlan *plan, const WavFmtData *pcm_fmt,
+                      uint8_t (*tables)[256]) {
+  size_t lanes = pcm_fmt->blockAlign;
+  uint8_t *frames = (uint8_t *)pool_acquire(256 * lanes);
+  if (!frames) {
+    return 0;
+  }
+
+  for (size_t v = 0; v < 256; v++) {
+    memset(frames + v * lanes, (int)v, lanes);
+  }
+  apply_render_plan(frames, 256 * lanes, 0, pcm_fmt, plan);
+  for (size_t v = 0; v < 256; v++) {
+    for (size_t lane = 0; lane < lanes; lane++) {
+      tables[lane][v] = frames[v * lanes + lane];
+    }
+  }
+
+  pool_release(frames);
+  return 1;
+}
+
+// Chains whose byte tables reduce to the identity or to one byte per lane
+// (and 255, or 0, xor twice, left 7 then left 1, ...) do not need to run:
+// identity ranges are copied, which copy_data_range turns into a reflink or
+// an in-kernel copy where it can, and constant ranges are filled.
+typedef enum {
+  BYTE_MAP_GENERAL,
+  BYTE_MAP_IDENTITY,
+  BYTE_MAP_CONSTANT
+} ByteMapKind;
+
+ByteMapKind classify_lane_tables(const uint8_t (*tables)[256], size_t lanes,
+                                 uint8_t *pattern) {
+  int identity = 1;
+  int constant = 1;
+  for (size_t lane = 0; lane < lanes; lane++) {
+    pattern[lane] = tables[lane][0];
+    for (int v = 0; v < 256; v++) {
+      identity &= tables[lane][v] == v;
+      constant &= tables[lane][v] == pattern[lane];
+    }
+  }
+  if (identity) {
+    return BYTE_MAP_IDENTITY;
+  }
+  return constant ? BYTE_MAP_CONSTANT : BYTE_MAP_GENERAL;
+}
+
+int skip_input(FILE *file, uint64_t length) {
+#ifdef _WIN32
+  return _fseeki64(file, (__int64)length, SEEK_CUR);
+#else
+  return fseeko(file, (off_t)length, SEEK_CUR);
+#endif
+}
+
+// Writes length bytes of the repeating lane pattern without reading the
+// input they replace.
+int fill_data_range(RenderContext *ctx, uint64_t length,
+                    const uint8_t *pattern, size_t lanes) {
+  if (skip_input(ctx->input_file, length) != 0) {
+    printf("Error: cannot seek input\n");
+    return 1;
+  }
+  size_t fill_size = (length < ctx->buffer_size) ? length : ctx->buffer_size;
+  for (size_t i = 0; i < fill_size; i++) {
+    ctx->buffer[i] = pattern[(ctx->position + i) % lanes];
+  }
+
+  while (length > 0) {
+    size_t chunk_size =
+        (length < ctx->buffer_size) ? length : ctx->buffer_size;
+    if (!write_output(ctx, ctx->buffer, chunk_size)) {
+      printf("Error: write incomplete chunk\n");
+      return 1;
+    }
+
+    length -= chunk_size;
+    ctx->position += chunk_size;
+    ctx->total_processed += chunk_size;
+    report_progress(ctx);
+    stream_pages(ctx);
+    if (!checkpoint_job(ctx)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Renders the range without running the plan when its byte map is the
+// identity or constant. Returns 1 and sets result when it did.
+int shortcut_data_range(RenderContext *ctx, const RenderPlan *plan,
+                        uint64_t length, int *result) {
+  const WavFmtData *fmtData = ctx->fmtData;
+  size_t lanes = fmtData->blockAlign;
+  int format = fmtData->audioFormat;
+  if (ctx->analysis || ctx->gain_table ||
+      (format == WAVE_FORMAT_PCM ? !render_plan_is_byte_map(plan)
+                                 : format == WAVE_FORMAT_IMA_ADPCM ||
+                                       !render_plan_is_static(plan))) {
+    return 0;
+  }
+
+  // One table per lane, followed by the lane pattern of a constant map.
+  uint8_t(*tables)[256] =
+      (uint8_t(*)[256])pool_acquire(lanes * (sizeof(*tables) + 1));
+  if (!tables) {
+    return 0;
+  }
+  uint8_t *pattern = (uint8_t *)(tables + lanes);
+  ByteMapKind kind = BYTE_MAP_GENERAL;
+  if (format == WAVE_FORMAT_PCM
+          ? build_byte_tables(plan, &ctx->pcm_fmt, tables)
+          : build_law_tables(plan, fmtData, &ctx->pcm_fmt, tables)) {
+    kind = classify_lane_tables((const uint8_t(*)[256])tables, lanes,
+                                pattern);
+  }
+
+  int handled = 1;
+  if (kind == BYTE_MAP_IDENTITY) {
+    printf("Chain reduces to the identity, copying audio data\n");
+    *result = copy_data_range(ctx, length);
+  } else if (kind == BYTE_MAP_CONSTANT && !ctx->source && !ctx->input_hash) {
+    // Fan-out jobs and input checksums still have to consume the input.
+    printf("Chain reduces to constant bytes, filling audio data\n");
+    *result = fill_data_range(ctx, length, pattern, lanes);
+  } else {
+    handled = 0;
+  }
+  pool_release(tables);
+  return handled;
+}
+
+// --auto-gain scales the output so its peak lands on a target level without
+// a normalizing pass over the written file. The output peak comes from an
+// analysis pass over the input, which for byte-map chains on PCM only
+// gathers the input histogram and maps it through the chain's tables. The
+// gain is then one more table on processing format samples. It is folded
+// into the per-channel tables of byte-map and A-law/mu-law chains and runs
+// after the chain otherwise, so the output is written once, normalized.
+double output_peak(const Analysis *analysis) {
+  double peak = 0;
+  for (int c = 0; c < analysis->channels; c++) {
+    const uint64_t *hist = analysis->output_hist + c * analysis->bins;
+    for (size_t v = 0; v < analysis->bins; v++) {
+      double x = (analysis->bits == 8) ? (double)v - 128 : (double)(int16_t)v;
+      if (hist[v] && fabs(x) > peak) {
+        peak = fabs(x);
+      }
+    }
+  }
+  return peak;
+}
+
+// Table from each raw sample value to its value after the gain that brings
+// peak to target_db dBFS, 256 or 65536 entries.
+uint16_t *build_gain_table(int bits, double peak, double target_db,
+                           double *gain) {
+  double full_scale = (bits == 8) ? 128.0 : 32768.0;
+  size_t bins = (bits == 8) ? 256 : 65536;
+  double target = full_scale * pow(10.0, target_db / 20);
+  if (target > full_scale - 1) {
+    target = full_scale - 1;
+  }
+  *gain = (peak > 0) ? target / peak : 1.0;
+
+  uint16_t *table = (uint16_t *)pool_acquire(bins * sizeof(uint16_t));
+  if (!table) {
+    return NULL;
+  }
+  for (size_t v = 0; v < bins; v++) {
+    double x = (bits == 8) ? (double)v - 128 : (double)(int16_t)v;
+    double y = floor(x * *gain + 0.5);
+    if (y > full_scale - 1) {
+      y = full_scale - 1;
+    } else if (y < -full_scale) {
+      y = -full_scale;
+    }
+    table[v] = (bits == 8) ? (uint16_t)(y + 128) : (uint16_t)(int16_t)y;
+  }
+  return table;
+}
+
+void apply_gain_table(uint8_t *data, size_t size, const WavFmtData *pcm_fmt,
+                      const uint16_t *table) {
+  if (pcm_fmt->bitsPerSample == 16) {
+    uint16_t *samples = (uint16_t *)data;
+    for (size_t i = 0; i < size / 2; i++) {
+      samples[i] = table[samples[i]];
+    }
+    return;
+  }
+  for (size_t i = 0; i < size; i++) {
+    data[i] = (uint8_t)table[data[i]];
+  }
+}
+
+// Per-channel tables from each raw sample value straight to its output
+// through a byte-map plan and then the gain, 256 or 65536 entries each.
+uint16_t *build_sample_tables(const RenderPlan *plan,
+                              const WavFmtData *pcm_fmt,
+                              const uint16_t *gain_table) {
+  int channels = pcm_fmt->numChannels;
+  size_t bins = (pcm_fmt->bitsPerSample == 8) ? 256 : 65536;
+  uint8_t(*lanes)[256] =
+      (uint8_t(*)[256])pool_acquire(pcm_fmt->blockAlign * sizeof(*lanes));
+  uint16_t *tables =
+      (uint16_t *)pool_acquire(channels * bins * sizeof(uint16_t));
+  if (!lanes || !tables || !build_byte_tables(plan, pcm_fmt, lanes)) {
+    pool_release(lanes);
+    pool_release(tables);
+    return NULL;
+  }
+
+  for (int c = 0; c < channels; c++) {
+    uint16_t *table = tables + c * bins;
+    for (size_t v = 0; v < bins; v++) {
+      size_t out = (bins == 256)
+                       ? lanes[c][v]
+                       : lanes[2 * c][v & 0xFF] |
+                             (lanes[2 * c + 1][v >> 8] << 8);
+      table[v] = gain_table[out];
+    }
+  }
+  pool_release(lanes);
+  return tables;
+}
+
+// position is the offset of data inside the data chunk.
+void apply_sample_tables(uint8_t *data, size_t size, uint64_t position,
+                         const WavFmtData *pcm_fmt, const uint16_t *tables) {
+  int channels = pcm_fmt->numChannels;
+  if (pcm_fmt->bitsPerSample == 16) {
+    uint16_t *samples = (uint16_t *)data;
+    int c = (int)(position / 2 % channels);
+    for (size_t i = 0; i < size / 2; i++) {
+      samples[i] = tables[(size_t)c * 65536 + samples[i]];
+      if (++c == channels) {
+        c = 0;
+      }
+    }
+    return;
+  }
+  int c = (int)(position % channels);
+  for (size_t i = 0; i < size; i++) {
+    data[i] = (uint8_t)tables[c * 256 + data[i]];
+    if (++c == channels) {
+      c = 0;
+    }
+  }
+}
+
+// Runs each code of A-law/mu-law tables through the gain.
+void fold_gain_into_law_tables(uint8_t (*tables)[256], int channels,
+                               int format, const uint16_t *gain_table) {
+  const int16_t *decode =
+      (format == WAVE_FORMAT_MULAW) ? mulaw_decode_table : alaw_decode_table;
+  for (int c = 0; c < channels; c++) {
+    for (int code = 0; code < 256; code++) {
+      int16_t sample = (int16_t)gain_table[(uint16_t)decode[tables[c][code]]];
+      tables[c][code] = law_encode(format, sample);
+    }
+  }
+}
+
+// Renders length bytes with a plan built from chain. Frame op state lives in
+// the plan, so a caller rendering one stream in several calls passes the same
+// plan each time. shortcut allows the identity and constant short-circuits.
+int transform_with_plan(RenderContext *ctx, uint64_t length,
+                        const OpChain *chain, const RenderPlan *plan,
+                        int shortcut) {
+  const WavFmtData *pcm_fmt = &ctx->pcm_fmt;
+  int encoded = ctx->fmtData->audioFormat != WAVE_FORMAT_PCM;
+
+  int automated = ctx->options->automation.type != ENVELOPE_NONE &&
+                  automated_op_index(chain) >= 0;
+  double duration = (double)ctx->data_size / ctx->fmtData->byteRate;
+  AutomationCache automation_cache;
+  memset(&automation_cache, 0, sizeof(automation_cache));
+
+  uint8_t(*law_tables)[256] = NULL;
+  uint8_t(*byte_tables)[256] = NULL;
+  uint16_t *sample_tables = NULL;
+  int16_t *pcm = NULL;
+  int result = 1;
+
+  if (shortcut && !automated &&
+      shortcut_data_range(ctx, plan, length, &result)) {
+    goto done;
+  }
+
+  if (ctx->analysis && !encoded && !automated &&
+      render_plan_is_byte_map(plan)) {
+    byte_tables = (uint8_t(*)[256])pool_acquire(pcm_fmt->blockAlign *
+                                                sizeof(*byte_tables));
+    if (!byte_tables || !build_byte_tables(plan, pcm_fmt, byte_tables)) {
+      printf("Error: cannot allocate analysis tables\n");
+      goto done;
+    }
+  } else if (encoded && ctx->fmtData->audioFormat != WAVE_FORMAT_IMA_ADPCM &&
+      !automated && render_plan_is_static(plan)) {
+    law_tables = (uint8_t(*)[256])pool_acquire(ctx->fmtData->numChannels *
+                                               sizeof(*law_tables));
+    if (!law_tables ||
+        !build_law_tables(plan, ctx->fmtData, pcm_fmt, law_tables)) {
+      printf("Error: cannot allocate codec tables\n");
+      goto done;
+    }
+    if (ctx->gain_table) {
+      fold_gain_into_law_tables(law_tables, ctx->fmtData->numChannels,
+                                ctx->fmtData->audioFormat, ctx->gain_table);
+    }
+  } else if (ctx->gain_table && !encoded && !automated &&
+             render_plan_is_byte_map(plan)) {
+    sample_tables = build_sample_tables(plan, pcm_fmt, ctx->gain_table);
+    if (!sample_tables) {
+      printf("Error: cannot allocate gain tables\n");
+      goto done;
+    }
+  } else if (encoded) {
+    size_t blocks = ctx->buffer_size / ctx->fmtData->blockAlign;
+    pcm = (int16_t *)pool_acquire(blocks * frames_per_block(ctx->fmtData) *
+                                  pcm_fmt->blockAlign);
+    if (!pcm) {
+      printf("Error: cannot allocate decode buffer\n");
+      goto done;
+    }
+  }
+
+  while (length > 0) {
+    size_t chunk_size =
+        (length < ctx->buffer_size) ? length : ctx->buffer_size;
+
+    if (!read_input(ctx, chunk_size)) {
+      printf("Error: read incomplete chunk\n");
+      goto done;
+    }
+    if (ctx->input_hash) {
+      xxh64_update(ctx->input_hash, ctx->buffer, chunk_size);
+    }
+
+    if (byte_tables) {
+      histogram_samples(ctx->buffer, chunk_size, pcm_fmt,
+                        ctx->analysis->range_hist);
+      length -= chunk_size;
+      ctx->position += chunk_size;
+      ctx->total_processed += chunk_size;
+      report_progress(ctx);
+      stream_pages(ctx);
+      continue;
+    }
+    if (ctx->analysis) {
+      memcpy(ctx->analysis->original, ctx->buffer, chunk_size);
+    }
+
+    if (law_tables) {
+      apply_lane_tables(ctx->buffer, chunk_size,
+                        (const uint8_t(*)[256])law_tables,
+                        ctx->fmtData->numChannels,
+                        ctx->position % ctx->fmtData->numChannels);
+    } else if (sample_tables) {
+      apply_sample_tables(ctx->buffer, chunk_size, ctx->position, pcm_fmt,
+                          sample_tables);
+    } else {
+      uint8_t *samples = ctx->buffer;
+      size_t sample_size = chunk_size;
+      uint64_t sample_position = ctx->position;
+      if (encoded) {
+        sample_size =
+            decode_samples(ctx->buffer, chunk_size, ctx->fmtData, pcm);
+        samples = (uint8_t *)pcm;
+        sample_position = processing_position(ctx->position, ctx->fmtData);
+      }
+
+      if (automated) {
+        if (!apply_automated_chain(samples, sample_size, sample_position,
+                                   chain, &automation_cache, ctx->options,
+                                   pcm_fmt, duration)) {
+          printf("Error: cannot allocate automation tables\n");
+          goto done;
+        }
+      } else {
+        apply_render_plan(samples, sample_size, sample_position, pcm_fmt,
+                          plan);
+      }
+      if (ctx->gain_table) {
+        apply_gain_table(samples, sample_size, pcm_fmt, ctx->gain_table);
+      }
+
+      if (encoded) {
+        encode_samples(pcm, chunk_size, ctx->fmtData, ctx->buffer);
+      }
+    }
+
+    if (ctx->analysis) {
+      Analysis *analysis = ctx->analysis;
+      histogram_file_samples(analysis, analysis->original, chunk_size,
+                             ctx->fmtData, pcm_fmt, analysis->input_hist);
+      histogram_file_samples(analysis, ctx->buffer, chunk_size, ctx->fmtData,
+                             pcm_fmt, analysis->output_hist);
+      count_changed_bytes(analysis, analysis->original, ctx->buffer,
+                          chunk_size, ctx->position, ctx->fmtData);
+    } else if (!write_output(ctx, ctx->buffer, chunk_size)) {
+      printf("Error: write incomplete chunk\n");
+      goto done;
+    }
+
+    length -= chunk_size;
+    ctx->position += chunk_size;
+    ctx->total_processed += chunk_size;
+    report_progress(ctx);
+    stream_pages(ctx);
+    if (!checkpoint_job(ctx)) {
+      goto done;
+    }
+  }
+
+  if (byte_tables) {
+    fold_range_histogram(ctx->analysis, (const uint8_t(*)[256])byte_tables);
+  }
+  result = 0;
+
+done:
+  pool_release(byte_tables);
+  pool_release(law_tables);
+  pool_release(sample_tables);
+  pool_release(pcm);
+  free_automation_cache(&automation_cache);
+  return result;
+}
+
+int transform_data_range(RenderContext *ctx, uint64_t length,
+                         const OpChain *chain) {
+  RenderPlan plan;
+  if (!build_render_plan(chain, ctx->options, &ctx->pcm_fmt, &plan)) {
+    printf("Error: cannot allocate channel tables\n");
+    return 1;
+  }
+  int result = transform_with_plan(ctx, length, chain, &plan, 1);
+  free_render_plan(&plan);
+  return result;
+}
+
+int render_regions(RenderContext *ctx, const Region *regions,
+                   size_t region_count) {
+  int result = 0;
+  for (size_t r = 0; r <= region_count && result == 0; r++) {
+    uint64_t untouched_end =
+        (r < region_count) ? regions[r].start : ctx->data_size;
+    if (untouched_end > ctx->position) {
+      result = copy_data_range(ctx, untouched_end - ctx->position);
+    }
+
+    if (r < region_count && result == 0 && regions[r].end > ctx->position) {
+      result = transform_data_range(ctx, regions[r].end - ctx->position,
+                                    &regions[r].chain);
+    }
+  }
+  return result;
+}
+
+// Dry run of the regions over the data chunk that reports what the chains
+// would do instead of writing an output file. With peak set it only measures
+// the output peak for --auto-gain.
+int analyze_wav_file(FILE *input_file, const WavFmtData *fmtData,
+                     uint32_t data_size, long data_offset,
+                     const Region *regions, size_t region_count,
+                     const ProcessOptions *options, InputStream *stream,
+                     GlitchSource *glitch, CombineSource *combine,
+                     double *peak) {
+  const size_t BUFFER_SIZE = io_tuning.block_size;
+  RenderContext ctx;
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.input_file = input_file;
+  ctx.fmtData = fmtData;
+  ctx.pcm_fmt = processing_format(fmtData);
+  ctx.options = options;
+  ctx.buffer_size = BUFFER_SIZE - BUFFER_SIZE % fmtData->blockAlign;
+  ctx.data_size = data_size;
+  ctx.stream = stream;
+  ctx.glitch = glitch;
+  ctx.combine = combine;
+
+  size_t pcm_size = 0;
+  if (fmtData->audioFormat != WAVE_FORMAT_PCM) {
+    pcm_size = ctx.buffer_size / fmtData->blockAlign *
+               frames_per_block(fmtData) * ctx.pcm_fmt.blockAlign;
+  }
+
+  Analysis analysis;
+  ctx.buffer = (uint8_t *)pool_acquire(BUFFER_SIZE);
+  if (!ctx.buffer ||
+      !init_analysis(&analysis, &ctx.pcm_fmt, ctx.buffer_size, pcm_size)) {
+    printf("Error: cannot allocate analysis buffers\n");
+    pool_release(ctx.buffer);
+    return 1;
+  }
+  ctx.analysis = &analysis;
+
+  if (fseek(input_file, data_offset, SEEK_SET) != 0) {
+    printf("Error: cannot seek to audio data\n");
+    free_analysis(&analysis);
+    pool_release(ctx.buffer);
+    return 1;
+  }
+
+  printf(peak ? "Measuring output level...\n" : "Analyzing audio data...\n");
+  int result = render_regions(&ctx, regions, region_count);
+  printf("\n");
+
+  if (result == 0 && peak) {
+    *peak = output_peak(&analysis);
+  } else if (result == 0) {
+    print_analysis(&analysis);
+  }
+
+  free_analysis(&analysis);
+  pool_release(ctx.buffer);
+  return result;
+}
+
+// Opens the input and checks that its format is one we can render.
+int open_wav_input(const char *input_filename, FILE **input,
+                   WavFmtData *fmtData, uint32_t *data_size,
+                   long *data_offset) {
+  FILE *input_file = fopen(input_filename, "rb");
+  if (!input_file) {
+    printf("Error: cannot open input file %s\n", input_filename);
+    return 0;
+  }
+
+  if (!parse_wav_file(input_file, fmtData, data_size, data_offset)) {
+    printf("Error: invalid WAV file format\n");
+    fclose(input_file);
+    return 0;
+  }
+
+  printf("WAV file info:\n");
+  printf("  Channels: %d\n", fmtData->numChannels);
+  printf("  Sample rate: %d Hz\n", fmtData->sampleRate);
+  printf("  Bits per sample: %d\n", fmtData->bitsPerSample);
+  printf("  Data size: %u bytes\n", *data_size);
+  printf("  Data offset: %ld bytes\n", *data_offset);
+
+  if (fmtData->audioFormat != WAVE_FORMAT_PCM &&
+      fmtData->audioFormat != WAVE_FORMAT_ALAW &&
+      fmtData->audioFormat != WAVE_FORMAT_MULAW &&
+      fmtData->audioFormat != WAVE_FORMAT_IMA_ADPCM) {
+    printf("Error: only PCM, A-law, mu-law and IMA ADPCM formats supported\n");
+    fclose(input_file);
+    return 0;
+  }
+
+  if (fmtData->audioFormat == WAVE_FORMAT_PCM &&
+      fmtData->bitsPerSample != 8 && fmtData->bitsPerSample != 16) {
+    printf("Error: only 8-bit and 16-bit PCM supported\n");
+    fclose(input_file);
+    return 0;
+  }
+
+  if ((fmtData->audioFormat == WAVE_FORMAT_ALAW ||
+       fmtData->audioFormat == WAVE_FORMAT_MULAW) &&
+      fmtData->bitsPerSample != 8) {
+    printf("Error: only 8-bit A-law and mu-law supported\n");
+    fclose(input_file);
+    return 0;
+  }
+
+  if (fmtData->audioFormat == WAVE_FORMAT_IMA_ADPCM &&
+      (fmtData->bitsPerSample != 4 || fmtData->numChannels == 0 ||
+       fmtData->blockAlign <= 4 * fmtData->numChannels ||
+       (fmtData->blockAlign - 4 * fmtData->numChannels) %
+               (4 * fmtData->numChannels) !=
+           0)) {
+    printf("Error: unsupported IMA ADPCM block layout\n");
+    fclose(input_file);
+    return 0;
+  }
+
+  if (fmtData->blockAlign == 0 || fmtData->numChannels == 0) {
+    printf("Error: invalid block alignment\n");
+    fclose(input_file);
+    return 0;
+  }
+
+  init_law_tables();
+  *input = input_file;
+  return 1;
+}
+
+// Reads everything before the data chunk, leaving the input at the audio.
+uint8_t *read_wav_header(FILE *input_file, long data_offset) {
+  rewind(input_file);
+  uint8_t *header_buffer = (uint8_t *)pool_acquire(data_offset);
+  if (!header_buffer) {
+    printf("Error: cannot allocate memory for header\n");
+    return NULL;
+  }
+
+  if (fread(header_buffer, 1, data_offset, input_file) != data_offset) {
+    printf("Error: cannot read file header\n");
+    pool_release(header_buffer);
+    return NULL;
+  }
+  return header_buffer;
+}
+
+// One output being rendered: its regions, temp file, checksums and journal.
+// finish_output_job cleans up after begin_output_job whether or not it
+// succeeded.
+typedef struct {
+  const char *output_filename;
+  char temp_filename[4096];
+  int in_place;
+  FILE *output_file;
+  Region *regions;
+  size_t region_count;
+  Journal journal;
+  Xxh64State output_hash;
+  Xxh64State input_hash;
+  RenderContext ctx;
+  int result;
+} OutputJob;
+
+int begin_output_job(OutputJob *job, const char *output_filename,
+                     FILE *input_file, const uint8_t *header_buffer,
+                     long data_offset, const WavFmtData *fmtData,
+                     uint32_t data_size, const OpChain *chain,
+                     const ProcessOptions *options) {
+  memset(job, 0, sizeof(OutputJob));
+  job->output_filename = output_filename;
+  job->result = 1;
+
+  if (!load_regions(options, fmtData, data_size, chain, &job->regions,
+                    &job->region_count)) {
+    return 0;
+  }
+
+  RenderContext *ctx = &job->ctx;
+  ctx->options = options;
+  ctx->fmtData = fmtData;
+  ctx->out_fmt = output_format(fmtData, &options->output);
+  ctx->converting = options->output.bits != 0 ||
+                    ctx->out_fmt.numChannels != fmtData->numChannels;
+  ctx->out_signed = options->output.bits ? options->output.is_signed
+                                         : ctx->out_fmt.bitsPerSample == 16;
+
+  const uint8_t *header = header_buffer;
+  uint8_t *converted_header = NULL;
+  if (ctx->converting && fmtData->audioFormat != WAVE_FORMAT_PCM) {
+    printf("Error: --out-format and --mono only support PCM inputs\n");
+    return 0;
+  }
+  if (ctx->converting) {
+    converted_header =
+        convert_header(header_buffer, data_offset, &ctx->out_fmt,
+                       (uint32_t)output_bytes(ctx, data_size));
+    if (!converted_header) {
+      return 0;
+    }
+    header = converted_header;
+  }
+
+  // Followed outputs are written in place so they can be read as they grow.
+  job->in_place = options->follow;
+  snprintf(job->temp_filename, sizeof(job->temp_filename),
+           job->in_place ? "%s" : "%s.part", output_filename);
+
+  uint64_t resume_position = 0;
+  if (options->journal_filename) {
+    job->journal.filename = options->journal_filename;
+    job->journal.fingerprint =
+        job_fingerprint(input_file, header_buffer, data_offset, job->regions,
+                        job->region_count, options);
+    resume_position = find_resume_position(
+        &job->journal, job->temp_filename, data_offset, fmtData, job->regions,
+        job->region_count, options);
+    job->journal.committed = resume_position;
+  }
+
+  xxh64_reset(&job->output_hash);
+  xxh64_reset(&job->input_hash);
+  if (resume_position == 0) {
+    xxh64_update(&job->output_hash, header, data_offset);
+  }
+
+  job->output_file =
+      fopen(job->temp_filename, resume_position > 0 ? "r+b" : "wb");
+  int header_written =
+      job->output_file &&
+      (resume_position > 0 ||
+       fwrite(header, 1, data_offset, job->output_file) == data_offset);
+  pool_release(converted_header);
+  if (!job->output_file) {
+    printf("Error: cannot create output file %s\n", job->temp_filename);
+    return 0;
+  }
+  if (!header_written) {
+    printf("Error: cannot write file header\n");
+    return 0;
+  }
+
+  preallocate_file(job->output_file,
+                   (uint64_t)data_offset + output_bytes(ctx, data_size));
+
+  const size_t BUFFER_SIZE = io_tuning.block_size;
+  ctx->buffer = (uint8_t *)pool_acquire(BUFFER_SIZE);
+  if (!ctx->buffer) {
+    printf("Error: cannot allocate buffer\n");
+    return 0;
+  }
+  ctx->buffer_size = BUFFER_SIZE - BUFFER_SIZE % fmtData->blockAlign;
+
+  if (ctx->converting) {
+    size_t samples = ctx->buffer_size / (fmtData->bitsPerSample / 8);
+    ctx->out_pcm = (int16_t *)pool_acquire(samples * sizeof(int16_t));
+    ctx->out_buffer = (uint8_t *)pool_acquire(samples * sizeof(int16_t));
+    if (!ctx->out_pcm || !ctx->out_buffer) {
+      printf("Error: cannot allocate conversion buffers\n");
+      return 0;
+    }
+  }
+
+  ctx->input_file = input_file;
+  ctx->output_file = job->output_file;
+  ctx->pcm_fmt = processing_format(fmtData);
+  ctx->position = resume_position;
+  ctx->total_processed = resume_position;
+  ctx->data_size = data_size;
+  int hashing = options->checksum || options->checksum_json;
+  ctx->output_hash = hashing ? &job->output_hash : NULL;
+  ctx->input_hash = (options->checksum_json && options->checksum_input)
+                        ? &job->input_hash
+                        : NULL;
+  ctx->journal = options->journal_filename ? &job->journal : NULL;
+
+  if (resume_position > 0) {
+    printf("Resuming from data offset %llu\n",
+           (unsigned long long)resume_position);
+    if (!prepare_resume(ctx, data_offset)) {
+      printf("Error: cannot resume output file %s\n", job->temp_filename);
+      return 0;
+    }
+  }
+
+  job->result = 0;
+  return 1;
+}
+
+// Publishes the output when job->result is 0 and returns the final result.
+int finish_output_job(OutputJob *job, const char *input_filename,
+                      const ProcessOptions *options) {
+  int result = job->result;
+  pool_release(job->ctx.buffer);
+  pool_release(job->ctx.out_pcm);
+  pool_release(job->ctx.out_buffer);
+  free(job->regions);
+
+  if (!job->output_file) {
+    return 1;
+  }
+
+  if (result == 0 && job->ctx.stream) {
+    drop_output_pages(job->output_file, &job->ctx.output_pages,
+                      job->ctx.stream->data_offset +
+                          output_bytes(&job->ctx, job->ctx.position),
+                      1);
+  }
+
+  if (result == 0 && options->durability != DURABILITY_NONE &&
+      !sync_file(job->output_file)) {
+    printf("Error: cannot sync output file %s\n", job->temp_filename);
+    result = 1;
+  }
+  if (fclose(job->output_file) != 0 && result == 0) {
+    printf("Error: cannot write output file %s\n", job->temp_filename);
+    result = 1;
+  }
+
+  if (result == 0 && !job->in_place &&
+      !commit_output(job->temp_filename, job->output_filename,
+                     options->durability)) {
+    result = 1;
+  }
+  if (result != 0 && !job->ctx.journal && !job->in_place) {
+    remove(job->temp_filename);
+  }
+
+  if (result == 0 && job->ctx.output_hash &&
+      !write_checksums(input_filename, job->output_filename, options,
+                       &job->output_hash, job->ctx.input_hash)) {
+    result = 1;
+  }
+
+  if (result == 0 && job->ctx.journal) {
+    remove(job->journal.filename);
+  }
+
+  return result;
+}
+
+int process_wav_file(const char *input_filename, const char *output_filename,
+                     const OpChain *chain, const ProcessOptions *options) {
+  FILE *input_file;
+  WavFmtData fmtData;
+  uint32_t data_size;
+  long data_offset;
+  if (!open_wav_input(input_filename, &input_file, &fmtData, &data_size,
+                      &data_offset)) {
+    return 1;
+  }
+
+  int result = 1;
+  InputStream stream;
+  InputStream *streaming = NULL;
+  GlitchSource glitch;
+  GlitchSource *glitching = NULL;
+  CombineSource combine;
+  CombineSource *combining = NULL;
+  uint32_t output_size = data_size;
+  uint16_t *gain_table = NULL;
+
+  if (options->streaming) {
+    if (!open_input_stream(&stream, input_filename, input_file, data_offset,
+                           options)) {
+      goto done;
+    }
+    streaming = &stream;
+  }
+
+  if (options->glitch.type != GLITCH_NONE) {
+    open_glitch_source(&glitch, input_file, data_offset, data_size, &fmtData,
+                       &options->glitch);
+    glitching = &glitch;
+  }
+
+  if (options->combine.type != COMBINE_NONE) {
+    if (!open_combine_source(&combine, &options->combine, &fmtData, data_size,
+                             &output_size)) {
+      goto done;
+    }
+    combining = &combine;
+    if ((uint64_t)data_offset - 8 + output_size > UINT32_MAX) {
+      printf("Error: combined output is too large for a WAV file\n");
+      goto done;
+    }
+    printf("Combining %zu inputs, %u bytes of output data\n",
+           options->combine.count + 1, output_size);
+  }
+
+  if (options->analyze) {
+    Region *regions;
+    size_t region_count;
+    if (load_regions(options, &fmtData, output_size, chain, &regions,
+                     &region_count)) {
+      result = analyze_wav_file(input_file, &fmtData, output_size,
+                                data_offset, regions, region_count, options,
+                                streaming, glitching, combining, NULL);
+      free(regions);
+    }
+    goto done;
+  }
+
+  if (options->auto_gain) {
+    Region *regions;
+    size_t region_count;
+    double peak = 0;
+    if (!load_regions(options, &fmtData, output_size, chain, &regions,
+                      &region_count)) {
+      goto done;
+    }
+    int measured = analyze_wav_file(input_file, &fmtData, output_size,
+                                    data_offset, regions, region_count,
+                                    options, streaming, glitching, combining,
+                                    &peak) == 0;
+    free(regions);
+    if (!measured) {
+      goto done;
+    }
+
+    int bits = processing_format(&fmtData).bitsPerSample;
+    double full_scale = (bits == 8) ? 128.0 : 32768.0;
+    double gain;
+    gain_table = build_gain_table(bits, peak, options->auto_gain_db, &gain);
+    if (!gain_table) {
+      printf("Error: cannot allocate gain table\n");
+      goto done;
+    }
+    printf("Output peak %.1f dBFS, applying %+.1f dB of gain\n",
+           peak > 0 ? 20 * log10(peak / full_scale) : -INFINITY,
+           20 * log10(gain));
+  }
+
+  uint8_t *header_buffer = read_wav_header(input_file, data_offset);
+  if (!header_buffer) {
+    goto done;
+  }
+  if (output_size != data_size) {
+    set_wav_sizes(header_buffer, data_offset, output_size);
+  }
+
+  OutputJob job;
+  int ok = begin_output_job(&job, output_filename, input_file, header_buffer,
+                            data_offset, &fmtData, output_size, chain,
+                            options);
+  pool_release(header_buffer);
+  job.ctx.stream = streaming;
+  job.ctx.glitch = glitching;
+  job.ctx.combine = combining;
+  job.ctx.gain_table = gain_table;
+
+  if (ok) {
+    printf("Processing audio data...\n");
+    job.result = render_regions(&job.ctx, job.regions, job.region_count);
+    printf("\n");
+  }
+
+  result = finish_output_job(&job, input_filename, options);
+
+done:
+  pool_release(gain_table);
+  if (streaming) {
+    close_input_stream(streaming);
+  }
+  if (glitching) {
+    close_glitch_source(glitching);
+  }
+  if (combining) {
+    close_combine_source(combining);
+  }
+  fclose(input_file);
+  return result;
+}
+
+typedef struct {
+  char *output_filename;
+  OpChain chain;
+} Variant;
+
+void *render_job_thread(void *arg) {
+  OutputJob *job = (OutputJob *)arg;
+  job->result = render_regions(&job->ctx, job->regions, job->region_count);
+  fan_out_detach(job->ctx.source, job->ctx.consumer);
+  return NULL;
+}
+
+// Renders every variant from a single read of the input, one thread per
+// output.
+int process_fan_out(const char *input_filename, const Variant *variants,
+                    size_t variant_count, const ProcessOptions *options) {
+  FILE *input_file;
+  WavFmtData fmtData;
+  uint32_t data_size;
+  long data_offset;
+  if (!open_wav_input(input_filename, &input_file, &fmtData, &data_size,
+                      &data_offset)) {
+    return 1;
+  }
+
+  InputStream stream;
+  if (options->streaming &&
+      !open_input_stream(&stream, input_filename, input_file, data_offset,
+                         options)) {
+    fclose(input_file);
+    return 1;
+  }
+  InputStream *streaming = options->streaming ? &stream : NULL;
+
+  GlitchSource glitch;
+  GlitchSource *glitching = NULL;
+  if (options->glitch.type != GLITCH_NONE) {
+    open_glitch_source(&glitch, input_file, data_offset, data_size, &fmtData,
+                       &options->glitch);
+    glitching = &glitch;
+  }
+
+  uint8_t *header_buffer = read_wav_header(input_file, data_offset);
+  if (!header_buffer) {
+    if (streaming) {
+      close_input_stream(streaming);
+    }
+    if (glitching) {
+      close_glitch_source(glitching);
+    }
+    fclose(input_file);
+    return 1;
+  }
+
+  FanOutSource source;
+  memset(&source, 0, sizeof(source));
+  source.input_file = input_file;
+  source.stream = streaming;
+  source.glitch = glitching;
+  source.data_size = data_size;
+  source.consumer_count = variant_count;
+  source.consumed = (uint64_t *)calloc(variant_count, sizeof(uint64_t));
+  pthread_mutex_init(&source.lock, NULL);
+  pthread_cond_init(&source.changed, NULL);
+
+  OutputJob *jobs = (OutputJob *)calloc(variant_count, sizeof(OutputJob));
+  pthread_t *threads = (pthread_t *)calloc(variant_count, sizeof(pthread_t));
+  int result = 0;
+  if (!source.consumed || !jobs || !threads) {
+    result = 1;
+  }
+  source.block_size = io_tuning.block_size;
+  source.slot_count = io_tuning.queue_depth;
+  for (size_t s = 0; s < source.slot_count && result == 0; s++) {
+    source.slots[s] = (uint8_t *)pool_acquire(source.block_size);
+    if (!source.slots[s]) {
+      result = 1;
+    }
+  }
+  if (result != 0) {
+    printf("Error: cannot allocate fan-out buffers\n");
+  }
+
+  size_t begun = 0;
+  for (; result == 0 && begun < variant_count; begun++) {
+    OutputJob *job = &jobs[begun];
+    if (!begin_output_job(job, variants[begun].output_filename, input_file,
+                          header_buffer, data_offset, &fmtData, data_size,
+                          &variants[begun].chain, options)) {
+      result = 1;
+    }
+    job->ctx.source = &source;
+    job->ctx.consumer = begun;
+    job->ctx.stream = streaming;
+  }
+  pool_release(header_buffer);
+
+  size_t started = 0;
+  if (result == 0) {
+    printf("Rendering %zu variations...\n", variant_count);
+    for (; started < variant_count; started++) {
+      if (pthread_create(&threads[started], NULL, render_job_thread,
+                         &jobs[started]) != 0) {
+        printf("Error: cannot start render thread\n");
+        break;
+      }
+    }
+    for (size_t v = started; v < variant_count; v++) {
+      jobs[v].result = 1;
+      fan_out_detach(&source, v);
+    }
+    if (!fan_out_fill(&source)) {
+      result = 1;
+    }
+    for (size_t v = 0; v < started; v++) {
+      pthread_join(threads[v], NULL);
+    }
+    printf("\n");
+  } else {
+    for (size_t v = 0; v < begun; v++) {
+      jobs[v].result = 1;
+    }
+  }
+
+  for (size_t v = 0; v < begun; v++) {
+    if (finish_output_job(&jobs[v], input_filename, options) != 0) {
+      result = 1;
+    } else {
+      printf("Saved %s\n", jobs[v].output_filename);
+    }
+  }
+
+  for (size_t s = 0; s < source.slot_count; s++) {
+    pool_release(source.slots[s]);
+  }
+  pthread_mutex_destroy(&source.lock);
+  pthread_cond_destroy(&source.changed);
+  free(source.consumed);
+  free(jobs);
+  free(threads);
+  if (streaming) {
+    close_input_stream(streaming);
+  }
+  if (glitching) {
+    close_glitch_source(glitching);
+  }
+  fclose(input_file);
+  return result;
+}
+
+// A job graph runs several processing steps in one pass without writing the
+// audio between them to disk. The graph file has one node per line, and a
+// node can only read nodes defined above it:
+//
+//   input NAME FILE                  read a PCM WAV file
+//   chain NAME FROM CHAIN            run an op chain, e.g. xor:85,right:2
+//   convert NAME FROM FMT            change the samples like --out-format
+//                                    and --mono, e.g. u8 or s16,mono
+//   combine NAME MODE[:RULE] FROM... combine like --combine and --length
+//   output FROM FILE                 write FROM to FILE
+//
+// Every node runs on its own thread and publishes its audio through a ring
+// of blocks like the fan-out reader. Block k holds the same frames in every
+// node, so a node makes its block k from block k of its inputs. A slot is
+// only refilled once every reader is past it, which holds back nodes that
+// run ahead, while independent branches run in parallel. Only output nodes
+// write files. Block size and ring depth come from io_tuning.
+#define MAX_GRAPH_NODES 64
+#define MAX_NODE_INPUTS (MAX_COMBINE_INPUTS + 1)
+
+typedef enum {
+  NODE_INPUT,
+  NODE_CHAIN,
+  NODE_CONVERT,
+  NODE_COMBINE,
+  NODE_OUTPUT
+} NodeType;
+
+// The audio of a node. consumed holds the number of blocks each reader is
+// done with.
+typedef struct {
+  WavFmtData fmt;
+  uint64_t data_size;
+  size_t block_size;
+  size_t slot_count;
+  uint8_t *slots[MAX_FAN_OUT_SLOTS];
+  uint64_t loaded;
+  uint64_t *consumed;
+  size_t consumer_count;
+  int error;
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+} NodeStream;
+
+typedef struct {
+  NodeType type;
+  char name[64];
+  char filename[4096];
+  char temp_filename[4096];
+  NodeStream *sources[MAX_NODE_INPUTS];
+  size_t consumers[MAX_NODE_INPUTS];
+  size_t source_count;
+  OpChain chain;
+  OutputFormat output;
+  int out_signed;
+  CombineType combine;
+  LengthRule length;
+  FILE *file;
+  long data_offset;
+  NodeStream stream;
+  int result;
+} GraphNode;
+
+typedef struct {
+  GraphNode *nodes;
+  size_t node_count;
+  size_t output_count;
+} JobGraph;
+
+uint64_t stream_block_count(const NodeStream *stream) {
+  return (stream->data_size + stream->block_size - 1) / stream->block_size;
+}
+
+size_t stream_block_bytes(const NodeStream *stream, uint64_t block) {
+  uint64_t remaining = stream->data_size - block * stream->block_size;
+  return (remaining < stream->block_size) ? (size_t)remaining
+                                          : stream->block_size;
+}
+
+// Waits for block to be published and returns its slot, or NULL when the
+// node producing it failed.
+const uint8_t *wait_for_block(NodeStream *stream, uint64_t block) {
+  pthread_mutex_lock(&stream->lock);
+  while (stream->loaded <= block && !stream->error) {
+    pthread_cond_wait(&stream->changed, &stream->lock);
+  }
+  int error = stream->error;
+  pthread_mutex_unlock(&stream->lock);
+  return error ? NULL : stream->slots[block % stream->slot_count];
+}
+
+// Marks the first count blocks as done for one reader. UINT64_MAX detaches
+// the reader.
+void release_blocks(NodeStream *stream, size_t consumer, uint64_t count) {
+  pthread_mutex_lock(&stream->lock);
+  stream->consumed[consumer] = count;
+  pthread_cond_broadcast(&stream->changed);
+  pthread_mutex_unlock(&stream->lock);
+}
+
+// Waits until the slot of block is free and returns it, or NULL when no
+// reader needs the rest of the stream.
+uint8_t *claim_block(NodeStream *stream, uint64_t block) {
+  pthread_mutex_lock(&stream->lock);
+  uint64_t slowest;
+  for (;;) {
+    slowest = UINT64_MAX;
+    for (size_t c = 0; c < stream->consumer_count; c++) {
+      if (stream->consumed[c] < slowest) {
+        slowest = stream->consumed[c];
+      }
+    }
+    if (slowest == UINT64_MAX || slowest + stream->slot_count > block) {
+      break;
+    }
+    pthread_cond_wait(&stream->changed, &stream->lock);
+  }
+  pthread_mutex_unlock(&stream->lock);
+  return (slowest == UINT64_MAX) ? NULL
+                                 : stream->slots[block % stream->slot_count];
+}
+
+void publish_block(NodeStream *stream, uint64_t block) {
+  pthread_mutex_lock(&stream->lock);
+  stream->loaded = block + 1;
+  pthread_cond_broadcast(&stream->changed);
+  pthread_mutex_unlock(&stream->lock);
+}
+
+void fail_stream(NodeStream *stream) {
+  pthread_mutex_lock(&stream->lock);
+  stream->error = 1;
+  pthread_cond_broadcast(&stream->changed);
+  pthread_mutex_unlock(&stream->lock);
+}
+
+void free_job_graph(JobGraph *graph) {
+  for (size_t n = 0; n < graph->node_count; n++) {
+    GraphNode *node = &graph->nodes[n];
+    if (node->file) {
+      fclose(node->file);
+      if (node->type == NODE_OUTPUT) {
+        remove(node->temp_filename);
+      }
+    }
+    for (size_t s = 0; s < node->stream.slot_count; s++) {
+      pool_release(node->stream.slots[s]);
+    }
+    free(node->stream.consumed);
+    pthread_mutex_destroy(&node->stream.lock);
+    pthread_cond_destroy(&node->stream.changed);
+  }
+  free(graph->nodes);
+}
+
+GraphNode *find_graph_node(JobGraph *graph, const char *name) {
+  for (size_t n = 0; n < graph->node_count; n++) {
+    if (graph->nodes[n].type != NODE_OUTPUT &&
+        strcmp(graph->nodes[n].name, name) == 0) {
+      return &graph->nodes[n];
+    }
+  }
+  return NULL;
+}
+
+int add_node_source(JobGraph *graph, GraphNode *node, const char *name,
+                    const char *where) {
+  GraphNode *source = find_graph_node(graph, name);
+  if (!source) {
+    printf("Error: unknown node %s on %s\n", name, where);
+    return 0;
+  }
+  if (node->source_count == MAX_NODE_INPUTS) {
+    printf("Error: more than %d inputs on %s\n", MAX_NODE_INPUTS, where);
+    return 0;
+  }
+  node->sources[node->source_count] = &source->stream;
+  node->consumers[node->source_count] = source->stream.consumer_count++;
+  node->source_count++;
+  return 1;
+}
+
+// Parses a convert format such as "u8", "mono" or "s16,mono".
+int parse_convert(const char *spec, OutputFormat *format) {
+  memset(format, 0, sizeof(OutputFormat));
+  while (*spec) {
+    char token[16];
+    size_t len = strcspn(spec, ",");
+    if (len == 0 || len >= sizeof(token)) {
+      return 0;
+    }
+    memcpy(token, spec, len);
+    token[len] = '\0';
+    spec += len;
+    if (*spec == ',') {
+      spec++;
+    }
+
+    if (strcmp(token, "mono") == 0) {
+      format->mono = 1;
+    } else if (format->bits || !parse_out_format(token, format)) {
+      return 0;
+    }
+  }
+  return format->bits || format->mono;
+}
+
+// Fills in node from one line of the graph file, with everything after the
+// keyword in rest. Streams of new nodes get their format and size here.
+int parse_graph_node(JobGraph *graph, GraphNode *node, const char *keyword,
+                     const char *rest, const char *where) {
+  char from[64];
+  char spec[256];
+  int used = 0;
+  NodeStream *stream = &node->stream;
+
+  if (strcmp(keyword, "output") == 0) {
+    node->type = NODE_OUTPUT;
+    if (sscanf(rest, "%63s %4095s", from, node->filename) != 2) {
+      printf("Error: expected \"output FROM FILE\" on %s\n", where);
+      return 0;
+    }
+    if (!add_node_source(graph, node, from, where)) {
+      return 0;
+    }
+    if (node->sources[0]->data_size > UINT32_MAX - 36) {
+      printf("Error: output on %s is too large for a WAV file\n", where);
+      return 0;
+    }
+    graph->output_count++;
+    return 1;
+  }
+
+  if (strcmp(keyword, "input") == 0) {
+    node->type = NODE_INPUT;
+    if (sscanf(rest, "%63s %4095s", node->name, node->filename) != 2) {
+      printf("Error: expected \"input NAME FILE\" on %s\n", where);
+      return 0;
+    }
+  } else if (strcmp(keyword, "chain") == 0) {
+    node->type = NODE_CHAIN;
+    if (sscanf(rest, "%63s %63s %n", node->name, from, &used) != 2 ||
+        !parse_op_chain(rest + used, &node->chain)) {
+      printf("Error: expected \"chain NAME FROM CHAIN\" on %s\n", where);
+      return 0;
+    }
+  } else if (strcmp(keyword, "convert") == 0) {
+    node->type = NODE_CONVERT;
+    if (sscanf(rest, "%63s %63s %255s", node->name, from, spec) != 3 ||
+        !parse_convert(spec, &node->output)) {
+      printf("Error: expected \"convert NAME FROM FMT\" on %s\n", where);
+      return 0;
+    }
+  } else if (strcmp(keyword, "combine") == 0) {
+    node->type = NODE_COMBINE;
+    node->length = LENGTH_FIRST;
+    char *colon = NULL;
+    if (sscanf(rest, "%63s %255s%n", node->name, spec, &used) == 2) {
+      colon = strchr(spec, ':');
+      if (colon) {
+        *colon = '\0';
+      }
+    }
+    if (!used || !parse_combine(spec, &node->combine) ||
+        (colon && !parse_length_rule(colon + 1, &node->length))) {
+      printf("Error: expected \"combine NAME MODE[:RULE] FROM...\" on %s\n",
+             where);
+      return 0;
+    }
+  } else {
+    printf("Error: unknown node type %s on %s\n", keyword, where);
+    return 0;
+  }
+
+  if (find_graph_node(graph, node->name)) {
+    printf("Error: node %s is defined twice, on %s\n", node->name, where);
+    return 0;
+  }
+
+  if (node->type == NODE_COMBINE) {
+    const char *p = rest + used;
+    int n;
+    while (sscanf(p, "%63s%n", from, &n) == 1) {
+      if (!add_node_source(graph, node, from, where)) {
+        return 0;
+      }
+      p += n;
+    }
+    if (node->source_count < 2) {
+      printf("Error: combine needs at least two inputs on %s\n", where);
+      return 0;
+    }
+
+    stream->fmt = node->sources[0]->fmt;
+    stream->data_size = node->sources[0]->data_size;
+    for (size_t i = 1; i < node->source_count; i++) {
+      const NodeStream *other = node->sources[i];
+      if (!formats_match(&stream->fmt, &other->fmt)) {
+        printf("Error: combined nodes have different formats on %s\n",
+               where);
+        return 0;
+      }
+      if ((node->length == LENGTH_SHORTEST &&
+           other->data_size < stream->data_size) ||
+          (node->length == LENGTH_LONGEST &&
+           other->data_size > stream->data_size)) {
+        stream->data_size = other->data_size;
+      }
+    }
+  } else if (node->type != NODE_INPUT) {
+    if (!add_node_source(graph, node, from, where)) {
+      return 0;
+    }
+    stream->fmt = node->sources[0]->fmt;
+    stream->data_size = node->sources[0]->data_size;
+    if (node->type == NODE_CONVERT) {
+      stream->fmt = output_format(&stream->fmt, &node->output);
+      stream->data_size = stream->data_size /
+                          node->sources[0]->fmt.blockAlign *
+                          stream->fmt.blockAlign;
+      node->out_signed = node->output.bits
+                             ? node->output.is_signed
+                             : stream->fmt.bitsPerSample == 16;
+    }
+  } else {
+    uint32_t data_size;
+    if (!open_wav_input(node->filename, &node->file, &stream->fmt,
+                        &data_size, &node->data_offset)) {
+      return 0;
+    }
+    if (stream->fmt.audioFormat != WAVE_FORMAT_PCM) {
+      printf("Error: graph inputs must be PCM, on %s\n", where);
+      fclose(node->file);
+      node->file = NULL;
+      return 0;
+    }
+    stream->data_size = data_size - data_size % stream->fmt.blockAlign;
+  }
+  return 1;
+}
+
+// Reads the graph file into graph. Frees what it built when it fails.
+int load_job_graph(const char *filename, JobGraph *graph) {
+  memset(graph, 0, sizeof(JobGraph));
+  FILE *file = fopen(filename, "r");
+  if (!file) {
+    printf("Error: cannot open graph file %s\n", filename);
+    return 0;
+  }
+  graph->nodes = (GraphNode *)calloc(MAX_GRAPH_NODES, sizeof(GraphNode));
+  if (!graph->nodes) {
+    printf("Error: cannot allocate graph\n");
+    fclose(file);
+    return 0;
+  }
+
+  char line[8192];
+  int line_number = 0;
+  int ok = 1;
+  while (ok && fgets(line, sizeof(line), file)) {
+    line_number++;
+
+    char *comment = strchr(line, '#');
+    if (comment) {
+      *comment = '\0';
+    }
+    line[strcspn(line, "\r\n")] = '\0';
+
+    char keyword[16];
+    int used;
+    if (sscanf(line, "%15s%n", keyword, &used) != 1) {
+      continue;
+    }
+    char where[4200];
+    snprintf(where, sizeof(where), "line %d of %s", line_number, filename);
+    if (graph->node_count == MAX_GRAPH_NODES) {
+      printf("Error: more than %d nodes, on %s\n", MAX_GRAPH_NODES, where);
+      ok = 0;
+      break;
+    }
+
+    GraphNode *node = &graph->nodes[graph->node_count];
+    memset(node, 0, sizeof(GraphNode));
+    ok = parse_graph_node(graph, node, keyword, line + used, where);
+    pthread_mutex_init(&node->stream.lock, NULL);
+    pthread_cond_init(&node->stream.changed, NULL);
+    graph->node_count++;
+  }
+  fclose(file);
+
+  for (size_t n = 0; ok && n < graph->node_count; n++) {
+    const GraphNode *node = &graph->nodes[n];
+    if (node->type != NODE_OUTPUT && node->stream.consumer_count == 0) {
+      printf("Error: node %s is not used\n", node->name);
+      ok = 0;
+    }
+  }
+  if (ok && graph->output_count == 0) {
+    printf("Error: %s has no output nodes\n", filename);
+    ok = 0;
+  }
+
+  if (!ok) {
+    free_job_graph(graph);
+  }
+  return ok;
+}
+
+// Writes a canonical header for data_size bytes in format fmt.
+int write_graph_header(FILE *file, const WavFmtData *fmt, uint32_t data_size) {
+  uint8_t header[44];
+  WavRiffHeader riff = {{'R', 'I', 'F', 'F'}, 36 + data_size,
+                        {'W', 'A', 'V', 'E'}};
+  WavChunkHeader fmt_chunk = {{'f', 'm', 't', ' '}, sizeof(WavFmtData)};
+  WavChunkHeader data_chunk = {{'d', 'a', 't', 'a'}, data_size};
+  memcpy(header, &riff, 12);
+  memcpy(header + 12, &fmt_chunk, 8);
+  memcpy(header + 20, fmt, 16);
+  memcpy(header + 36, &data_chunk, 8);
+  return fwrite(header, 1, sizeof(header), file) == sizeof(header);
+}
+
+// Sizes the blocks so they all hold the same frames, allocates the rings and
+// opens the outputs.
+int prepare_job_graph(JobGraph *graph) {
+  size_t widest = 1;
+  for (size_t n = 0; n < graph->node_count; n++) {
+    const GraphNode *node = &graph->nodes[n];
+    if (node->type != NODE_OUTPUT && node->stream.fmt.blockAlign > widest) {
+      widest = node->stream.fmt.blockAlign;
+    }
+  }
+  size_t block_frames = io_tuning.block_size / widest;
+  if (block_frames == 0) {
+    block_frames = 1;
+  }
+
+  for (size_t n = 0; n < graph->node_count; n++) {
+    GraphNode *node = &graph->nodes[n];
+    NodeStream *stream = &node->stream;
+    if (node->type == NODE_OUTPUT) {
+      const NodeStream *source = node->sources[0];
+      if (snprintf(node->temp_filename, sizeof(node->temp_filename),
+                   "%s.part", node->filename) >=
+          (int)sizeof(node->temp_filename)) {
+        printf("Error: output file name %s is too long\n", node->filename);
+        return 0;
+      }
+      node->file = fopen(node->temp_filename, "wb");
+      if (!node->file) {
+        printf("Error: cannot create output file %s\n",
+               node->temp_filename);
+        return 0;
+      }
+      if (!write_graph_header(node->file, &source->fmt,
+                              (uint32_t)source->data_size)) {
+        printf("Error: cannot write file header\n");
+        return 0;
+      }
+      preallocate_file(node->file, 44 + source->data_size);
+      continue;
+    }
+
+    stream->block_size = block_frames * stream->fmt.blockAlign;
+    stream->consumed =
+        (uint64_t *)calloc(stream->consumer_count, sizeof(uint64_t));
+    if (!stream->consumed) {
+      printf("Error: cannot allocate graph buffers\n");
+      return 0;
+    }
+    for (size_t s = 0; s < io_tuning.queue_depth; s++) {
+      stream->slots[s] = (uint8_t *)pool_acquire(stream->block_size);
+      if (!stream->slots[s]) {
+        printf("Error: cannot allocate graph buffers\n");
+        return 0;
+      }
+      stream->slot_count++;
+    }
+  }
+  return 1;
+}
+
+// Folds block of every input of a combine node into slot.
+int combine_graph_block(GraphNode *node, uint64_t block, uint8_t *slot,
+                        size_t size) {
+  int bits = node->stream.fmt.bitsPerSample;
+  for (size_t i = 0; i < node->source_count; i++) {
+    NodeStream *source = node->sources[i];
+    size_t available = 0;
+    if (block < stream_block_count(source)) {
+      const uint8_t *data = wait_for_block(source, block);
+      if (!data) {
+        return 0;
+      }
+      available = stream_block_bytes(source, block);
+      if (available > size) {
+        available = size;
+      }
+      if (i == 0) {
+        memcpy(slot, data, available);
+      } else {
+        fold_combined(node->combine, slot, data, available, bits);
+      }
+      release_blocks(source, node->consumers[i], block + 1);
+    }
+    if (i == 0) {
+      memset(slot + available, combine_identity(node->combine, bits),
+             size - available);
+    }
+  }
+  return 1;
+}
+
+// Makes block of the node's stream in slot.
+int fill_graph_block(GraphNode *node, uint64_t block, uint8_t *slot,
+                     size_t size, const RenderPlan *plan, int16_t *pcm) {
+  if (node->type == NODE_INPUT) {
+    if (fread(slot, 1, size, node->file) != size) {
+      printf("Error: read incomplete chunk from %s\n", node->filename);
+      return 0;
+    }
+    return 1;
+  }
+  if (node->type == NODE_COMBINE) {
+    return combine_graph_block(node, block, slot, size);
+  }
+
+  NodeStream *source = node->sources[0];
+  const uint8_t *data = wait_for_block(source, block);
+  if (!data) {
+    return 0;
+  }
+  if (node->type == NODE_CHAIN) {
+    memcpy(slot, data, size);
+    release_blocks(source, node->consumers[0], block + 1);
+    apply_render_plan(slot, size, block * node->stream.block_size,
+                      &node->stream.fmt, plan);
+    return 1;
+  }
+
+  size_t count = widen_samples(data, stream_block_bytes(source, block),
+                               &source->fmt, node->output.mono, pcm);
+  release_blocks(source, node->consumers[0], block + 1);
+  pack_samples(pcm, count, &node->stream.fmt, node->out_signed, slot);
+  return 1;
+}
+
+int run_graph_node(GraphNode *node) {
+  NodeStream *stream = &node->stream;
+  NodeStream *source = node->sources[0];
+  RenderPlan plan = {NULL, 0};
+  int16_t *pcm = NULL;
+  int result = 1;
+
+  if (node->type == NODE_INPUT &&
+      seek_file(node->file, node->data_offset) != 0) {
+    printf("Error: cannot seek to audio data in %s\n", node->filename);
+    return 1;
+  }
+  if (node->type == NODE_CHAIN) {
+    ProcessOptions options;
+    memset(&options, 0, sizeof(options));
+    if (!build_render_plan(&node->chain, &options, &stream->fmt, &plan)) {
+      printf("Error: cannot allocate channel tables\n");
+      return 1;
+    }
+  }
+  if (node->type == NODE_CONVERT) {
+    pcm = (int16_t *)pool_acquire(source->block_size /
+                                  (source->fmt.bitsPerSample / 8) *
+                                  sizeof(int16_t));
+    if (!pcm) {
+      printf("Error: cannot allocate conversion buffers\n");
+      return 1;
+    }
+  }
+
+  if (node->type == NODE_OUTPUT) {
+    uint64_t block_count = stream_block_count(source);
+    for (uint64_t block = 0; block < block_count; block++) {
+      const uint8_t *data = wait_for_block(source, block);
+      if (!data) {
+        goto done;
+      }
+      size_t size = stream_block_bytes(source, block);
+      if (fwrite(data, 1, size, node->file) != size) {
+        printf("Error: write incomplete chunk to %s\n", node->temp_filename);
+        goto done;
+      }
+      release_blocks(source, node->consumers[0], block + 1);
+    }
+    result = 0;
+    goto done;
+  }
+
+  uint64_t block_count = stream_block_count(stream);
+  for (uint64_t block = 0; block < block_count; block++) {
+    uint8_t *slot = claim_block(stream, block);
+    if (!slot) {
+      break;
+    }
+    if (!fill_graph_block(node, block, slot, stream_block_bytes(stream, block),
+                          &plan, pcm)) {
+      goto done;
+    }
+    publish_block(stream, block);
+  }
+  result = 0;
+
+done:
+  free_render_plan(&plan);
+  pool_release(pcm);
+  return result;
+}
+
+// Lets the node's inputs move on without it and, when it failed, fails the
+// nodes reading from it.
+void stop_graph_node(GraphNode *node) {
+  for (size_t i = 0; i < node->source_count; i++) {
+    release_blocks(node->sources[i], node->consumers[i], UINT64_MAX);
+  }
+  if (node->result != 0 && node->type != NODE_OUTPUT) {
+    fail_stream(&node->stream);
+  }
+}
+
+void *graph_node_thread(void *arg) {
+  GraphNode *node = (GraphNode *)arg;
+  node->result = run_graph_node(node);
+  stop_graph_node(node);
+  return NULL;
+}
+
+int run_job_graph(const char *filename) {
+  JobGraph graph;
+  if (!load_job_graph(filename, &graph)) {
+    return 1;
+  }
+  int result = prepare_job_graph(&graph) ? 0 : 1;
+  pthread_t threads[MAX_GRAPH_NODES];
+
+  size_t started = 0;
+  if (result == 0) {
+    printf("Running %zu nodes, writing %zu outputs...\n", graph.node_count,
+           graph.output_count);
+    for (; started < graph.node_count; started++) {
+      if (pthread_create(&threads[started], NULL, graph_node_thread,
+                         &graph.nodes[started]) != 0) {
+        printf("Error: cannot start node thread\n");
+        result = 1;
+        break;
+      }
+    }
+    for (size_t n = started; n < graph.node_count; n++) {
+      graph.nodes[n].result = 1;
+      stop_graph_node(&graph.nodes[n]);
+    }
+    for (size_t n = 0; n < started; n++) {
+      pthread_join(threads[n], NULL);
+    }
+  }
+
+  for (size_t n = 0; n < graph.node_count; n++) {
+    GraphNode *node = &graph.nodes[n];
+    if (result == 0 && node->result != 0) {
+      result = 1;
+    }
+    if (node->type != NODE_OUTPUT || !node->file || node->result != 0) {
+      continue;
+    }
+    int closed = fclose(node->file) == 0;
+    node->file = NULL;
+    if (!closed) {
+      printf("Error: cannot write output file %s\n", node->temp_filename);
+      remove(node->temp_filename);
+      result = 1;
+    } else if (!commit_output(node->temp_filename, node->filename,
+                              DURABILITY_NONE)) {
+      remove(node->temp_filename);
+      result = 1;
+    } else {
+      printf("Saved %s\n", node->filename);
+    }
+  }
+
+  free_job_graph(&graph);
+  return result;
+}
+
+// --autotune benchmarks block sizes, then fan-out queue depths at the best
+// block size, on a scratch file in a directory of the device to tune. Every
+// pass starts with cold caches and includes syncing what it wrote, so the
+// numbers reflect the device rather than memory.
+#define AUTOTUNE_PASSES 2
+
+const size_t autotune_block_sizes[] = {64 * 1024, 256 * 1024, 1024 * 1024,
+                                       4 * 1024 * 1024, 16 * 1024 * 1024};
+const size_t autotune_queue_depths[] = {2, 4, 8, 16, 32};
+
+#define NUM_AUTOTUNE_BLOCK_SIZES \
+  (sizeof(autotune_block_sizes) / sizeof(autotune_block_sizes[0]))
+#define NUM_AUTOTUNE_QUEUE_DEPTHS \
+  (sizeof(autotune_queue_depths) / sizeof(autotune_queue_depths[0]))
+
+double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Writes back and evicts the cached pages of file, where the OS allows it.
+void drop_cached_pages(FILE *file) {
+  sync_file(file);
+#ifdef __linux__
+  posix_fadvise(fileno(file), 0, 0, POSIX_FADV_DONTNEED);
+#endif
+}
+
+int write_scratch_file(FILE *file, uint64_t size, uint8_t *buffer,
+                       size_t buffer_size) {
+  uint32_t state = 0x2545F491u;
+  while (size > 0) {
+    size_t chunk_size = (size < buffer_size) ? size : buffer_size;
+    for (size_t i = 0; i < chunk_size; i++) {
+      state ^= state << 13;
+      state ^= state >> 17;
+      state ^= state << 5;
+      buffer[i] = (uint8_t)state;
+    }
+    if (fwrite(buffer, 1, chunk_size, file) != chunk_size) {
+      return 0;
+    }
+    size -= chunk_size;
+  }
+  drop_cached_pages(file);
+  return 1;
+}
+
+// Reads, transforms and writes the scratch file in blocks, returning MiB/s
+// or 0 on error.
+double benchmark_block_size(FILE *input, FILE *output, uint64_t size,
+                            size_t block_size) {
+  uint8_t *buffer = (uint8_t *)pool_acquire(block_size);
+  if (!buffer) {
+    return 0;
+  }
+  rewind(input);
+  rewind(output);
+
+  double start = now_seconds();
+  uint64_t remaining = size;
+  while (remaining > 0) {
+    size_t chunk_size = (remaining < block_size) ? remaining : block_size;
+    if (fread(buffer, 1, chunk_size, input) != chunk_size) {
+      break;
+    }
+    apply_xor(buffer, chunk_size, 0x55);
+    if (fwrite(buffer, 1, chunk_size, output) != chunk_size) {
+      break;
+    }
+    remaining -= chunk_size;
+  }
+  drop_cached_pages(output);
+  double elapsed = now_seconds() - start;
+  drop_cached_pages(input);
+
+  pool_release(buffer);
+  if (remaining > 0 || elapsed <= 0) {
+    return 0;
+  }
+  return size / (1024.0 * 1024.0) / elapsed;
+}
+
+typedef struct {
+  FanOutSource *source;
+  size_t consumer;
+  FILE *output;
+  int ok;
+} AutotuneConsumer;
+
+void *autotune_consumer_thread(void *arg) {
+  AutotuneConsumer *consumer = (AutotuneConsumer *)arg;
+  FanOutSource *source = consumer->source;
+  uint8_t *buffer = (uint8_t *)pool_acquire(source->block_size);
+  consumer->ok = buffer != NULL;
+
+  for (uint64_t position = 0; consumer->ok && position < source->data_size;
+       position += source->block_size) {
+    uint64_t remaining = source->data_size - position;
+    size_t size =
+        (remaining < source->block_size) ? remaining : source->block_size;
+    if (!fan_out_read(source, consumer->consumer, position, buffer, size)) {
+      consumer->ok = 0;
+      break;
+    }
+    apply_xor(buffer, size, 0x55);
+    consumer->ok = fwrite(buffer, 1, size, consumer->output) == size;
+  }
+
+  fan_out_detach(source, consumer->consumer);
+  pool_release(buffer);
+  return NULL;
+}
+
+// Renders the scratch file to two outputs through the fan-out ring, the
+// path the queue depth applies to, and returns input MiB/s or 0 on error.
+double benchmark_queue_depth(FILE *input, FILE **outputs, uint64_t size,
+                             size_t block_size, size_t queue_depth) {
+  FanOutSource source;
+  memset(&source, 0, sizeof(source));
+  source.input_file = input;
+  source.data_size = size;
+  source.block_size = block_size;
+  source.slot_count = queue_depth;
+  source.quiet = 1;
+  uint64_t consumed[2] = {0, 0};
+  source.consumed = consumed;
+  source.consumer_count = 2;
+  pthread_mutex_init(&source.lock, NULL);
+  pthread_cond_init(&source.changed, NULL);
+
+  int ok = 1;
+  for (size_t s = 0; s < queue_depth && ok; s++) {
+    source.slots[s] = (uint8_t *)pool_acquire(block_size);
+    ok = source.slots[s] != NULL;
+  }
+  rewind(input);
+
+  AutotuneConsumer consumers[2];
+  pthread_t threads[2];
+  size_t started = 0;
+  double start = now_seconds();
+  for (; ok && started < 2; started++) {
+    rewind(outputs[started]);
+    consumers[started].source = &source;
+    consumers[started].consumer = started;
+    consumers[started].output = outputs[started];
+    if (pthread_create(&threads[started], NULL, autotune_consumer_thread,
+                       &consumers[started]) != 0) {
+      ok = 0;
+      break;
+    }
+  }
+  for (size_t c = started; c < 2; c++) {
+    fan_out_detach(&source, c);
+  }
+  if (ok && !fan_out_fill(&source)) {
+    ok = 0;
+  }
+  for (size_t c = 0; c < started; c++) {
+    pthread_join(threads[c], NULL);
+    ok = ok && consumers[c].ok;
+    drop_cached_pages(outputs[c]);
+  }
+  double elapsed = now_seconds() - start;
+  drop_cached_pages(input);
+
+  for (size_t s = 0; s < queue_depth; s++) {
+    pool_release(source.slots[s]);
+  }
+  pthread_mutex_destroy(&source.lock);
+  pthread_cond_destroy(&source.changed);
+  if (!ok || elapsed <= 0) {
+    return 0;
+  }
+  return size / (1024.0 * 1024.0) / elapsed;
+}
+
+int run_autotune(const char *dir, double megabytes) {
+  unsigned long long device;
+  if (!device_of(dir, &device)) {
+    printf("Error: cannot stat %s\n", dir);
+    return 1;
+  }
+  uint64_t size = (uint64_t)(megabytes * 1024 * 1024);
+  if (size < MAX_BLOCK_SIZE) {
+    printf("Error: the scratch file must be at least %d MB\n",
+           MAX_BLOCK_SIZE / (1024 * 1024));
+    return 1;
+  }
+
+  char filenames[3][4096];
+  FILE *files[3] = {NULL, NULL, NULL};
+  const char *suffixes[3] = {"in", "out0", "out1"};
+  int result = 1;
+  for (int f = 0; f < 3; f++) {
+    snprintf(filenames[f], sizeof(filenames[f]),
+             "%s/.soundbadizer-autotune.%s", dir, suffixes[f]);
+    files[f] = fopen(filenames[f], f == 0 ? "w+b" : "wb");
+    if (!files[f]) {
+      printf("Error: cannot create scratch file %s\n", filenames[f]);
+      goto done;
+    }
+  }
+
+  uint8_t *buffer = (uint8_t *)pool_acquire(io_tuning.block_size);
+  int written = buffer && write_scratch_file(files[0], size, buffer,
+                                             io_tuning.block_size);
+  pool_release(buffer);
+  if (!written) {
+    printf("Error: cannot write scratch file %s\n", filenames[0]);
+    goto done;
+  }
+
+  printf("Tuning device %llx with %.0f MB of scratch data\n", device,
+         megabytes);
+  IoTuning best = io_tuning;
+  double best_rate = 0;
+  for (size_t i = 0; i < NUM_AUTOTUNE_BLOCK_SIZES; i++) {
+    double rate = 0;
+    for (int pass = 0; pass < AUTOTUNE_PASSES; pass++) {
+      double pass_rate = benchmark_block_size(files[0], files[1], size,
+                                              autotune_block_sizes[i]);
+      if (pass_rate > rate) {
+        rate = pass_rate;
+      }
+    }
+    printf("  block size %6zu KiB: %8.1f MiB/s\n",
+           autotune_block_sizes[i] / 1024, rate);
+    if (rate > best_rate) {
+      best_rate = rate;
+      best.block_size = autotune_block_sizes[i];
+    }
+  }
+
+  best_rate = 0;
+  for (size_t i = 0; i < NUM_AUTOTUNE_QUEUE_DEPTHS; i++) {
+    double rate = 0;
+    for (int pass = 0; pass < AUTOTUNE_PASSES; pass++) {
+      double pass_rate =
+          benchmark_queue_depth(files[0], &files[1], size, best.block_size,
+                                autotune_queue_depths[i]);
+      if (pass_rate > rate) {
+        rate = pass_rate;
+      }
+    }
+    printf("  queue depth %2zu:       %8.1f MiB/s\n",
+           autotune_queue_depths[i], rate);
+    if (rate > best_rate) {
+      best_rate = rate;
+      best.queue_depth = autotune_queue_depths[i];
+    }
+  }
+
+  if (best_rate == 0) {
+    printf("Error: benchmark failed\n");
+    goto done;
+  }
+  printf("Best: %zu KiB blocks, queue depth %zu\n", best.block_size / 1024,
+         best.queue_depth);
+  if (save_tuning(device, &best)) {
+    result = 0;
+  }
+
+done:
+  for (int f = 0; f < 3; f++) {
+    if (files[f]) {
+      fclose(files[f]);
+      remove(filenames[f]);
+    }
+  }
+  return result;
+}
+
+int add_variant(Variant **variants, size_t *count, const char *filename,
+                size_t filename_length, const OpChain *chain) {
+  Variant *grown =
+      (Variant *)realloc(*variants, (*count + 1) * sizeof(Variant));
+  if (!grown) {
+    return 0;
+  }
+  *variants = grown;
+  Variant *variant = &grown[*count];
+  variant->output_filename = (char *)malloc(filename_length + 1);
+  if (!variant->output_filename) {
+    return 0;
+  }
+  memcpy(variant->output_filename, filename, filename_length);
+  variant->output_filename[filename_length] = '\0';
+  variant->chain = *chain;
+  (*count)++;
+  return 1;
+}
+
+// Follow mode processes a WAV that is still being recorded, like tail -f.
+// The data chunk is taken to run to the end of the file, since recorders
+// only finalize its size when they stop, and every time the file grows the
+// new whole frames go through the chain and are appended to the output,
+// whose RIFF and data sizes are patched after each batch. The output is
+// written in place so readers can use it while it grows. Once the recorder
+// rewrites the input's data size that size is trusted, and following stops
+// when it is reached or when the input has not grown for follow_idle
+// seconds. On Linux inotify wakes us on writes; elsewhere, and as a
+// fallback, the input is polled.
+#define FOLLOW_POLL_MS 500
+
+typedef struct {
+  int fd;
+  int watch;
+} FollowWatch;
+
+void open_follow_watch(FollowWatch *watch, const char *filename) {
+  watch->fd = -1;
+#ifdef __linux__
+  watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (watch->fd >= 0) {
+    watch->watch = inotify_add_watch(watch->fd, filename,
+                                     IN_MODIFY | IN_CLOSE_WRITE);
+    if (watch->watch < 0) {
+      close(watch->fd);
+      watch->fd = -1;
+    }
+  }
+#else
+  (void)filename;
+#endif
+}
+
+void close_follow_watch(FollowWatch *watch) {
+#ifdef __linux__
+  if (watch->fd >= 0) {
+    close(watch->fd);
+  }
+#else
+  (void)watch;
+#endif
+}
+
+// Sleeps until the input is written to or for at most milliseconds.
+void wait_for_input(FollowWatch *watch, int milliseconds) {
+#ifdef __linux__
+  if (watch->fd >= 0) {
+    struct pollfd pfd = {watch->fd, POLLIN, 0};
+    if (poll(&pfd, 1, milliseconds) > 0) {
+      char events[4096];
+      while (read(watch->fd, events, sizeof(events)) > 0) {
+      }
+    }
+    return;
+  }
+#else
+  (void)watch;
+#endif
+  struct timespec delay = {milliseconds / 1000,
+                           (milliseconds % 1000) * 1000000L};
+  nanosleep(&delay, NULL);
+}
+
+// Reads the input's current data size field, leaving the file position
+// where it was.
+int read_data_size_field(FILE *input_file, long data_offset,
+                         uint32_t *data_size) {
+  uint64_t position = ftello(input_file);
+  int ok = seek_file(input_file, data_offset - 4) == 0 &&
+           fread(data_size, sizeof(*data_size), 1, input_file) == 1;
+  return seek_file(input_file, position) == 0 && ok;
+}
+
+// Whole frames of the input that can be processed now.
+uint64_t followed_data_size(FILE *input_file, long data_offset,
+                            const WavFmtData *fmtData,
+                            uint32_t initial_field) {
+  struct stat info;
+  if (fstat(fileno(input_file), &info) != 0 ||
+      (uint64_t)info.st_size < (uint64_t)data_offset) {
+    return 0;
+  }
+  uint64_t size = info.st_size - data_offset;
+
+  uint32_t field;
+  if (read_data_size_field(input_file, data_offset, &field) &&
+      field != initial_field && field != 0 && field != UINT32_MAX &&
+      field <= size) {
+    size = field;
+  }
+  if (size > UINT32_MAX - (uint64_t)data_offset) {
+    size = UINT32_MAX - (uint64_t)data_offset;
+  }
+  return size - size % fmtData->blockAlign;
+}
+
+// Points the output header at the data written so far.
+int patch_output_sizes(FILE *output_file, long data_offset,
+                       uint32_t data_size) {
+  uint32_t riff_size = (uint32_t)(data_offset - 8) + data_size;
+  uint64_t position = ftello(output_file);
+  int ok = seek_file(output_file, 4) == 0 &&
+           fwrite(&riff_size, sizeof(riff_size), 1, output_file) == 1 &&
+           seek_file(output_file, data_offset - 4) == 0 &&
+           fwrite(&data_size, sizeof(data_size), 1, output_file) == 1;
+  return seek_file(output_file, position) == 0 && ok &&
+         fflush(output_file) == 0;
+}
+
+int follow_wav_file(const char *input_filename, const char *output_filename,
+                    const OpChain *chain, const ProcessOptions *options) {
+  FILE *input_file;
+  WavFmtData fmtData;
+  uint32_t data_size;
+  long data_offset;
+  if (!open_wav_input(input_filename, &input_file, &fmtData, &data_size,
+                      &data_offset)) {
+    return 1;
+  }
+
+  uint8_t *header_buffer = read_wav_header(input_file, data_offset);
+  if (!header_buffer) {
+    fclose(input_file);
+    return 1;
+  }
+
+  uint32_t initial_field = data_size;
+  uint64_t available =
+      followed_data_size(input_file, data_offset, &fmtData, initial_field);
+
+  OutputJob job;
+  int ok = begin_output_job(&job, output_filename, input_file, header_buffer,
+                            data_offset, &fmtData, (uint32_t)available, chain,
+                            options);
+  pool_release(header_buffer);
+
+  FollowWatch watch;
+  open_follow_watch(&watch, input_filename);
+  RenderContext *ctx = &job.ctx;
+  double idle_since = now_seconds();
+
+  // One plan for the whole run, so frame op state such as decimate's held
+  // frame carries across batches. The short-circuits are left out since they
+  // would be checked again for every batch.
+  RenderPlan plan = {NULL, 0};
+  if (ok && !build_render_plan(chain, options, &ctx->pcm_fmt, &plan)) {
+    printf("Error: cannot allocate channel tables\n");
+    job.result = 1;
+  }
+  if (ok && job.result == 0 &&
+      !patch_output_sizes(ctx->output_file, data_offset, 0)) {
+    printf("Error: cannot update output header\n");
+    job.result = 1;
+  }
+  if (ok) {
+    printf("Following %s, stopping after %.0f s without new audio\n",
+           input_filename, options->follow_idle);
+  }
+  while (ok && job.result == 0) {
+    if (available > ctx->position) {
+      ctx->data_size = (uint32_t)available;
+      clearerr(input_file);
+      job.result = transform_with_plan(ctx, available - ctx->position,
+                                       chain, &plan, 0);
+      if (job.result == 0 &&
+          !patch_output_sizes(ctx->output_file, data_offset,
+                              (uint32_t)output_bytes(ctx, ctx->position))) {
+        printf("\nError: cannot update output header\n");
+        job.result = 1;
+      }
+      idle_since = now_seconds();
+    }
+
+    uint32_t field;
+    if (read_data_size_field(input_file, data_offset, &field) &&
+        field != initial_field && field != 0 && field != UINT32_MAX &&
+        ctx->position >= field - field % fmtData.blockAlign) {
+      break;
+    }
+
+    double idle = now_seconds() - idle_since;
+    if (idle >= options->follow_idle) {
+      break;
+    }
+    double wait_ms = (options->follow_idle - idle) * 1000;
+    wait_for_input(&watch, wait_ms < FOLLOW_POLL_MS ? (int)wait_ms + 1
+                                                    : FOLLOW_POLL_MS);
+    available =
+        followed_data_size(input_file, data_offset, &fmtData, initial_field);
+  }
+  printf("\n");
+
+  free_render_plan(&plan);
+  close_follow_watch(&watch);
+  int result = finish_output_job(&job, input_filename, options);
+  fclose(input_file);
+  return result;
+}
+
+// Parses "OUTPUT=CHAIN".
+int parse_variant(const char *spec, Variant **variants, size_t *count) {
+  const char *equals = strchr(spec, '=');
+  OpChain chain;
+  if (!equals || equals == spec || !parse_op_chain(equals + 1, &chain)) {
+    return 0;
+  }
+  return add_variant(variants, count, spec, equals - spec, &chain);
+}
+
+// Parses "OP:FROM:TO" into one variant per value, named after the main
+// output with the op and value appended, e.g. out_right3.wav.
+int parse_sweep(const char *spec, const char *output_filename,
+                Variant **variants, size_t *count) {
+  char name[32];
+  int from;
+  int to;
+  if (sscanf(spec, "%31[^:]:%d:%d", name, &from, &to) != 3) {
+    return 0;
+  }
+  const OperationInfo *info = find_operation(name);
+  if (!info || !info->takes_value || info->parse_value || from > to ||
+      from < info->min_value || to > info->max_value) {
+    return 0;
+  }
+
+  const char *slash = strrchr(output_filename, '/');
+  const char *dot = strrchr(output_filename, '.');
+  if (!dot || (slash && dot < slash)) {
+    dot = output_filename + strlen(output_filename);
+  }
+
+  for (int value = from; value <= to; value++) {
+    char filename[4096];
+    int length = snprintf(filename, sizeof(filename), "%.*s_%s%d%s",
+                          (int)(dot - output_filename), output_filename,
+                          info->name, value, dot);
+    OpChain chain;
+    chain.count = 1;
+    chain.ops[0].info = info;
+    chain.ops[0].value = value;
+    if (length < 0 || (size_t)length >= sizeof(filename) ||
+        !add_variant(variants, count, filename, length, &chain)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int main(int argc, char *argv[]) {
+#ifdef _WIN32
+  _setmode(_fileno(stdin), _O_BINARY);
+  _setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+  if (argc >= 3 && argc <= 4 && strcmp(argv[1], "--autotune") == 0) {
+    return run_autotune(argv[2], argc > 3 ? atof(argv[3]) : 256);
+  }
+
+  if (argc == 3 && strcmp(argv[1], "--graph") == 0) {
+    if (load_tuning(argv[2], &io_tuning)) {
+      printf("Tuning: %zu KiB blocks, queue depth %zu\n",
+             io_tuning.block_size / 1024, io_tuning.queue_depth);
+    }
+    int result = run_job_graph(argv[2]);
+    printf(result == 0 ? "Done!\n" : "Error processing graph\n");
+    return result;
+  }
+
+  if (argc < 4) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  const char *input_filename = argv[1];
+  const char *output_filename = argv[2];
+  const char *operation = argv[3];
+  const char *value_arg = NULL;
+  int value = 0;
+  int argi = 4;
+  int pool_stats = 0;
+  size_t block_size = 0;
+  size_t queue_depth = 0;
+  Variant *variants = NULL;
+  size_t variant_count = 0;
+
+  OpChain chain;
+  ProcessOptions options;
+  options.start_time = -1;
+  options.end_time = -1;
+  options.regions_filename = NULL;
+  memset(options.channel_chain_set, 0, sizeof(options.channel_chain_set));
+  options.automation.type = ENVELOPE_NONE;
+  options.automation.points = NULL;
+  options.checksum = 0;
+  options.checksum_json = NULL;
+  options.checksum_input = 0;
+  options.analyze = 0;
+  options.journal_filename = NULL;
+  options.durability = DURABILITY_NONE;
+  options.streaming = 0;
+  options.direct_io = 0;
+  options.glitch.type = GLITCH_NONE;
+  options.combine.type = COMBINE_NONE;
+  options.combine.length = LENGTH_FIRST;
+  options.combine.count = 0;
+  CombineType combine_type = COMBINE_XOR;
+  memset(&options.output, 0, sizeof(options.output));
+  options.follow = 0;
+  options.follow_idle = 10;
+  options.auto_gain = 0;
+  options.auto_gain_db = 0;
+
+  if (strcmp(operation, "--chain") == 0 || strcmp(operation, "-c") == 0) {
+    if (argc < 5 || !parse_op_chain(argv[4], &chain)) {
+      printf("Error: invalid op chain\n");
+      return 1;
+    }
+    value_arg = argv[4];
+    argi = 5;
+  } else {
+    const OperationInfo *info = find_operation(operation);
+    if (!info) {
+      print_usage(argv[0]);
+      return 1;
+    }
+
+    if (argc > 4 && (info->takes_value || argv[4][0] != '-')) {
+      value_arg = argv[4];
+      argi = 5;
+      if (info->parse_value && !parse_op_value(info, argv[4], &value)) {
+        printf("Error: invalid value for %s\n", operation);
+        return 1;
+      } else if (!info->parse_value) {
+        value = atoi(argv[4]);
+      }
+    } else if (info->takes_value) {
+      print_usage(argv[0]);
+      return 1;
+    }
+
+    if (info->takes_value && !info->parse_value &&
+        (value < info->min_value || value > info->max_value)) {
+      if (info->max_value == 7 && info->kernel != apply_bit_plane) {
+        printf("Error: shift value must be in range 0-7\n");
+      } else if (info->max_value == 255) {
+        printf("Error: operation value must be in range 0-255\n");
+      } else {
+        printf("Error: %s value must be in range %d-%d\n", info->name,
+               info->min_value, info->max_value);
+      }
+      return 1;
+    }
+
+    chain.count = 1;
+    chain.ops[0].info = info;
+    chain.ops[0].value = value;
+  }
+
+  for (; argi < argc; argi++) {
+    if (strcmp(argv[argi], "--start") == 0 && argi + 1 < argc) {
+      options.start_time = atof(argv[++argi]);
+    } else if (strcmp(argv[argi], "--end") == 0 && argi + 1 < argc) {
+      options.end_time = atof(argv[++argi]);
+    } else if (strcmp(argv[argi], "--regions") == 0 && argi + 1 < argc) {
+      options.regions_filename = argv[++argi];
+    } else if (strcmp(argv[argi], "--channel") == 0 && argi + 1 < argc) {
+      char *spec;
+      long channel = strtol(argv[++argi], &spec, 10);
+      if (*spec != ':' || channel < 0 || channel >= MAX_CHANNELS ||
+          !parse_op_chain(spec + 1, &options.channel_chains[channel])) {
+        printf("Error: invalid channel chain %s\n", argv[argi]);
+        return 1;
+      }
+      options.channel_chain_set[channel] = 1;
+    } else if (strcmp(argv[argi], "--huge-pages") == 0) {
+      buffer_pool.huge_pages = 1;
+    } else if (strcmp(argv[argi], "--memory-budget") == 0 && argi + 1 < argc) {
+      buffer_pool.budget = (size_t)(atof(argv[++argi]) * 1024 * 1024);
+    } else if (strcmp(argv[argi], "--block-size") == 0 && argi + 1 < argc) {
+      block_size = (size_t)atol(argv[++argi]) * 1024;
+      if (!valid_tuning(block_size, io_tuning.queue_depth)) {
+        printf("Error: block size must be in range %d-%d KiB\n",
+               MIN_BLOCK_SIZE / 1024, MAX_BLOCK_SIZE / 1024);
+        return 1;
+      }
+    } else if (strcmp(argv[argi], "--queue-depth") == 0 && argi + 1 < argc) {
+      queue_depth = (size_t)atol(argv[++argi]);
+      if (!valid_tuning(io_tuning.block_size, queue_depth)) {
+        printf("Error: queue depth must be in range 2-%d\n",
+               MAX_FAN_OUT_SLOTS);
+        return 1;
+      }
+    } else if (strcmp(argv[argi], "--pool-stats") == 0) {
+      pool_stats = 1;
+    } else if (strcmp(argv[argi], "--journal") == 0 && argi + 1 < argc) {
+      options.journal_filename = argv[++argi];
+    } else if (strcmp(argv[argi], "--durability") == 0 && argi + 1 < argc) {
+      if (!parse_durability(argv[++argi], &options.durability)) {
+        printf("Error: durability must be none, data or full\n");
+        return 1;
+      }
+    } else if (strcmp(argv[argi], "--variant") == 0 && argi + 1 < argc) {
+      if (!parse_variant(argv[++argi], &variants, &variant_count)) {
+        printf("Error: invalid variant %s\n", argv[argi]);
+        return 1;
+      }
+    } else if (strcmp(argv[argi], "--sweep") == 0 && argi + 1 < argc) {
+      if (!parse_sweep(argv[++argi], output_filename, &variants,
+                       &variant_count)) {
+        printf("Error: invalid sweep %s\n", argv[argi]);
+        return 1;
+      }
+    } else if (strcmp(argv[argi], "--stream") == 0) {
+      options.streaming = 1;
+    } else if (strcmp(argv[argi], "--direct") == 0) {
+#ifdef __linux__
+      options.streaming = 1;
+      options.direct_io = 1;
+#else
+      printf("Error: --direct is only supported on Linux\n");
+      return 1;
+#endif
+    } else if (strcmp(argv[argi], "--glitch") == 0 && argi + 1 < argc) {
+      if (!parse_glitch(argv[++argi], &options.glitch)) {
+        printf("Error: invalid glitch %s\n", argv[argi]);
+        return 1;
+      }
+    } else if (strcmp(argv[argi], "--with") == 0 && argi + 1 < argc) {
+      if (options.combine.count == MAX_COMBINE_INPUTS) {
+        printf("Error: at most %d --with inputs\n", MAX_COMBINE_INPUTS);
+        return 1;
+      }
+      options.combine.filenames[options.combine.count++] = argv[++argi];
+    } else if (strcmp(argv[argi], "--combine") == 0 && argi + 1 < argc) {
+      if (!parse_combine(argv[++argi], &combine_type)) {
+        printf("Error: combine must be xor, and, or or mix\n");
+        return 1;
+      }
+    } else if (strcmp(argv[argi], "--length") == 0 && argi + 1 < argc) {
+      if (!parse_length_rule(argv[++argi], &options.combine.length)) {
+        printf("Error: length must be first, shortest or longest\n");
+        return 1;
+      }
+    } else if (strcmp(argv[argi], "--out-format") == 0 && argi + 1 < argc) {
+      if (!parse_out_format(argv[++argi], &options.output)) {
+        printf("Error: output format must be u8, s8, u16 or s16\n");
+        return 1;
+      }
+    } else if (strcmp(argv[argi], "--mono") == 0) {
+      options.output.mono = 1;
+    } else if (strcmp(argv[argi], "--follow") == 0) {
+      options.follow = 1;
+    } else if (strcmp(argv[argi], "--follow-idle") == 0 && argi + 1 < argc) {
+      options.follow = 1;
+      options.follow_idle = atof(argv[++argi]);
+    } else if (strcmp(argv[argi], "--auto-gain") == 0 && argi + 1 < argc) {
+      options.auto_gain = 1;
+      options.auto_gain_db = atof(argv[++argi]);
+      if (options.auto_gain_db > 0) {
+        printf("Error: auto-gain target must be 0 dBFS or below\n");
+        return 1;
+      }
+    } else if (strcmp(argv[argi], "--analyze") == 0) {
+      options.analyze = 1;
+    } else if (strcmp(argv[argi], "--checksum") == 0) {
+      options.checksum = 1;
+    } else if (strcmp(argv[argi], "--checksum-json") == 0 &&
+               argi + 1 < argc) {
+      options.checksum_json = argv[++argi];
+    } else if (strcmp(argv[argi], "--checksum-input") == 0) {
+      options.checksum_input = 1;
+    } else if (strcmp(argv[argi], "--automate") == 0 && argi + 1 < argc) {
+      if (!parse_envelope(argv[++argi], &options.automation)) {
+        printf("Error: invalid envelope %s\n", argv[argi]);
+        return 1;
+      }
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (load_tuning(input_filename, &io_tuning)) {
+    printf("Tuning: %zu KiB blocks, queue depth %zu\n",
+           io_tuning.block_size / 1024, io_tuning.queue_depth);
+  }
+  if (block_size) {
+    io_tuning.block_size = block_size;
+  }
+  if (queue_depth) {
+    io_tuning.queue_depth = queue_depth;
+  }
+
+  printf("Operation: %s", operation);
+  if (value_arg) {
+    printf(" with value %s", value_arg);
+  }
+  printf("\n");
+
+  if (options.glitch.type != GLITCH_NONE &&
+      (options.streaming || options.checksum_input)) {
+    printf("Error: --glitch cannot be combined with --stream, --direct or "
+           "--checksum-input\n");
+    return 1;
+  }
+
+  if (options.combine.count > 0) {
+    options.combine.type = combine_type;
+    if (options.glitch.type != GLITCH_NONE || options.checksum_input ||
+        variant_count > 0) {
+      printf("Error: --with cannot be combined with --glitch, "
+             "--checksum-input, --variant or --sweep\n");
+      return 1;
+    }
+  }
+
+  if ((options.output.bits || options.output.mono) &&
+      options.journal_filename) {
+    printf("Error: --out-format and --mono cannot be combined with "
+           "--journal\n");
+    return 1;
+  }
+
+  if (options.auto_gain &&
+      (variant_count > 0 || options.analyze || options.follow ||
+       options.journal_filename || options.streaming ||
+       options.regions_filename || options.start_time >= 0 ||
+       options.end_time >= 0 || options.automation.type != ENVELOPE_NONE)) {
+    printf("Error: --auto-gain only supports whole file renders without "
+           "--variant, --sweep, --analyze, --follow, --journal, --stream, "
+           "--direct or --automate\n");
+    return 1;
+  }
+
+  if (options.follow &&
+      (variant_count > 0 || options.analyze || options.journal_filename ||
+       options.checksum || options.checksum_json || options.streaming ||
+       options.glitch.type != GLITCH_NONE || options.combine.count > 0 ||
+       options.regions_filename || options.start_time >= 0 ||
+       options.end_time >= 0 || options.automation.type != ENVELOPE_NONE)) {
+    printf("Error: --follow only supports whole file chains, --channel and "
+           "--out-format/--mono\n");
+    return 1;
+  }
+
+  int result;
+  if (options.follow) {
+    result =
+        follow_wav_file(input_filename, output_filename, &chain, &options);
+  } else if (variant_count > 0) {
+    if (options.analyze || options.journal_filename ||
+        options.checksum_json) {
+      printf("Error: --variant and --sweep cannot be combined with "
+             "--analyze, --journal or --checksum-json\n");
+      result = 1;
+    } else if (!add_variant(&variants, &variant_count, output_filename,
+                            strlen(output_filename), &chain)) {
+      printf("Error: cannot allocate variants\n");
+      result = 1;
+    } else {
+      result = process_fan_out(input_filename, variants, variant_count,
+                               &options);
+    }
+  } else {
+    result =
+        process_wav_file(input_filename, output_filename, &chain, &options);
+  }
+
+  for (size_t v = 0; v < variant_count; v++) {
+    free(variants[v].output_filename);
+  }
+  free(variants);
+
+  free(options.automation.points);
+
+  if (pool_stats) {
+    print_pool_stats();
+  }
+
+  if (result == 0 && (options.analyze || variant_count > 0)) {
+    printf("Done!\n");
+  } else if (result == 0) {
     printf("Done! Result saved to %s\n", output_filename);
   } else {
     printf("Error processing file\n");
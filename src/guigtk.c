@@ -1,4 +1,6 @@
+#include <glib/gstdio.h>
 #include <gtk/gtk.h>
+#include <math.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -7,6 +9,11 @@
 #ifdef _WIN32
 #include <fcntl.h>
 #include <io.h>
+#include <malloc.h>
+#endif
+
+#ifdef __linux__
+#include <sys/mman.h>
 #endif
 
 #pragma pack(push, 1)
@@ -51,6 +58,8 @@ typedef struct {
   gchar *output_filename;
   gchar *operation;
   gint value;
+  gint *values;
+  gint value_count;
   GtkProgressBar *progress_bar;
   GtkLabel *status_label;
   GtkWidget *process_button;
@@ -64,9 +73,12 @@ typedef struct {
   GtkWidget *value_spin;
   GtkWidget *value_label;
   GtkWidget *process_button;
+  GtkWidget *variations_entry;
+  GtkWidget *variations_button;
   GtkWidget *progress_bar;
   GtkWidget *status_label;
   GtkWidget *file_info_label;
+  GtkWidget *spectrum_button;
 } AppWidgets;
 
 void apply_right_shift(uint8_t *data, size_t size, int shift) {
@@ -105,6 +117,139 @@ void apply_xor(uint8_t *data, size_t size, int value) {
   }
 }
 
+void apply_rotate_left(uint8_t *data, size_t size, int value) {
+  int shift = value & 7;
+  for (size_t i = 0; i < size; i++) {
+    data[i] = (uint8_t)((data[i] << shift) | (data[i] >> ((8 - shift) & 7)));
+  }
+}
+
+void apply_rotate_right(uint8_t *data, size_t size, int value) {
+  int shift = value & 7;
+  for (size_t i = 0; i < size; i++) {
+    data[i] = (uint8_t)((data[i] >> shift) | (data[i] << ((8 - shift) & 7)));
+  }
+}
+
+void apply_bit_reverse(uint8_t *data, size_t size, int value) {
+  for (size_t i = 0; i < size; i++) {
+    uint8_t b = data[i];
+    b = (uint8_t)((b >> 4) | (b << 4));
+    b = (uint8_t)(((b & 0xCC) >> 2) | ((b & 0x33) << 2));
+    data[i] = (uint8_t)(((b & 0xAA) >> 1) | ((b & 0x55) << 1));
+  }
+}
+
+void apply_nibble_swap(uint8_t *data, size_t size, int value) {
+  for (size_t i = 0; i < size; i++) {
+    data[i] = (uint8_t)((data[i] >> 4) | (data[i] << 4));
+  }
+}
+
+void apply_gray_encode(uint8_t *data, size_t size, int value) {
+  for (size_t i = 0; i < size; i++) {
+    data[i] ^= data[i] >> 1;
+  }
+}
+
+void apply_gray_decode(uint8_t *data, size_t size, int value) {
+  for (size_t i = 0; i < size; i++) {
+    uint8_t b = data[i];
+    b ^= b >> 1;
+    b ^= b >> 2;
+    data[i] = b ^ (b >> 4);
+  }
+}
+
+// Keeps bit plane value (0 the least significant) as a full scale signal:
+// 0xFF where the bit is set, 0 elsewhere.
+void apply_bit_plane(uint8_t *data, size_t size, int value) {
+  for (size_t i = 0; i < size; i++) {
+    data[i] = (uint8_t)(0 - ((data[i] >> value) & 1));
+  }
+}
+
+typedef void (*ByteOpKernel)(uint8_t *data, size_t size, int value);
+
+// Operations offered in operation_combo, in order. max_value is 0 for ops
+// that take no value.
+typedef struct {
+  const char *name;
+  ByteOpKernel kernel;
+  int max_value;
+  const char *value_label;
+} GuiOperation;
+
+const GuiOperation gui_operations[] = {
+    {"right", apply_right_shift, 7, "Shift value (0-7):"},
+    {"left", apply_left_shift, 7, "Shift value (0-7):"},
+    {"not", apply_not, 0, NULL},
+    {"and", apply_and, 255, "Value (0-255):"},
+    {"or", apply_or, 255, "Value (0-255):"},
+    {"xor", apply_xor, 255, "Value (0-255):"},
+    {"rotl", apply_rotate_left, 7, "Rotate by (0-7):"},
+    {"rotr", apply_rotate_right, 7, "Rotate by (0-7):"},
+    {"bitrev", apply_bit_reverse, 0, NULL},
+    {"swap", apply_nibble_swap, 0, NULL},
+    {"gray", apply_gray_encode, 0, NULL},
+    {"ungray", apply_gray_decode, 0, NULL},
+    {"plane", apply_bit_plane, 7, "Bit plane (0-7):"},
+};
+
+#define NUM_GUI_OPERATIONS (sizeof(gui_operations) / sizeof(gui_operations[0]))
+
+const GuiOperation *find_gui_operation(const gchar *name) {
+  for (size_t i = 0; i < NUM_GUI_OPERATIONS; i++) {
+    if (g_strcmp0(name, gui_operations[i].name) == 0) {
+      return &gui_operations[i];
+    }
+  }
+  return NULL;
+}
+
+void apply_operation(const gchar *operation, uint8_t *data, size_t size,
+                     int value) {
+  const GuiOperation *info = find_gui_operation(operation);
+  if (info) {
+    info->kernel(data, size, value);
+  }
+}
+
+// Block size saved by the console's --autotune for the device holding
+// filename, or 1 MiB when that device was never tuned.
+size_t tuned_block_size(const gchar *filename) {
+  size_t block_size = 1024 * 1024;
+  GStatBuf info;
+  if (g_stat(filename, &info) != 0) {
+    return block_size;
+  }
+
+  const gchar *path = g_getenv("SOUNDBADIZER_TUNING");
+  gchar *tuning_path =
+      path ? g_strdup(path)
+           : g_build_filename(g_get_user_config_dir(), "soundbadizer-tuning",
+                              NULL);
+  FILE *file = fopen(tuning_path, "r");
+  g_free(tuning_path);
+  if (!file) {
+    return block_size;
+  }
+
+  char line[256];
+  while (fgets(line, sizeof(line), file)) {
+    unsigned long long device;
+    size_t line_block_size;
+    if (sscanf(line, "%llx %zu", &device, &line_block_size) == 2 &&
+        device == (unsigned long long)info.st_dev &&
+        line_block_size >= 64 * 1024 && line_block_size <= 64 * 1024 * 1024) {
+      block_size = line_block_size;
+      break;
+    }
+  }
+  fclose(file);
+  return block_size;
+}
+
 int parse_wav_file(FILE *file, WavFmtData *fmtData, uint32_t *data_size,
                    long *data_offset) {
   WavRiffHeader riffHeader;
@@ -145,6 +290,191 @@ int parse_wav_file(FILE *file, WavFmtData *fmtData, uint32_t *data_size,
   return (fmt_found && data_found);
 }
 
+// Work and header buffers come from an application wide pool of 64-byte aligned
+// blocks in power of two size classes. Released blocks are cached for the
+// next job instead of going back to the allocator. With huge pages enabled,
+// blocks of 2 MiB and up are backed by MAP_HUGETLB when available and by
+// transparent huge pages otherwise. budget caps the bytes the pool holds
+// (in use plus cached), 0 means unlimited.
+#define POOL_ALIGNMENT 64
+#define POOL_MIN_BLOCK 4096
+#define POOL_CLASSES 24
+#define POOL_HUGE_PAGE (2 * 1024 * 1024)
+
+typedef struct PoolBlock {
+  struct PoolBlock *next;
+  void *data;
+  size_t size;
+  int size_class;
+  int mapped;
+} PoolBlock;
+
+typedef struct {
+  PoolBlock *free_lists[POOL_CLASSES];
+  PoolBlock *live;
+  size_t budget;
+  int huge_pages;
+  size_t in_use;
+  size_t cached;
+  size_t peak;
+  uint64_t hits;
+  uint64_t misses;
+  GMutex lock;
+} BufferPool;
+
+BufferPool buffer_pool;
+
+void pool_free_block(PoolBlock *block) {
+#ifdef __linux__
+  if (block->mapped) {
+    munmap(block->data, block->size);
+    free(block);
+    return;
+  }
+#endif
+#ifdef _WIN32
+  _aligned_free(block->data);
+#else
+  free(block->data);
+#endif
+  free(block);
+}
+
+// Drops cached blocks, largest first, until need more bytes fit the budget.
+void pool_make_room(size_t need) {
+  for (int c = POOL_CLASSES - 1; c >= 0; c--) {
+    while (buffer_pool.free_lists[c] &&
+           buffer_pool.in_use + buffer_pool.cached + need >
+               buffer_pool.budget) {
+      PoolBlock *block = buffer_pool.free_lists[c];
+      buffer_pool.free_lists[c] = block->next;
+      buffer_pool.cached -= block->size;
+      pool_free_block(block);
+    }
+  }
+}
+
+PoolBlock *pool_allocate_block(size_t size) {
+  PoolBlock *block = (PoolBlock *)calloc(1, sizeof(PoolBlock));
+  if (!block) {
+    return NULL;
+  }
+  block->size = size;
+
+#ifdef __linux__
+  if (buffer_pool.huge_pages && size >= POOL_HUGE_PAGE) {
+    block->data = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (block->data == MAP_FAILED) {
+      block->data = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (block->data != MAP_FAILED) {
+        madvise(block->data, size, MADV_HUGEPAGE);
+      }
+    }
+    if (block->data != MAP_FAILED) {
+      block->mapped = 1;
+      return block;
+    }
+    block->data = NULL;
+  }
+#endif
+
+#ifdef _WIN32
+  block->data = _aligned_malloc(size, POOL_ALIGNMENT);
+#else
+  if (posix_memalign(&block->data, POOL_ALIGNMENT, size) != 0) {
+    block->data = NULL;
+  }
+#endif
+  if (!block->data) {
+    free(block);
+    return NULL;
+  }
+  return block;
+}
+
+void *pool_acquire(size_t size) {
+  int size_class = 0;
+  size_t class_size = POOL_MIN_BLOCK;
+  while (class_size < size) {
+    class_size <<= 1;
+    size_class++;
+  }
+  if (size_class >= POOL_CLASSES) {
+    return NULL;
+  }
+
+  g_mutex_lock(&buffer_pool.lock);
+
+  PoolBlock *block = buffer_pool.free_lists[size_class];
+  if (block) {
+    buffer_pool.free_lists[size_class] = block->next;
+    buffer_pool.cached -= block->size;
+    buffer_pool.hits++;
+  } else {
+    if (buffer_pool.budget) {
+      pool_make_room(class_size);
+      if (buffer_pool.in_use + buffer_pool.cached + class_size >
+          buffer_pool.budget) {
+        g_mutex_unlock(&buffer_pool.lock);
+        return NULL;
+      }
+    }
+    block = pool_allocate_block(class_size);
+    if (!block) {
+      g_mutex_unlock(&buffer_pool.lock);
+      return NULL;
+    }
+    block->size_class = size_class;
+    buffer_pool.misses++;
+  }
+
+  block->next = buffer_pool.live;
+  buffer_pool.live = block;
+  buffer_pool.in_use += block->size;
+  if (buffer_pool.in_use + buffer_pool.cached > buffer_pool.peak) {
+    buffer_pool.peak = buffer_pool.in_use + buffer_pool.cached;
+  }
+
+  g_mutex_unlock(&buffer_pool.lock);
+  return block->data;
+}
+
+void pool_release(void *data) {
+  if (!data) {
+    return;
+  }
+
+  g_mutex_lock(&buffer_pool.lock);
+
+  PoolBlock **link = &buffer_pool.live;
+  while (*link && (*link)->data != data) {
+    link = &(*link)->next;
+  }
+  PoolBlock *block = *link;
+  if (block) {
+    *link = block->next;
+    buffer_pool.in_use -= block->size;
+    block->next = buffer_pool.free_lists[block->size_class];
+    buffer_pool.free_lists[block->size_class] = block;
+    buffer_pool.cached += block->size;
+  }
+
+  g_mutex_unlock(&buffer_pool.lock);
+}
+
+gchar *format_pool_stats(void) {
+  g_mutex_lock(&buffer_pool.lock);
+  gchar *text = g_strdup_printf(
+      "buffer pool: %" G_GUINT64_FORMAT " hits, %" G_GUINT64_FORMAT
+      " misses, peak %zu KiB",
+      (guint64)buffer_pool.hits, (guint64)buffer_pool.misses,
+      buffer_pool.peak / 1024);
+  g_mutex_unlock(&buffer_pool.lock);
+  return text;
+}
+
 gboolean update_progress_idle(gpointer data) {
   ProgressData *progress_data = (ProgressData *)data;
   gtk_progress_bar_set_fraction(progress_data->progress_bar,
@@ -255,7 +585,7 @@ gpointer process_wav_file_thread(gpointer data) {
   g_idle_add(update_status_idle, status_data);
 
   rewind(input_file);
-  uint8_t *header_buffer = (uint8_t *)malloc(data_offset);
+  uint8_t *header_buffer = (uint8_t *)pool_acquire(data_offset);
   if (!header_buffer) {
     StatusData *status_data = g_malloc(sizeof(StatusData));
     status_data->status_label = thread_data->status_label;
@@ -277,7 +607,7 @@ gpointer process_wav_file_thread(gpointer data) {
     status_data->text = g_strdup("Error: cannot read file header");
     g_idle_add(update_status_idle, status_data);
     g_idle_add(enable_button_idle, thread_data->process_button);
-    free(header_buffer);
+    pool_release(header_buffer);
     fclose(input_file);
     fclose(output_file);
     g_free(thread_data->input_filename);
@@ -293,7 +623,7 @@ gpointer process_wav_file_thread(gpointer data) {
     status_data->text = g_strdup("Error: cannot write file header");
     g_idle_add(update_status_idle, status_data);
     g_idle_add(enable_button_idle, thread_data->process_button);
-    free(header_buffer);
+    pool_release(header_buffer);
     fclose(input_file);
     fclose(output_file);
     g_free(thread_data->input_filename);
@@ -303,10 +633,10 @@ gpointer process_wav_file_thread(gpointer data) {
     return GINT_TO_POINTER(FALSE);
   }
 
-  free(header_buffer);
+  pool_release(header_buffer);
 
-  const size_t BUFFER_SIZE = 1024 * 1024;
-  uint8_t *buffer = (uint8_t *)malloc(BUFFER_SIZE);
+  const size_t BUFFER_SIZE = tuned_block_size(thread_data->input_filename);
+  uint8_t *buffer = (uint8_t *)pool_acquire(BUFFER_SIZE);
   if (!buffer) {
     StatusData *status_data = g_malloc(sizeof(StatusData));
     status_data->status_label = thread_data->status_label;
@@ -336,7 +666,7 @@ gpointer process_wav_file_thread(gpointer data) {
       status_data->text = g_strdup("Error: read incomplete chunk");
       g_idle_add(update_status_idle, status_data);
       g_idle_add(enable_button_idle, thread_data->process_button);
-      free(buffer);
+      pool_release(buffer);
       fclose(input_file);
       fclose(output_file);
       g_free(thread_data->input_filename);
@@ -346,19 +676,8 @@ gpointer process_wav_file_thread(gpointer data) {
       return GINT_TO_POINTER(FALSE);
     }
 
-    if (strcmp(thread_data->operation, "right") == 0) {
-      apply_right_shift(buffer, chunk_size, thread_data->value);
-    } else if (strcmp(thread_data->operation, "left") == 0) {
-      apply_left_shift(buffer, chunk_size, thread_data->value);
-    } else if (strcmp(thread_data->operation, "not") == 0) {
-      apply_not(buffer, chunk_size, thread_data->value);
-    } else if (strcmp(thread_data->operation, "and") == 0) {
-      apply_and(buffer, chunk_size, thread_data->value);
-    } else if (strcmp(thread_data->operation, "or") == 0) {
-      apply_or(buffer, chunk_size, thread_data->value);
-    } else if (strcmp(thread_data->operation, "xor") == 0) {
-      apply_xor(buffer, chunk_size, thread_data->value);
-    }
+    apply_operation(thread_data->operation, buffer, chunk_size,
+                    thread_data->value);
 
     size_t bytes_written = fwrite(buffer, 1, chunk_size, output_file);
     if (bytes_written != chunk_size) {
@@ -367,7 +686,7 @@ gpointer process_wav_file_thread(gpointer data) {
       status_data->text = g_strdup("Error: write incomplete chunk");
       g_idle_add(update_status_idle, status_data);
       g_idle_add(enable_button_idle, thread_data->process_button);
-      free(buffer);
+      pool_release(buffer);
       fclose(input_file);
       fclose(output_file);
       g_free(thread_data->input_filename);
@@ -397,13 +716,16 @@ gpointer process_wav_file_thread(gpointer data) {
     }
   }
 
-  free(buffer);
+  pool_release(buffer);
   fclose(input_file);
   fclose(output_file);
 
   StatusData *final_status = g_malloc(sizeof(StatusData));
   final_status->status_label = thread_data->status_label;
-  final_status->text = g_strdup("Processing completed successfully!");
+  gchar *pool_stats = format_pool_stats();
+  final_status->text =
+      g_strdup_printf("Processing completed successfully! (%s)", pool_stats);
+  g_free(pool_stats);
   g_idle_add(update_status_idle, final_status);
 
   g_idle_add(enable_button_idle, thread_data->process_button);
@@ -416,6 +738,248 @@ gpointer process_wav_file_thread(gpointer data) {
   return GINT_TO_POINTER(TRUE);
 }
 
+// Render variations: one operation with several values, each written to
+// OUTPUT_<op><value>.wav. Every block is read once and the variants are
+// transformed and written in parallel on a thread pool.
+#define MAX_VARIATIONS 256
+
+typedef struct {
+  const uint8_t *block;
+  size_t size;
+  const gchar *operation;
+  const gint *values;
+  FILE **outputs;
+  uint8_t **buffers;
+  gint pending;
+  gboolean failed;
+  GMutex lock;
+  GCond done;
+} VariationBatch;
+
+// Parses values such as "0-7" or "1,2,4,8" and returns how many there are,
+// or 0 when the list is invalid or outside min-max.
+gint parse_variation_values(const gchar *text, gint min, gint max,
+                            gint *values) {
+  gint count = 0;
+  const gchar *p = text;
+  while (*p) {
+    char *end;
+    long from = strtol(p, &end, 10);
+    if (end == p) {
+      return 0;
+    }
+    long to = from;
+    p = end;
+    if (*p == '-') {
+      to = strtol(p + 1, &end, 10);
+      if (end == p + 1) {
+        return 0;
+      }
+      p = end;
+    }
+    if (from < min || to > max || from > to) {
+      return 0;
+    }
+    for (long v = from; v <= to; v++) {
+      if (count == MAX_VARIATIONS) {
+        return 0;
+      }
+      values[count++] = (gint)v;
+    }
+    while (*p == ',' || *p == ' ') {
+      p++;
+    }
+  }
+  return count;
+}
+
+gchar *variation_filename(const gchar *output_filename, const gchar *operation,
+                          gint value) {
+  const gchar *slash = strrchr(output_filename, '/');
+  const gchar *backslash = strrchr(output_filename, '\\');
+  if (backslash > slash) {
+    slash = backslash;
+  }
+  const gchar *dot = strrchr(output_filename, '.');
+  if (!dot || (slash && dot < slash)) {
+    dot = output_filename + strlen(output_filename);
+  }
+  return g_strdup_printf("%.*s_%s%d%s", (int)(dot - output_filename),
+                         output_filename, operation, value, dot);
+}
+
+void render_variation(gpointer data, gpointer user_data) {
+  VariationBatch *batch = (VariationBatch *)user_data;
+  gint index = GPOINTER_TO_INT(data) - 1;
+
+  uint8_t *buffer = batch->buffers[index];
+  memcpy(buffer, batch->block, batch->size);
+  apply_operation(batch->operation, buffer, batch->size,
+                  batch->values[index]);
+  gboolean ok =
+      fwrite(buffer, 1, batch->size, batch->outputs[index]) == batch->size;
+
+  g_mutex_lock(&batch->lock);
+  if (!ok) {
+    batch->failed = TRUE;
+  }
+  if (--batch->pending == 0) {
+    g_cond_signal(&batch->done);
+  }
+  g_mutex_unlock(&batch->lock);
+}
+
+void finish_variations(ThreadData *thread_data, gchar *text) {
+  StatusData *status_data = g_malloc(sizeof(StatusData));
+  status_data->status_label = thread_data->status_label;
+  status_data->text = text;
+  g_idle_add(update_status_idle, status_data);
+  g_idle_add(enable_button_idle, thread_data->process_button);
+  g_free(thread_data->input_filename);
+  g_free(thread_data->output_filename);
+  g_free(thread_data->operation);
+  g_free(thread_data->values);
+  g_free(thread_data);
+}
+
+gpointer render_variations_thread(gpointer data) {
+  ThreadData *thread_data = (ThreadData *)data;
+  gint count = thread_data->value_count;
+
+  FILE *input_file = fopen(thread_data->input_filename, "rb");
+  if (!input_file) {
+    finish_variations(thread_data, g_strdup("Error: cannot open input file"));
+    return GINT_TO_POINTER(FALSE);
+  }
+
+  WavFmtData fmtData;
+  uint32_t data_size;
+  long data_offset;
+  if (!parse_wav_file(input_file, &fmtData, &data_size, &data_offset) ||
+      fmtData.audioFormat != 1 ||
+      (fmtData.bitsPerSample != 8 && fmtData.bitsPerSample != 16)) {
+    fclose(input_file);
+    finish_variations(thread_data,
+                      g_strdup("Error: only 8-bit and 16-bit PCM supported"));
+    return GINT_TO_POINTER(FALSE);
+  }
+
+  const size_t BUFFER_SIZE = tuned_block_size(thread_data->input_filename);
+  FILE **outputs = g_new0(FILE *, count);
+  uint8_t **buffers = g_new0(uint8_t *, count);
+  uint8_t *block = (uint8_t *)pool_acquire(BUFFER_SIZE);
+  uint8_t *header_buffer = (uint8_t *)pool_acquire(data_offset);
+  gchar *error = NULL;
+
+  rewind(input_file);
+  if (!block || !header_buffer) {
+    error = g_strdup("Error: cannot allocate buffer");
+  } else if (fread(header_buffer, 1, data_offset, input_file) !=
+             (size_t)data_offset) {
+    error = g_strdup("Error: cannot read file header");
+  }
+
+  for (gint i = 0; i < count && !error; i++) {
+    gchar *filename = variation_filename(thread_data->output_filename,
+                                         thread_data->operation,
+                                         thread_data->values[i]);
+    outputs[i] = fopen(filename, "wb");
+    buffers[i] = (uint8_t *)pool_acquire(BUFFER_SIZE);
+    if (!outputs[i] || !buffers[i]) {
+      error = g_strdup_printf("Error: cannot create output file %s", filename);
+    } else if (fwrite(header_buffer, 1, data_offset, outputs[i]) !=
+               (size_t)data_offset) {
+      error = g_strdup_printf("Error: cannot write file header to %s",
+                              filename);
+    }
+    g_free(filename);
+  }
+  pool_release(header_buffer);
+
+  VariationBatch batch;
+  batch.operation = thread_data->operation;
+  batch.values = thread_data->values;
+  batch.outputs = outputs;
+  batch.buffers = buffers;
+  batch.failed = FALSE;
+  g_mutex_init(&batch.lock);
+  g_cond_init(&batch.done);
+
+  GThreadPool *workers = NULL;
+  if (!error) {
+    workers = g_thread_pool_new(render_variation, &batch,
+                                (gint)g_get_num_processors(), FALSE, NULL);
+    if (!workers) {
+      error = g_strdup("Error: cannot start render threads");
+    }
+  }
+
+  size_t total_processed = 0;
+  while (!error && total_processed < data_size) {
+    size_t remaining = data_size - total_processed;
+    size_t chunk_size = (remaining < BUFFER_SIZE) ? remaining : BUFFER_SIZE;
+    if (fread(block, 1, chunk_size, input_file) != chunk_size) {
+      error = g_strdup("Error: read incomplete chunk");
+      break;
+    }
+
+    batch.block = block;
+    batch.size = chunk_size;
+    batch.pending = count;
+    for (gint i = 0; i < count; i++) {
+      g_thread_pool_push(workers, GINT_TO_POINTER(i + 1), NULL);
+    }
+    g_mutex_lock(&batch.lock);
+    while (batch.pending > 0) {
+      g_cond_wait(&batch.done, &batch.lock);
+    }
+    g_mutex_unlock(&batch.lock);
+
+    if (batch.failed) {
+      error = g_strdup("Error: write incomplete chunk");
+      break;
+    }
+
+    total_processed += chunk_size;
+    ProgressData *progress_data = g_malloc(sizeof(ProgressData));
+    progress_data->progress_bar = thread_data->progress_bar;
+    progress_data->fraction = (double)total_processed / data_size;
+    progress_data->text = g_strdup_printf(
+        "Progress: %zu/%u bytes x %d variations", total_processed, data_size,
+        count);
+    g_idle_add(update_progress_idle, progress_data);
+  }
+
+  if (workers) {
+    g_thread_pool_free(workers, FALSE, TRUE);
+  }
+  g_mutex_clear(&batch.lock);
+  g_cond_clear(&batch.done);
+
+  for (gint i = 0; i < count; i++) {
+    if (outputs[i] && fclose(outputs[i]) != 0 && !error) {
+      error = g_strdup("Error: cannot write output file");
+    }
+    pool_release(buffers[i]);
+  }
+  pool_release(block);
+  g_free(outputs);
+  g_free(buffers);
+  fclose(input_file);
+
+  if (error) {
+    finish_variations(thread_data, error);
+    return GINT_TO_POINTER(FALSE);
+  }
+
+  gchar *pool_stats = format_pool_stats();
+  finish_variations(thread_data,
+                    g_strdup_printf("Rendered %d variations successfully! (%s)",
+                                    count, pool_stats));
+  g_free(pool_stats);
+  return GINT_TO_POINTER(TRUE);
+}
+
 gboolean get_wav_file_info(const char *filename, char *info_text,
                            size_t info_size) {
   FILE *file = fopen(filename, "rb");
@@ -445,22 +1009,514 @@ gboolean get_wav_file_info(const char *filename, char *info_text,
   return TRUE;
 }
 
+// Before/after spectrum view. A spectrum is computed on a background thread
+// from SPECTRUM_COLUMNS windows spread evenly over the file rather than from
+// every sample: each column is a Hann windowed real FFT of SPECTRUM_FFT_SIZE
+// frames downmixed to mono. Columns are filled coarse to fine (every 64th,
+// then the ones halfway between, ...) so the view sharpens while it is open,
+// and spectra are cached by file name, size and modification time.
+#define SPECTRUM_FFT_SIZE 1024
+#define SPECTRUM_BINS (SPECTRUM_FFT_SIZE / 2)
+#define SPECTRUM_COLUMNS 512
+#define SPECTRUM_FIRST_STRIDE 64
+#define SPECTRUM_FLOOR_DB -96.0f
+#define MAX_CACHED_SPECTRA 16
+
+typedef struct {
+  gint refs;
+  GMutex lock;
+  gboolean done;
+  gboolean failed;
+  gint columns_done;
+  uint8_t filled[SPECTRUM_COLUMNS];
+  float *levels;
+  double power_sum[SPECTRUM_BINS];
+  gchar *filename;
+} Spectrum;
+
+// Tables for a real FFT of SPECTRUM_FFT_SIZE points, done as a complex FFT
+// of half the size on split real and imaginary arrays. Each stage keeps its
+// twiddles contiguous so the butterfly loops vectorize.
+typedef struct {
+  float window[SPECTRUM_FFT_SIZE];
+  uint16_t reverse[SPECTRUM_BINS];
+  float stage_cos[SPECTRUM_BINS];
+  float stage_sin[SPECTRUM_BINS];
+  float post_cos[SPECTRUM_BINS];
+  float post_sin[SPECTRUM_BINS];
+} SpectrumFft;
+
+void init_spectrum_fft(SpectrumFft *fft) {
+  const double pi = 3.14159265358979323846;
+  for (int i = 0; i < SPECTRUM_FFT_SIZE; i++) {
+    fft->window[i] = (float)(0.5 - 0.5 * cos(2 * pi * i / SPECTRUM_FFT_SIZE));
+  }
+
+  int bits = 0;
+  while ((1 << bits) < SPECTRUM_BINS) {
+    bits++;
+  }
+  for (int i = 0; i < SPECTRUM_BINS; i++) {
+    int reversed = 0;
+    for (int b = 0; b < bits; b++) {
+      reversed |= ((i >> b) & 1) << (bits - 1 - b);
+    }
+    fft->reverse[i] = (uint16_t)reversed;
+  }
+
+  // Twiddles of the stage with butterflies half apart start at half - 1.
+  for (int half = 1; half < SPECTRUM_BINS; half <<= 1) {
+    for (int j = 0; j < half; j++) {
+      double angle = -pi * j / half;
+      fft->stage_cos[half - 1 + j] = (float)cos(angle);
+      fft->stage_sin[half - 1 + j] = (float)sin(angle);
+    }
+  }
+  for (int k = 0; k < SPECTRUM_BINS; k++) {
+    double angle = -2 * pi * k / SPECTRUM_FFT_SIZE;
+    fft->post_cos[k] = (float)cos(angle);
+    fft->post_sin[k] = (float)sin(angle);
+  }
+}
+
+// Power of bins 0 to SPECTRUM_BINS - 1 of the windowed samples.
+void compute_power_spectrum(const SpectrumFft *fft, const float *samples,
+                            float *power) {
+  float re[SPECTRUM_BINS];
+  float im[SPECTRUM_BINS];
+  for (int k = 0; k < SPECTRUM_BINS; k++) {
+    int r = fft->reverse[k];
+    re[k] = samples[2 * r] * fft->window[2 * r];
+    im[k] = samples[2 * r + 1] * fft->window[2 * r + 1];
+  }
+
+  for (int half = 1; half < SPECTRUM_BINS; half <<= 1) {
+    const float *wc = fft->stage_cos + half - 1;
+    const float *ws = fft->stage_sin + half - 1;
+    for (int start = 0; start < SPECTRUM_BINS; start += 2 * half) {
+      float *ar = re + start;
+      float *ai = im + start;
+      float *br = ar + half;
+      float *bi = ai + half;
+      for (int j = 0; j < half; j++) {
+        float tr = br[j] * wc[j] - bi[j] * ws[j];
+        float ti = br[j] * ws[j] + bi[j] * wc[j];
+        br[j] = ar[j] - tr;
+        bi[j] = ai[j] - ti;
+        ar[j] += tr;
+        ai[j] += ti;
+      }
+    }
+  }
+
+  // Split the half size transform into the even and odd sample spectra and
+  // combine them into the real input's spectrum.
+  for (int k = 0; k < SPECTRUM_BINS; k++) {
+    int m = (SPECTRUM_BINS - k) & (SPECTRUM_BINS - 1);
+    float er = 0.5f * (re[k] + re[m]);
+    float ei = 0.5f * (im[k] - im[m]);
+    float or_ = 0.5f * (im[k] + im[m]);
+    float oi = -0.5f * (re[k] - re[m]);
+    float xr = er + or_ * fft->post_cos[k] - oi * fft->post_sin[k];
+    float xi = ei + or_ * fft->post_sin[k] + oi * fft->post_cos[k];
+    power[k] = xr * xr + xi * xi;
+  }
+}
+
+Spectrum *spectrum_ref(Spectrum *spectrum) {
+  g_atomic_int_inc(&spectrum->refs);
+  return spectrum;
+}
+
+void spectrum_unref(gpointer data) {
+  Spectrum *spectrum = (Spectrum *)data;
+  if (g_atomic_int_dec_and_test(&spectrum->refs)) {
+    g_mutex_clear(&spectrum->lock);
+    g_free(spectrum->levels);
+    g_free(spectrum->filename);
+    g_free(spectrum);
+  }
+}
+
+// Reads SPECTRUM_FFT_SIZE frames starting at frame as mono samples in
+// [-1, 1], zero padded past the end of the data.
+void read_spectrum_window(FILE *file, const WavFmtData *fmtData,
+                          long data_offset, uint32_t frames, uint32_t frame,
+                          uint8_t *raw, float *samples) {
+  uint32_t count = SPECTRUM_FFT_SIZE;
+  if (frame >= frames) {
+    count = 0;
+  } else if (frames - frame < count) {
+    count = frames - frame;
+  }
+  if (count > 0 &&
+      (fseek(file, data_offset + (long)frame * fmtData->blockAlign,
+             SEEK_SET) != 0 ||
+       fread(raw, fmtData->blockAlign, count, file) != count)) {
+    count = 0;
+  }
+
+  int channels = fmtData->numChannels;
+  float scale = 1.0f / channels;
+  for (uint32_t f = 0; f < count; f++) {
+    float sum = 0;
+    if (fmtData->bitsPerSample == 8) {
+      const uint8_t *in = raw + f * channels;
+      for (int c = 0; c < channels; c++) {
+        sum += (in[c] - 128) / 128.0f;
+      }
+    } else {
+      const int16_t *in = (const int16_t *)raw + f * channels;
+      for (int c = 0; c < channels; c++) {
+        sum += in[c] / 32768.0f;
+      }
+    }
+    samples[f] = sum * scale;
+  }
+  for (uint32_t f = count; f < SPECTRUM_FFT_SIZE; f++) {
+    samples[f] = 0;
+  }
+}
+
+gpointer compute_spectrum_thread(gpointer data) {
+  Spectrum *spectrum = (Spectrum *)data;
+  FILE *file = fopen(spectrum->filename, "rb");
+  WavFmtData fmtData;
+  uint32_t data_size;
+  long data_offset;
+  if (!file || !parse_wav_file(file, &fmtData, &data_size, &data_offset) ||
+      fmtData.audioFormat != 1 ||
+      (fmtData.bitsPerSample != 8 && fmtData.bitsPerSample != 16) ||
+      fmtData.blockAlign != fmtData.numChannels * fmtData.bitsPerSample / 8) {
+    if (file) {
+      fclose(file);
+    }
+    g_mutex_lock(&spectrum->lock);
+    spectrum->failed = TRUE;
+    spectrum->done = TRUE;
+    g_mutex_unlock(&spectrum->lock);
+    spectrum_unref(spectrum);
+    return GINT_TO_POINTER(FALSE);
+  }
+
+  SpectrumFft *fft = g_new(SpectrumFft, 1);
+  init_spectrum_fft(fft);
+  uint8_t *raw = g_malloc((gsize)SPECTRUM_FFT_SIZE * fmtData.blockAlign);
+  float samples[SPECTRUM_FFT_SIZE];
+  float power[SPECTRUM_BINS];
+  uint32_t frames = data_size / fmtData.blockAlign;
+  const float norm = 16.0f / ((float)SPECTRUM_FFT_SIZE * SPECTRUM_FFT_SIZE);
+
+  for (gint stride = SPECTRUM_FIRST_STRIDE; stride >= 1; stride /= 2) {
+    for (gint c = 0; c < SPECTRUM_COLUMNS; c += stride) {
+      if (spectrum->filled[c]) {
+        continue;
+      }
+      uint64_t center = ((uint64_t)c * 2 + 1) * frames / (2 * SPECTRUM_COLUMNS);
+      uint32_t start = center > SPECTRUM_FFT_SIZE / 2
+                           ? (uint32_t)(center - SPECTRUM_FFT_SIZE / 2)
+                           : 0;
+      read_spectrum_window(file, &fmtData, data_offset, frames, start, raw,
+                           samples);
+      compute_power_spectrum(fft, samples, power);
+
+      g_mutex_lock(&spectrum->lock);
+      float *column = spectrum->levels + (gsize)c * SPECTRUM_BINS;
+      for (int k = 0; k < SPECTRUM_BINS; k++) {
+        float level = 10.0f * log10f(power[k] * norm + 1e-12f);
+        column[k] = level < SPECTRUM_FLOOR_DB ? SPECTRUM_FLOOR_DB : level;
+        spectrum->power_sum[k] += power[k] * norm;
+      }
+      spectrum->filled[c] = 1;
+      spectrum->columns_done++;
+      g_mutex_unlock(&spectrum->lock);
+    }
+  }
+
+  g_mutex_lock(&spectrum->lock);
+  spectrum->done = TRUE;
+  g_mutex_unlock(&spectrum->lock);
+
+  g_free(raw);
+  g_free(fft);
+  fclose(file);
+  spectrum_unref(spectrum);
+  return GINT_TO_POINTER(TRUE);
+}
+
+GHashTable *spectrum_cache = NULL;
+
+// Returns a new reference to the spectrum of filename as it is now, starting
+// its computation if it is not cached, or NULL when there is no such file.
+// Main thread only.
+Spectrum *get_spectrum(const gchar *filename) {
+  GStatBuf info;
+  if (g_stat(filename, &info) != 0) {
+    return NULL;
+  }
+  gchar *key = g_strdup_printf("%s|%lld|%lld", filename,
+                               (long long)info.st_size,
+                               (long long)info.st_mtime);
+
+  if (!spectrum_cache) {
+    spectrum_cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                           spectrum_unref);
+  }
+  Spectrum *spectrum = g_hash_table_lookup(spectrum_cache, key);
+  if (spectrum) {
+    g_free(key);
+    return spectrum_ref(spectrum);
+  }
+
+  if (g_hash_table_size(spectrum_cache) >= MAX_CACHED_SPECTRA) {
+    g_hash_table_remove_all(spectrum_cache);
+  }
+  spectrum = g_new0(Spectrum, 1);
+  spectrum->refs = 1;
+  g_mutex_init(&spectrum->lock);
+  spectrum->levels =
+      g_new(float, (gsize)SPECTRUM_COLUMNS * SPECTRUM_BINS);
+  spectrum->filename = g_strdup(filename);
+  g_hash_table_insert(spectrum_cache, key, spectrum_ref(spectrum));
+  g_thread_unref(g_thread_new("spectrum_thread", compute_spectrum_thread,
+                              spectrum_ref(spectrum)));
+  return spectrum;
+}
+
+// Drops the cached spectra of filename, whose contents are about to change.
+void forget_spectra(const gchar *filename) {
+  if (!spectrum_cache) {
+    return;
+  }
+  gchar *prefix = g_strdup_printf("%s|", filename);
+  GHashTableIter iter;
+  gpointer key;
+  g_hash_table_iter_init(&iter, spectrum_cache);
+  while (g_hash_table_iter_next(&iter, &key, NULL)) {
+    if (g_str_has_prefix((const gchar *)key, prefix)) {
+      g_hash_table_iter_remove(&iter);
+    }
+  }
+  g_free(prefix);
+}
+
+typedef struct {
+  GtkWidget *area;
+  Spectrum *input;
+  Spectrum *output;
+  guint timer;
+} SpectrumView;
+
+void spectrum_color(float level, uint8_t *r, uint8_t *g, uint8_t *b) {
+  float t = (level - SPECTRUM_FLOOR_DB) / -SPECTRUM_FLOOR_DB;
+  float red = 3 * t;
+  float green = 3 * t - 1;
+  float blue = 3 * t - 2;
+  *r = (uint8_t)(255 * (red < 0 ? 0 : red > 1 ? 1 : red));
+  *g = (uint8_t)(255 * (green < 0 ? 0 : green > 1 ? 1 : green));
+  *b = (uint8_t)(255 * (blue < 0 ? 0 : blue > 1 ? 1 : blue));
+}
+
+// Draws a spectrogram with time to the right and frequency up. Columns not
+// computed yet show the nearest computed column to their left.
+void draw_spectrogram(cairo_t *cr, Spectrum *spectrum, double x, double y,
+                      double width, double height, const char *title) {
+  cairo_set_source_rgb(cr, 0.8, 0.8, 0.8);
+  cairo_move_to(cr, x + 4, y + 12);
+  cairo_show_text(cr, title);
+  y += 16;
+  height -= 16;
+  if (!spectrum || height <= 0) {
+    return;
+  }
+
+  g_mutex_lock(&spectrum->lock);
+  gboolean failed = spectrum->failed;
+  g_mutex_unlock(&spectrum->lock);
+  if (failed) {
+    cairo_move_to(cr, x + 4, y + 12);
+    cairo_show_text(cr, "Only 8-bit and 16-bit PCM files can be shown");
+    return;
+  }
+
+  cairo_surface_t *surface = cairo_image_surface_create(
+      CAIRO_FORMAT_RGB24, SPECTRUM_COLUMNS, SPECTRUM_BINS);
+  uint8_t *pixels = cairo_image_surface_get_data(surface);
+  int stride = cairo_image_surface_get_stride(surface);
+  cairo_surface_flush(surface);
+
+  g_mutex_lock(&spectrum->lock);
+  gint source = -1;
+  for (gint c = 0; c < SPECTRUM_COLUMNS; c++) {
+    if (spectrum->filled[c]) {
+      source = c;
+    }
+    const float *column =
+        source >= 0 ? spectrum->levels + (gsize)source * SPECTRUM_BINS : NULL;
+    for (int k = 0; k < SPECTRUM_BINS; k++) {
+      uint32_t *pixel =
+          (uint32_t *)(pixels + (SPECTRUM_BINS - 1 - k) * stride) + c;
+      uint8_t r = 0, g = 0, b = 0;
+      if (column) {
+        spectrum_color(column[k], &r, &g, &b);
+      }
+      *pixel = ((uint32_t)r << 16) | ((uint32_t)g << 8) | b;
+    }
+  }
+  g_mutex_unlock(&spectrum->lock);
+  cairo_surface_mark_dirty(surface);
+
+  cairo_save(cr);
+  cairo_rectangle(cr, x, y, width, height);
+  cairo_clip(cr);
+  cairo_translate(cr, x, y);
+  cairo_scale(cr, width / SPECTRUM_COLUMNS, height / SPECTRUM_BINS);
+  cairo_set_source_surface(cr, surface, 0, 0);
+  cairo_paint(cr);
+  cairo_restore(cr);
+  cairo_surface_destroy(surface);
+}
+
+// Plots the average level per bin.
+void draw_average_spectrum(cairo_t *cr, Spectrum *spectrum, double x,
+                           double y, double width, double height) {
+  if (!spectrum) {
+    return;
+  }
+  g_mutex_lock(&spectrum->lock);
+  if (spectrum->columns_done > 0) {
+    for (int k = 0; k < SPECTRUM_BINS; k++) {
+      float level = 10.0f * log10f((float)(spectrum->power_sum[k] /
+                                           spectrum->columns_done) +
+                                   1e-12f);
+      if (level < SPECTRUM_FLOOR_DB) {
+        level = SPECTRUM_FLOOR_DB;
+      }
+      double px = x + width * k / (SPECTRUM_BINS - 1);
+      double py = y + height * level / SPECTRUM_FLOOR_DB;
+      if (k == 0) {
+        cairo_move_to(cr, px, py);
+      } else {
+        cairo_line_to(cr, px, py);
+      }
+    }
+    cairo_stroke(cr);
+  }
+  g_mutex_unlock(&spectrum->lock);
+}
+
+gboolean on_spectrum_draw(GtkWidget *area, cairo_t *cr, SpectrumView *view) {
+  double width = gtk_widget_get_allocated_width(area);
+  double height = gtk_widget_get_allocated_height(area);
+  double panel = height * 0.35;
+
+  cairo_set_source_rgb(cr, 0.1, 0.1, 0.1);
+  cairo_paint(cr);
+  cairo_set_font_size(cr, 11);
+
+  draw_spectrogram(cr, view->input, 0, 0, width, panel, "Input");
+  draw_spectrogram(cr, view->output, 0, panel, width, panel,
+                   view->output ? "Output" : "Output (not rendered yet)");
+
+  double y = 2 * panel + 16;
+  double plot = height - y - 4;
+  cairo_set_source_rgb(cr, 0.8, 0.8, 0.8);
+  cairo_move_to(cr, 4, 2 * panel + 12);
+  cairo_show_text(cr, "Average spectrum: input (blue), output (orange)");
+  cairo_set_line_width(cr, 1.0);
+  cairo_set_source_rgb(cr, 0.3, 0.6, 1.0);
+  draw_average_spectrum(cr, view->input, 0, y, width, plot);
+  cairo_set_source_rgb(cr, 1.0, 0.6, 0.2);
+  draw_average_spectrum(cr, view->output, 0, y, width, plot);
+  return FALSE;
+}
+
+gboolean spectrum_done(Spectrum *spectrum) {
+  if (!spectrum) {
+    return TRUE;
+  }
+  g_mutex_lock(&spectrum->lock);
+  gboolean done = spectrum->done;
+  g_mutex_unlock(&spectrum->lock);
+  return done;
+}
+
+// Redraws while either spectrum is still being refined.
+gboolean refresh_spectrum_view(gpointer data) {
+  SpectrumView *view = (SpectrumView *)data;
+  gtk_widget_queue_draw(view->area);
+  if (spectrum_done(view->input) && spectrum_done(view->output)) {
+    view->timer = 0;
+    return G_SOURCE_REMOVE;
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+void on_spectrum_view_destroy(GtkWidget *window, SpectrumView *view) {
+  if (view->timer) {
+    g_source_remove(view->timer);
+  }
+  if (view->input) {
+    spectrum_unref(view->input);
+  }
+  if (view->output) {
+    spectrum_unref(view->output);
+  }
+  g_free(view);
+}
+
+void on_spectrum_clicked(GtkButton *button, AppWidgets *widgets) {
+  const gchar *input_file = gtk_entry_get_text(GTK_ENTRY(widgets->input_entry));
+  const gchar *output_file =
+      gtk_entry_get_text(GTK_ENTRY(widgets->output_entry));
+
+  if (g_strcmp0(input_file, "") == 0) {
+    gtk_label_set_text(GTK_LABEL(widgets->status_label),
+                       "Error: please select an input file");
+    return;
+  }
+
+  SpectrumView *view = g_new0(SpectrumView, 1);
+  view->input = get_spectrum(input_file);
+  if (!view->input) {
+    gtk_label_set_text(GTK_LABEL(widgets->status_label),
+                       "Error: cannot open input file");
+    g_free(view);
+    return;
+  }
+  if (g_strcmp0(output_file, "") != 0) {
+    view->output = get_spectrum(output_file);
+  }
+
+  GtkWidget *window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+  gtk_window_set_title(GTK_WINDOW(window), "Spectrum Before and After");
+  gtk_window_set_transient_for(GTK_WINDOW(window),
+                               GTK_WINDOW(widgets->window));
+  gtk_window_set_default_size(GTK_WINDOW(window), 640, 560);
+
+  view->area = gtk_drawing_area_new();
+  gtk_container_add(GTK_CONTAINER(window), view->area);
+  g_signal_connect(view->area, "draw", G_CALLBACK(on_spectrum_draw), view);
+  g_signal_connect(window, "destroy", G_CALLBACK(on_spectrum_view_destroy),
+                   view);
+  view->timer = g_timeout_add(100, refresh_spectrum_view, view);
+
+  gtk_widget_show_all(window);
+}
+
 void on_operation_changed(GtkComboBox *combo, AppWidgets *widgets) {
   gchar *operation = gtk_combo_box_text_get_active_text(
       GTK_COMBO_BOX_TEXT(widgets->operation_combo));
 
-  if (g_strcmp0(operation, "not") == 0) {
+  const GuiOperation *info = find_gui_operation(operation);
+  if (!info || info->max_value == 0) {
     gtk_widget_set_sensitive(widgets->value_spin, FALSE);
     gtk_label_set_text(GTK_LABEL(widgets->value_label), "Value (ignored):");
-  } else if (g_strcmp0(operation, "right") == 0 ||
-             g_strcmp0(operation, "left") == 0) {
-    gtk_widget_set_sensitive(widgets->value_spin, TRUE);
-    gtk_spin_button_set_range(GTK_SPIN_BUTTON(widgets->value_spin), 0, 7);
-    gtk_label_set_text(GTK_LABEL(widgets->value_label), "Shift value (0-7):");
   } else {
     gtk_widget_set_sensitive(widgets->value_spin, TRUE);
-    gtk_spin_button_set_range(GTK_SPIN_BUTTON(widgets->value_spin), 0, 255);
-    gtk_label_set_text(GTK_LABEL(widgets->value_label), "Value (0-255):");
+    gtk_spin_button_set_range(GTK_SPIN_BUTTON(widgets->value_spin), 0,
+                              info->max_value);
+    gtk_label_set_text(GTK_LABEL(widgets->value_label), info->value_label);
   }
 
   g_free(operation);
@@ -539,6 +1595,7 @@ void on_process_clicked(GtkButton *button, AppWidgets *widgets) {
   gint value =
       gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(widgets->value_spin));
 
+  forget_spectra(output_file);
   gtk_widget_set_sensitive(widgets->process_button, FALSE);
   gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(widgets->progress_bar), 0.0);
   gtk_progress_bar_set_text(GTK_PROGRESS_BAR(widgets->progress_bar),
@@ -550,6 +1607,8 @@ void on_process_clicked(GtkButton *button, AppWidgets *widgets) {
   thread_data->output_filename = g_strdup(output_file);
   thread_data->operation = g_strdup(operation);
   thread_data->value = value;
+  thread_data->values = NULL;
+  thread_data->value_count = 0;
   thread_data->progress_bar = GTK_PROGRESS_BAR(widgets->progress_bar);
   thread_data->status_label = GTK_LABEL(widgets->status_label);
   thread_data->process_button = widgets->process_button;
@@ -559,6 +1618,63 @@ void on_process_clicked(GtkButton *button, AppWidgets *widgets) {
   g_free(operation);
 }
 
+void on_variations_clicked(GtkButton *button, AppWidgets *widgets) {
+  const gchar *input_file = gtk_entry_get_text(GTK_ENTRY(widgets->input_entry));
+  const gchar *output_file =
+      gtk_entry_get_text(GTK_ENTRY(widgets->output_entry));
+
+  if (g_strcmp0(input_file, "") == 0 || g_strcmp0(output_file, "") == 0) {
+    gtk_label_set_text(GTK_LABEL(widgets->status_label),
+                       "Error: please select input and output files");
+    return;
+  }
+
+  gchar *operation = gtk_combo_box_text_get_active_text(
+      GTK_COMBO_BOX_TEXT(widgets->operation_combo));
+  const GuiOperation *info = find_gui_operation(operation);
+  if (!info || info->max_value == 0) {
+    gchar *text = g_strdup_printf("Error: %s has no value to vary", operation);
+    gtk_label_set_text(GTK_LABEL(widgets->status_label), text);
+    g_free(text);
+    g_free(operation);
+    return;
+  }
+
+  gint max_value = info->max_value;
+  gint *values = g_new(gint, MAX_VARIATIONS);
+  gint count = parse_variation_values(
+      gtk_entry_get_text(GTK_ENTRY(widgets->variations_entry)), 0, max_value,
+      values);
+  if (count == 0) {
+    gtk_label_set_text(GTK_LABEL(widgets->status_label),
+                       "Error: variations must be values or ranges such as "
+                       "0-7 or 1,2,4");
+    g_free(values);
+    g_free(operation);
+    return;
+  }
+
+  gtk_widget_set_sensitive(widgets->variations_button, FALSE);
+  gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(widgets->progress_bar), 0.0);
+  gtk_progress_bar_set_text(GTK_PROGRESS_BAR(widgets->progress_bar),
+                            "Starting...");
+  gtk_label_set_text(GTK_LABEL(widgets->status_label),
+                     "Rendering variations...");
+
+  ThreadData *thread_data = g_malloc(sizeof(ThreadData));
+  thread_data->input_filename = g_strdup(input_file);
+  thread_data->output_filename = g_strdup(output_file);
+  thread_data->operation = operation;
+  thread_data->value = 0;
+  thread_data->values = values;
+  thread_data->value_count = count;
+  thread_data->progress_bar = GTK_PROGRESS_BAR(widgets->progress_bar);
+  thread_data->status_label = GTK_LABEL(widgets->status_label);
+  thread_data->process_button = widgets->variations_button;
+
+  g_thread_new("variations_thread", render_variations_thread, thread_data);
+}
+
 AppWidgets *create_gui() {
   AppWidgets *widgets = g_malloc(sizeof(AppWidgets));
 
@@ -610,18 +1726,10 @@ AppWidgets *create_gui() {
   gtk_grid_attach(GTK_GRID(grid), operation_label, 0, 3, 1, 1);
 
   widgets->operation_combo = gtk_combo_box_text_new();
-  gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(widgets->operation_combo),
-                                 "right");
-  gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(widgets->operation_combo),
-                                 "left");
-  gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(widgets->operation_combo),
-                                 "not");
-  gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(widgets->operation_combo),
-                                 "and");
-  gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(widgets->operation_combo),
-                                 "or");
-  gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(widgets->operation_combo),
-                                 "xor");
+  for (size_t i = 0; i < NUM_GUI_OPERATIONS; i++) {
+    gtk_combo_box_text_append_text(
+        GTK_COMBO_BOX_TEXT(widgets->operation_combo), gui_operations[i].name);
+  }
   gtk_combo_box_set_active(GTK_COMBO_BOX(widgets->operation_combo), 0);
   gtk_grid_attach(GTK_GRID(grid), widgets->operation_combo, 1, 3, 1, 1);
 
@@ -637,13 +1745,28 @@ AppWidgets *create_gui() {
   gtk_widget_set_halign(widgets->process_button, GTK_ALIGN_CENTER);
   gtk_grid_attach(GTK_GRID(grid), widgets->process_button, 0, 4, 4, 1);
 
+  GtkWidget *variations_label = gtk_label_new("Variations:");
+  gtk_widget_set_halign(variations_label, GTK_ALIGN_START);
+  gtk_grid_attach(GTK_GRID(grid), variations_label, 0, 5, 1, 1);
+
+  widgets->variations_entry = gtk_entry_new();
+  gtk_entry_set_text(GTK_ENTRY(widgets->variations_entry), "0-7");
+  gtk_grid_attach(GTK_GRID(grid), widgets->variations_entry, 1, 5, 2, 1);
+
+  widgets->variations_button = gtk_button_new_with_label("Render Variations");
+  gtk_grid_attach(GTK_GRID(grid), widgets->variations_button, 3, 5, 1, 1);
+
   widgets->progress_bar = gtk_progress_bar_new();
   gtk_progress_bar_set_show_text(GTK_PROGRESS_BAR(widgets->progress_bar), TRUE);
-  gtk_grid_attach(GTK_GRID(grid), widgets->progress_bar, 0, 5, 4, 1);
+  gtk_grid_attach(GTK_GRID(grid), widgets->progress_bar, 0, 6, 4, 1);
 
   widgets->status_label = gtk_label_new("Ready");
   gtk_widget_set_halign(widgets->status_label, GTK_ALIGN_START);
-  gtk_grid_attach(GTK_GRID(grid), widgets->status_label, 0, 6, 4, 1);
+  gtk_grid_attach(GTK_GRID(grid), widgets->status_label, 0, 7, 4, 1);
+
+  widgets->spectrum_button = gtk_button_new_with_label("Compare Spectra");
+  gtk_widget_set_halign(widgets->spectrum_button, GTK_ALIGN_CENTER);
+  gtk_grid_attach(GTK_GRID(grid), widgets->spectrum_button, 0, 8, 4, 1);
 
   g_signal_connect(widgets->window, "destroy", G_CALLBACK(gtk_main_quit), NULL);
   g_signal_connect(widgets->operation_combo, "changed",
@@ -654,6 +1777,10 @@ AppWidgets *create_gui() {
                    G_CALLBACK(on_browse_output_clicked), widgets);
   g_signal_connect(widgets->process_button, "clicked",
                    G_CALLBACK(on_process_clicked), widgets);
+  g_signal_connect(widgets->variations_button, "clicked",
+                   G_CALLBACK(on_variations_clicked), widgets);
+  g_signal_connect(widgets->spectrum_button, "clicked",
+                   G_CALLBACK(on_spectrum_clicked), widgets);
   g_signal_connect(widgets->input_entry, "changed",
                    G_CALLBACK(on_input_file_changed), widgets);
 
@@ -0,0 +1,342 @@
+// LADSPA plugin of the soundbadizer kernels for real-time hosts. Samples are
+// converted to 8-bit or 16-bit PCM, run through up to three op stages and
+// converted back. Everything the audio callback touches lives in the
+// instance, so run() never allocates, locks or blocks.
+//
+// gcc -O2 -Wall -shared -fPIC -o soundbadizer.so src/ladspa.c
+#include <ladspa.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+void apply_right_shift(uint8_t *data, size_t size, int shift) {
+  for (size_t i = 0; i < size; i++) {
+    data[i] = (data[i] >> shift) & 0xFF;
+  }
+}
+
+void apply_left_shift(uint8_t *data, size_t size, int shift) {
+  for (size_t i = 0; i < size; i++) {
+    data[i] = (data[i] << shift) & 0xFF;
+  }
+}
+
+void apply_not(uint8_t *data, size_t size, int value) {
+  for (size_t i = 0; i < size; i++) {
+    data[i] = ~data[i] & 0xFF;
+  }
+}
+
+void apply_and(uint8_t *data, size_t size, int value) {
+  for (size_t i = 0; i < size; i++) {
+    data[i] = (data[i] & value) & 0xFF;
+  }
+}
+
+void apply_or(uint8_t *data, size_t size, int value) {
+  for (size_t i = 0; i < size; i++) {
+    data[i] = (data[i] | value) & 0xFF;
+  }
+}
+
+void apply_xor(uint8_t *data, size_t size, int value) {
+  for (size_t i = 0; i < size; i++) {
+    data[i] = (data[i] ^ value) & 0xFF;
+  }
+}
+
+typedef void (*ByteOpKernel)(uint8_t *data, size_t size, int value);
+
+typedef enum {
+  STEP_TABLE,
+  STEP_CRUSH,
+  STEP_DECIMATE
+} StepKind;
+
+typedef struct {
+  const char *name;
+  StepKind kind;
+  ByteOpKernel kernel;
+  int min;
+  int max;
+} PluginOperation;
+
+// Indexed by the value of a stage's operation port, 0 disables the stage.
+const PluginOperation plugin_operations[] = {
+    {"none", STEP_TABLE, NULL, 0, 0},
+    {"right", STEP_TABLE, apply_right_shift, 0, 7},
+    {"left", STEP_TABLE, apply_left_shift, 0, 7},
+    {"not", STEP_TABLE, apply_not, 0, 0},
+    {"and", STEP_TABLE, apply_and, 0, 255},
+    {"or", STEP_TABLE, apply_or, 0, 255},
+    {"xor", STEP_TABLE, apply_xor, 0, 255},
+    {"crush", STEP_CRUSH, NULL, 1, 16},
+    {"decimate", STEP_DECIMATE, NULL, 1, 4096},
+};
+
+#define NUM_PLUGIN_OPERATIONS \
+  (sizeof(plugin_operations) / sizeof(plugin_operations[0]))
+#define STAGE_COUNT 3
+
+#define PORT_INPUT 0
+#define PORT_OUTPUT 1
+#define PORT_BITS 2
+#define PORT_STAGE_OPERATION(stage) (3 + 2 * (stage))
+#define PORT_STAGE_VALUE(stage) (4 + 2 * (stage))
+#define PORT_COUNT (3 + 2 * STAGE_COUNT)
+
+typedef struct {
+  StepKind kind;
+  int value;
+  uint8_t table[256];
+} PlanStep;
+
+typedef struct {
+  LADSPA_Data *ports[PORT_COUNT];
+  int bits;
+  int operations[STAGE_COUNT];
+  int values[STAGE_COUNT];
+  int planned;
+  PlanStep steps[STAGE_COUNT];
+  int step_count;
+  // Decimate phase and held sample per step, carried across blocks.
+  int phases[STAGE_COUNT];
+  int32_t held[STAGE_COUNT];
+} Badizer;
+
+int control_value(const LADSPA_Data *port, int min, int max) {
+  if (!port) {
+    return min;
+  }
+  LADSPA_Data value = *port;
+  if (!(value >= min)) {
+    return min;
+  }
+  if (value > max) {
+    return max;
+  }
+  return (int)(value + 0.5f);
+}
+
+// Rebuilds the stage plan when a control changed since the last block.
+// Consecutive byte ops are composed into one 256 entry table.
+void update_plan(Badizer *badizer) {
+  int bits = control_value(badizer->ports[PORT_BITS], 8, 16) < 12 ? 8 : 16;
+  int operations[STAGE_COUNT];
+  int values[STAGE_COUNT];
+  int changed = !badizer->planned || bits != badizer->bits;
+  for (int stage = 0; stage < STAGE_COUNT; stage++) {
+    operations[stage] =
+        control_value(badizer->ports[PORT_STAGE_OPERATION(stage)], 0,
+                      NUM_PLUGIN_OPERATIONS - 1);
+    const PluginOperation *operation = &plugin_operations[operations[stage]];
+    values[stage] = control_value(badizer->ports[PORT_STAGE_VALUE(stage)],
+                                  operation->min, operation->max);
+    if (operations[stage] != badizer->operations[stage] ||
+        values[stage] != badizer->values[stage]) {
+      changed = 1;
+    }
+  }
+  if (!changed) {
+    return;
+  }
+
+  badizer->bits = bits;
+  badizer->step_count = 0;
+  PlanStep *table_step = NULL;
+  for (int stage = 0; stage < STAGE_COUNT; stage++) {
+    badizer->operations[stage] = operations[stage];
+    badizer->values[stage] = values[stage];
+    const PluginOperation *operation = &plugin_operations[operations[stage]];
+    if (operations[stage] == 0) {
+      continue;
+    }
+
+    if (operation->kind == STEP_TABLE) {
+      if (!table_step) {
+        table_step = &badizer->steps[badizer->step_count++];
+        table_step->kind = STEP_TABLE;
+        for (int i = 0; i < 256; i++) {
+          table_step->table[i] = (uint8_t)i;
+        }
+      }
+      operation->kernel(table_step->table, 256, values[stage]);
+      continue;
+    }
+
+    PlanStep *step = &badizer->steps[badizer->step_count];
+    if (step->kind != operation->kind || step->value != values[stage]) {
+      badizer->phases[badizer->step_count] = 0;
+    }
+    step->kind = operation->kind;
+    step->value = values[stage];
+    badizer->step_count++;
+    table_step = NULL;
+  }
+  badizer->planned = 1;
+}
+
+// Same rounding as the console's crush: nearest level, clamped to the top.
+int32_t crush_sample(int32_t sample, int bits, int value) {
+  if (value >= bits) {
+    return sample;
+  }
+  int shift = bits - value;
+  int32_t half = 1 << (shift - 1);
+  int32_t max_level = (bits == 8 ? 256 : 32768) - (1 << shift);
+  int32_t level = ((sample + half) >> shift) * (1 << shift);
+  return level > max_level ? max_level : level;
+}
+
+int32_t to_pcm(LADSPA_Data value, int bits) {
+  if (!(value >= -1.0f)) {
+    value = -1.0f;
+  } else if (value > 1.0f) {
+    value = 1.0f;
+  }
+  LADSPA_Data scaled = value * (bits == 8 ? 128.0f : 32768.0f);
+  int32_t sample = (int32_t)(scaled + (scaled >= 0.0f ? 0.5f : -0.5f));
+  if (bits == 8) {
+    sample += 128;
+    return sample > 255 ? 255 : sample;
+  }
+  return sample > 32767 ? 32767 : sample;
+}
+
+LADSPA_Data from_pcm(int32_t sample, int bits) {
+  if (bits == 8) {
+    return (LADSPA_Data)(sample - 128) / 128.0f;
+  }
+  return (LADSPA_Data)sample / 32768.0f;
+}
+
+LADSPA_Handle instantiate_badizer(const LADSPA_Descriptor *descriptor,
+                                  unsigned long sample_rate) {
+  return calloc(1, sizeof(Badizer));
+}
+
+void connect_badizer_port(LADSPA_Handle instance, unsigned long port,
+                          LADSPA_Data *location) {
+  if (port < PORT_COUNT) {
+    ((Badizer *)instance)->ports[port] = location;
+  }
+}
+
+void activate_badizer(LADSPA_Handle instance) {
+  Badizer *badizer = (Badizer *)instance;
+  badizer->planned = 0;
+  memset(badizer->steps, 0, sizeof(badizer->steps));
+  memset(badizer->phases, 0, sizeof(badizer->phases));
+  memset(badizer->held, 0, sizeof(badizer->held));
+}
+
+void run_badizer(LADSPA_Handle instance, unsigned long sample_count) {
+  Badizer *badizer = (Badizer *)instance;
+  const LADSPA_Data *input = badizer->ports[PORT_INPUT];
+  LADSPA_Data *output = badizer->ports[PORT_OUTPUT];
+  update_plan(badizer);
+  int bits = badizer->bits;
+
+  for (unsigned long i = 0; i < sample_count; i++) {
+    int32_t sample = to_pcm(input[i], bits);
+
+    for (int s = 0; s < badizer->step_count; s++) {
+      const PlanStep *step = &badizer->steps[s];
+      if (step->kind == STEP_TABLE) {
+        if (bits == 8) {
+          sample = step->table[sample];
+        } else {
+          uint16_t word = (uint16_t)sample;
+          word = (uint16_t)(step->table[word & 0xFF] |
+                            (step->table[word >> 8] << 8));
+          sample = (int16_t)word;
+        }
+      } else if (step->kind == STEP_CRUSH) {
+        sample = crush_sample(sample, bits, step->value);
+      } else {
+        if (badizer->phases[s] == 0) {
+          badizer->held[s] = sample;
+        } else {
+          sample = badizer->held[s];
+        }
+        if (++badizer->phases[s] >= step->value) {
+          badizer->phases[s] = 0;
+        }
+      }
+    }
+
+    output[i] = from_pcm(sample, bits);
+  }
+}
+
+void cleanup_badizer(LADSPA_Handle instance) { free(instance); }
+
+const LADSPA_PortDescriptor badizer_port_descriptors[PORT_COUNT] = {
+    LADSPA_PORT_INPUT | LADSPA_PORT_AUDIO,
+    LADSPA_PORT_OUTPUT | LADSPA_PORT_AUDIO,
+    LADSPA_PORT_INPUT | LADSPA_PORT_CONTROL,
+    LADSPA_PORT_INPUT | LADSPA_PORT_CONTROL,
+    LADSPA_PORT_INPUT | LADSPA_PORT_CONTROL,
+    LADSPA_PORT_INPUT | LADSPA_PORT_CONTROL,
+    LADSPA_PORT_INPUT | LADSPA_PORT_CONTROL,
+    LADSPA_PORT_INPUT | LADSPA_PORT_CONTROL,
+    LADSPA_PORT_INPUT | LADSPA_PORT_CONTROL,
+};
+
+const char *const badizer_port_names[PORT_COUNT] = {
+    "Input",
+    "Output",
+    "Sample bits (8 or 16)",
+    "Stage 1 operation (0 none, 1 right, 2 left, 3 not, 4 and, 5 or, 6 xor, "
+    "7 crush, 8 decimate)",
+    "Stage 1 value",
+    "Stage 2 operation",
+    "Stage 2 value",
+    "Stage 3 operation",
+    "Stage 3 value",
+};
+
+#define OPERATION_HINT \
+  {LADSPA_HINT_BOUNDED_BELOW | LADSPA_HINT_BOUNDED_ABOVE | \
+       LADSPA_HINT_INTEGER | LADSPA_HINT_DEFAULT_MINIMUM,  \
+   0, NUM_PLUGIN_OPERATIONS - 1}
+#define VALUE_HINT \
+  {LADSPA_HINT_BOUNDED_BELOW | LADSPA_HINT_BOUNDED_ABOVE | \
+       LADSPA_HINT_INTEGER | LADSPA_HINT_DEFAULT_0,        \
+   0, 4096}
+
+const LADSPA_PortRangeHint badizer_port_hints[PORT_COUNT] = {
+    {0, 0, 0},
+    {0, 0, 0},
+    {LADSPA_HINT_BOUNDED_BELOW | LADSPA_HINT_BOUNDED_ABOVE |
+         LADSPA_HINT_INTEGER | LADSPA_HINT_DEFAULT_MAXIMUM,
+     8, 16},
+    OPERATION_HINT,
+    VALUE_HINT,
+    OPERATION_HINT,
+    VALUE_HINT,
+    OPERATION_HINT,
+    VALUE_HINT,
+};
+
+const LADSPA_Descriptor badizer_descriptor = {
+    .UniqueID = 4517,
+    .Label = "soundbadizer",
+    .Properties = LADSPA_PROPERTY_REALTIME | LADSPA_PROPERTY_HARD_RT_CAPABLE,
+    .Name = "Soundbadizer",
+    .Maker = "soundbadizer",
+    .Copyright = "See LICENSE",
+    .PortCount = PORT_COUNT,
+    .PortDescriptors = badizer_port_descriptors,
+    .PortNames = badizer_port_names,
+    .PortRangeHints = badizer_port_hints,
+    .instantiate = instantiate_badizer,
+    .connect_port = connect_badizer_port,
+    .activate = activate_badizer,
+    .run = run_badizer,
+    .cleanup = cleanup_badizer,
+};
+
+const LADSPA_Descriptor *ladspa_descriptor(unsigned long index) {
+  return index == 0 ? &badizer_descriptor : NULL;
+}
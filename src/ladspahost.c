@@ -0,0 +1,201 @@
+// Headless host for the LADSPA plugin. Drives it with small blocks of a test
+// signal, changing the controls every few blocks, and reports the worst-case
+// time per block against the real-time budget of that block size.
+//
+// gcc -O2 -Wall -o ladspahost src/ladspahost.c -ldl
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <ladspa.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_PORTS 64
+#define MAX_BLOCK 4096
+#define CONTROL_CHANGE_INTERVAL 16
+
+const unsigned long block_sizes[] = {16, 32, 64, 128, 256, 512};
+
+#define NUM_BLOCK_SIZES (sizeof(block_sizes) / sizeof(block_sizes[0]))
+
+uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+uint32_t next_random(uint32_t *state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 17;
+  *state ^= *state << 5;
+  return *state;
+}
+
+// Picks a random control value inside the port's bounds.
+LADSPA_Data random_control(const LADSPA_PortRangeHint *hint, uint32_t *state) {
+  LADSPA_Data low = LADSPA_IS_HINT_BOUNDED_BELOW(hint->HintDescriptor)
+                        ? hint->LowerBound
+                        : 0.0f;
+  LADSPA_Data high = LADSPA_IS_HINT_BOUNDED_ABOVE(hint->HintDescriptor)
+                         ? hint->UpperBound
+                         : 1.0f;
+  LADSPA_Data value = low + (high - low) * (next_random(state) / 4294967296.0f);
+  if (LADSPA_IS_HINT_INTEGER(hint->HintDescriptor)) {
+    value = (LADSPA_Data)(long)(value + 0.5f);
+  }
+  return value;
+}
+
+// Runs one block size for seconds of audio and prints the timing. Returns 1
+// when every block finished inside its budget.
+int run_block_size(const LADSPA_Descriptor *descriptor,
+                   unsigned long sample_rate, double seconds,
+                   unsigned long block_size, LADSPA_Data *input,
+                   LADSPA_Data *output, LADSPA_Data *controls) {
+  LADSPA_Handle instance = descriptor->instantiate(descriptor, sample_rate);
+  if (!instance) {
+    printf("Error: cannot instantiate %s\n", descriptor->Label);
+    return 0;
+  }
+
+  for (unsigned long port = 0; port < descriptor->PortCount; port++) {
+    LADSPA_PortDescriptor port_descriptor = descriptor->PortDescriptors[port];
+    if (LADSPA_IS_PORT_CONTROL(port_descriptor)) {
+      descriptor->connect_port(instance, port, &controls[port]);
+    } else if (LADSPA_IS_PORT_INPUT(port_descriptor)) {
+      descriptor->connect_port(instance, port, input);
+    } else {
+      descriptor->connect_port(instance, port, output);
+    }
+  }
+  if (descriptor->activate) {
+    descriptor->activate(instance);
+  }
+
+  uint32_t random_state = 0x9E3779B9u;
+  uint64_t block_count = (uint64_t)(seconds * sample_rate) / block_size;
+  uint64_t budget_ns = 1000000000ull * block_size / sample_rate;
+  uint64_t worst_ns = 0;
+  uint64_t total_ns = 0;
+  uint64_t overruns = 0;
+  double phase = 0.0;
+
+  for (uint64_t b = 0; b < block_count; b++) {
+    for (unsigned long i = 0; i < block_size; i++) {
+      phase += 440.0 / sample_rate;
+      if (phase >= 1.0) {
+        phase -= 1.0;
+      }
+      // Triangle plus a little noise, so every code path sees varied input.
+      LADSPA_Data triangle = (LADSPA_Data)(4.0 * (phase < 0.5 ? phase
+                                                              : 1.0 - phase) -
+                                           1.0);
+      input[i] = 0.8f * triangle +
+                 0.1f * (next_random(&random_state) / 2147483648.0f - 1.0f);
+    }
+
+    if (b % CONTROL_CHANGE_INTERVAL == 0) {
+      for (unsigned long port = 0; port < descriptor->PortCount; port++) {
+        if (LADSPA_IS_PORT_CONTROL(descriptor->PortDescriptors[port]) &&
+            LADSPA_IS_PORT_INPUT(descriptor->PortDescriptors[port])) {
+          controls[port] =
+              random_control(&descriptor->PortRangeHints[port], &random_state);
+        }
+      }
+    }
+
+    uint64_t start = now_ns();
+    descriptor->run(instance, block_size);
+    uint64_t elapsed = now_ns() - start;
+
+    total_ns += elapsed;
+    if (elapsed > worst_ns) {
+      worst_ns = elapsed;
+    }
+    if (elapsed > budget_ns) {
+      overruns++;
+    }
+  }
+
+  if (descriptor->deactivate) {
+    descriptor->deactivate(instance);
+  }
+  descriptor->cleanup(instance);
+
+  printf("%5lu frames: budget %8.2f us, worst %8.2f us (%5.2f%%), mean %8.3f "
+         "us, %llu/%llu blocks over budget\n",
+         block_size, budget_ns / 1000.0, worst_ns / 1000.0,
+         100.0 * worst_ns / budget_ns,
+         block_count ? total_ns / 1000.0 / block_count : 0.0,
+         (unsigned long long)overruns, (unsigned long long)block_count);
+  return overruns == 0;
+}
+
+void print_usage(const char *program_name) {
+  printf("Usage: %s <plugin.so> [label] [sample_rate] [seconds]\n",
+         program_name);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2 || argc > 5) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  const char *label = argc > 2 ? argv[2] : NULL;
+  unsigned long sample_rate = argc > 3 ? strtoul(argv[3], NULL, 10) : 48000;
+  double seconds = argc > 4 ? atof(argv[4]) : 10.0;
+  if (sample_rate == 0 || seconds <= 0.0) {
+    printf("Error: invalid sample rate or duration\n");
+    return 1;
+  }
+
+  void *library = dlopen(argv[1], RTLD_NOW | RTLD_LOCAL);
+  if (!library) {
+    printf("Error: %s\n", dlerror());
+    return 1;
+  }
+  LADSPA_Descriptor_Function descriptor_function =
+      (LADSPA_Descriptor_Function)dlsym(library, "ladspa_descriptor");
+  if (!descriptor_function) {
+    printf("Error: %s is not a LADSPA plugin\n", argv[1]);
+    dlclose(library);
+    return 1;
+  }
+
+  const LADSPA_Descriptor *descriptor = NULL;
+  for (unsigned long i = 0; (descriptor = descriptor_function(i)); i++) {
+    if (!label || strcmp(descriptor->Label, label) == 0) {
+      break;
+    }
+  }
+  if (!descriptor || descriptor->PortCount > MAX_PORTS) {
+    printf("Error: no usable plugin found in %s\n", argv[1]);
+    dlclose(library);
+    return 1;
+  }
+
+  static LADSPA_Data input[MAX_BLOCK];
+  static LADSPA_Data output[MAX_BLOCK];
+  static LADSPA_Data controls[MAX_PORTS];
+
+  printf("%s (%lu) at %lu Hz, %.1f s per block size\n", descriptor->Name,
+         descriptor->UniqueID, sample_rate, seconds);
+  int in_budget = 1;
+  for (size_t i = 0; i < NUM_BLOCK_SIZES; i++) {
+    if (!run_block_size(descriptor, sample_rate, seconds, block_sizes[i],
+                        input, output, controls)) {
+      in_budget = 0;
+    }
+  }
+
+  dlclose(library);
+  if (!in_budget) {
+    printf("Some blocks missed their real-time budget\n");
+    return 1;
+  }
+  printf("Done!\n");
+  return 0;
+}
@@ -0,0 +1,48 @@
+#!/bin/sh
+# Checks that --follow on a WAV that grows while it is being rendered gives
+# the same file as a normal render of the finished WAV, with a stateful frame
+# op whose groups straddle the batch boundaries.
+#
+# sh tests/follow.sh
+set -e
+cd "$(dirname "$0")/.."
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+gcc -O2 -Wall -o "$dir/soundbadizer" src/console.c -lm -lpthread
+
+# Writes 16-bit stereo noise in steps of 300001 bytes, then finalizes the
+# data size like a recorder that stops.
+python3 - "$dir/input.wav" <<'PY' &
+import random, struct, sys, time
+random.seed(7)
+data = random.randbytes(4 * 44100 * 5)
+with open(sys.argv[1], "wb") as f:
+    f.write(b"RIFF" + struct.pack("<I", 0) + b"WAVEfmt " +
+            struct.pack("<IHHIIHH", 16, 1, 2, 44100, 44100 * 4, 4, 16) +
+            b"data" + struct.pack("<I", 0))
+    f.flush()
+    for i in range(0, len(data), 300001):
+        f.write(data[i:i + 300001])
+        f.flush()
+        time.sleep(0.2)
+    f.seek(4)
+    f.write(struct.pack("<I", 36 + len(data)))
+    f.seek(40)
+    f.write(struct.pack("<I", len(data)))
+PY
+writer=$!
+
+sleep 0.1
+"$dir/soundbadizer" "$dir/input.wav" "$dir/followed.wav" --decimate 7 \
+    --follow --follow-idle 3 > /dev/null
+wait $writer
+"$dir/soundbadizer" "$dir/input.wav" "$dir/normal.wav" --decimate 7 \
+    > /dev/null
+
+if cmp "$dir/followed.wav" "$dir/normal.wav"; then
+  echo "follow: ok"
+else
+  echo "follow: followed render differs from a normal render"
+  exit 1
+fi